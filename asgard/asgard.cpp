@@ -21,13 +21,20 @@
 #include "utils/zmq.h"
 
 #include "asgard/asgard_conf.h"
+#include "asgard/fallback_table.h"
+#include "asgard/matrix_cache.h"
+#include "asgard/matrix_pool.h"
 #include "asgard/metrics.h"
 #include "asgard/projector.h"
 #include "asgard/request.pb.h"
+#include "asgard/warmup.h"
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread.hpp>
 
+#include <chrono>
+#include <thread>
+
 using namespace valhalla;
 
 static void respond(zmq::socket_t& socket,
@@ -84,6 +91,36 @@ static void worker(const asgard::Context& context) {
     }
 }
 
+static void snapshot_projector(const asgard::Projector& projector,
+                               const boost::property_tree::ptree& graph_conf,
+                               const std::string& snapshot_path,
+                               size_t snapshot_interval) {
+    valhalla::baldr::GraphReader graph(graph_conf);
+    auto last_snapshot = std::chrono::steady_clock::now();
+
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        const auto now = std::chrono::steady_clock::now();
+        const bool periodic = snapshot_interval > 0 && now - last_snapshot >= std::chrono::seconds(snapshot_interval);
+
+        if (asgard::snapshot_requested || asgard::shutdown_requested || periodic) {
+            asgard::snapshot_requested = 0;
+            last_snapshot = now;
+            try {
+                const auto nb_entries = projector.save(snapshot_path, graph);
+                LOG_INFO(std::to_string(nb_entries) + " projections saved in " + snapshot_path);
+            } catch (const std::exception& e) {
+                LOG_ERROR(std::string("Cannot save the projector snapshot: ") + e.what());
+            }
+        }
+
+        if (asgard::shutdown_requested) {
+            LOG_INFO("Process terminated by signal");
+            exit(0);
+        }
+    }
+}
+
 int main() {
     asgard::init_app();
 
@@ -92,23 +129,129 @@ int main() {
     boost::thread_group threads;
     zmq::context_t context(1);
     LoadBalancer lb(context);
-    lb.bind(asgard_conf.socket_path, "inproc://workers");
     const asgard::Metrics metrics(asgard_conf);
-    const asgard::Projector projector(asgard_conf.cache_size["walking"],
-                                      asgard_conf.cache_size["bike"],
-                                      asgard_conf.cache_size["car"],
-                                      asgard_conf.reachability,
-                                      asgard_conf.radius);
+    // as it always was: the radius is the min inbound reach, and the loki search radius is 0
+    asgard::Projector projector(asgard_conf.cache_size["walking"],
+                                asgard_conf.cache_size["bike"],
+                                asgard_conf.cache_size["car"],
+                                asgard_conf.cache_size["taxi"],
+                                asgard_conf.reachability,
+                                asgard_conf.radius,
+                                0,
+                                asgard_conf.projector_cache_conf);
+    if (asgard_conf.nb_projection_threads > 0) {
+        projector.set_projection_pool(std::make_shared<asgard::ProjectionPool>(asgard_conf.valhalla_conf.get_child("mjolnir"),
+                                                                               asgard_conf.nb_projection_threads,
+                                                                               asgard_conf.projection_batch_size));
+    }
     valhalla::baldr::GraphReader graph(asgard_conf.valhalla_conf.get_child("mjolnir"));
 
+    if (asgard_conf.edge_index) {
+        const auto start = std::chrono::steady_clock::now();
+        projector.set_edge_index(std::make_shared<asgard::EdgeIndex>(graph));
+        const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+        LOG_INFO("Edge index built in " + std::to_string(duration.count()) + "s");
+        graph.Clear();
+    }
+
+    if (asgard_conf.shared_cache_path) {
+        try {
+            projector.set_shared_cache(std::make_shared<asgard::SharedProjectorCache>(*asgard_conf.shared_cache_path,
+                                                                                      projector.make_snapshot_header(graph),
+                                                                                      asgard_conf.projector_cache_conf.key_precision,
+                                                                                      asgard_conf.shared_cache_size,
+                                                                                      asgard_conf.shared_cache_slot_size));
+            LOG_INFO("Projector cache shared in " + *asgard_conf.shared_cache_path);
+        } catch (const std::exception& e) {
+            LOG_ERROR(std::string("Cannot map the shared projector cache: ") + e.what());
+        }
+    }
+
+    if (asgard_conf.projector_snapshot_path) {
+        try {
+            projector.load(*asgard_conf.projector_snapshot_path, graph);
+        } catch (const std::exception& e) {
+            LOG_ERROR(std::string("Cannot load the projector snapshot: ") + e.what());
+        }
+        asgard::init_snapshot_signal_handling();
+        threads.create_thread(std::bind(&snapshot_projector,
+                                        std::cref(projector),
+                                        asgard_conf.valhalla_conf.get_child("mjolnir"),
+                                        *asgard_conf.projector_snapshot_path,
+                                        asgard_conf.projector_snapshot_interval));
+    }
+
+    if (asgard_conf.warmup_file) {
+        try {
+            const auto start = std::chrono::steady_clock::now();
+            const auto locations = asgard::warmup::read_warmup_file(*asgard_conf.warmup_file);
+            const auto nb_projections = asgard::warmup::warmup_projector(projector,
+                                                                          locations,
+                                                                          asgard_conf.valhalla_conf.get_child("mjolnir"),
+                                                                          asgard_conf.nb_threads);
+            const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+            LOG_INFO("Warmup: " + std::to_string(nb_projections) + " projections done in " + std::to_string(duration.count()) + "s");
+        } catch (const std::exception& e) {
+            LOG_ERROR(std::string("Warmup failed: ") + e.what());
+        }
+    }
+
+    std::unique_ptr<const asgard::MatrixCache> matrix_cache;
+    if (asgard_conf.matrix_cache_size > 0) {
+        matrix_cache = std::make_unique<const asgard::MatrixCache>(asgard_conf.matrix_cache_size,
+                                                                   asgard_conf.matrix_cache_row_size,
+                                                                   asgard_conf.matrix_tree_cache_size);
+    }
+
+    std::unique_ptr<const asgard::FallbackTable> fallback_table;
+    if (asgard_conf.fallback_table_path) {
+        try {
+            auto table = std::make_unique<const asgard::FallbackTable>(*asgard_conf.fallback_table_path);
+            if (table->get_tileset_fingerprint() == asgard::get_tileset_fingerprint(graph)) {
+                fallback_table = std::move(table);
+                LOG_INFO("Fallback table loaded from " + *asgard_conf.fallback_table_path);
+            } else {
+                LOG_ERROR("Fallback table " + *asgard_conf.fallback_table_path + " has not been computed for this tileset, it is not used");
+            }
+        } catch (const std::exception& e) {
+            LOG_ERROR(std::string("Cannot load the fallback table: ") + e.what());
+        }
+    }
+
+    std::unique_ptr<const asgard::MatrixPool> matrix_pool;
+    if (asgard_conf.nb_matrix_threads > 0) {
+        matrix_pool = std::make_unique<const asgard::MatrixPool>(asgard_conf.valhalla_conf.get_child("mjolnir"),
+                                                                 asgard_conf.nb_matrix_threads,
+                                                                 asgard_conf.matrix_min_split_size);
+    }
+
+    boost::optional<float> crow_fly_margin;
+    if (asgard_conf.crow_fly_filter) {
+        crow_fly_margin = asgard_conf.crow_fly_margin;
+    }
+
+    // The socket is bound only once the caches are warm, so no request is
+    // sent to an instance which is not ready yet
+    lb.bind(asgard_conf.socket_path, "inproc://workers");
+
     for (size_t i = 0; i < asgard_conf.nb_threads; ++i) {
         threads.create_thread(std::bind(&worker, asgard::Context(context,
                                                                  graph,
                                                                  metrics,
                                                                  projector,
-                                                                 asgard_conf.valhalla_service_url)));
+                                                                 asgard_conf.valhalla_service_url,
+                                                                 matrix_cache.get(),
+                                                                 fallback_table.get(),
+                                                                 matrix_pool.get(),
+                                                                 asgard_conf.matrix_auto_direction,
+                                                                 crow_fly_margin,
+                                                                 asgard_conf.matrix_engine,
+                                                                 asgard_conf.with_cost_matrix)));
     }
 
+    metrics.set_ready();
+    LOG_INFO("Asgard is ready");
+
     // Connect worker threads to client threads via a queue
     while (true) {
         try {
@@ -1,5 +1,8 @@
 #pragma once
 
+#include "asgard/bucket_matrix.h"
+#include "asgard/projector_cache.h"
+
 #include <valhalla/midgard/logging.h>
 
 #include <boost/filesystem.hpp>
@@ -39,7 +42,28 @@ namespace ptree = boost::property_tree;
 struct AsgardConf {
     std::string socket_path;
     std::unordered_map<std::string, std::size_t> cache_size;
+    ProjectorCacheConf projector_cache_conf;
+    boost::optional<std::string> projector_snapshot_path;
+    boost::optional<std::string> shared_cache_path;
+    std::size_t shared_cache_size;
+    std::size_t shared_cache_slot_size;
+    std::size_t matrix_cache_size;
+    std::size_t matrix_cache_row_size;
+    std::size_t matrix_tree_cache_size;
+    boost::optional<std::string> fallback_table_path;
+    std::size_t projector_snapshot_interval;
+    boost::optional<std::string> warmup_file;
     std::size_t nb_threads;
+    std::size_t nb_projection_threads;
+    std::size_t projection_batch_size;
+    std::size_t nb_matrix_threads;
+    std::size_t matrix_min_split_size;
+    bool matrix_auto_direction;
+    MatrixEngine matrix_engine;
+    bool with_cost_matrix;
+    bool crow_fly_filter;
+    float crow_fly_margin;
+    bool edge_index;
     ptree::ptree valhalla_conf;
     boost::optional<std::string> metrics_binding;
     boost::optional<std::string> valhalla_service_url;
@@ -53,7 +77,56 @@ struct AsgardConf {
         cache_size["walking"] = get_config<size_t>("ASGARD_WALKING_CACHE_SIZE", 50000).get();
         cache_size["bike"] = get_config<size_t>("ASGARD_BIKE_CACHE_SIZE", 50000).get();
         cache_size["car"] = get_config<size_t>("ASGARD_CAR_CACHE_SIZE", 50000).get();
+        cache_size["taxi"] = get_config<size_t>("ASGARD_TAXI_CACHE_SIZE", 50000).get();
+        projector_cache_conf.nb_shards = get_config<size_t>("ASGARD_PROJECTOR_CACHE_SHARDS", projector_cache_conf.nb_shards).get();
+        projector_cache_conf.policy = parse_cache_policy(get_config<std::string>("ASGARD_PROJECTOR_CACHE_POLICY", to_string(projector_cache_conf.policy)).get());
+        // in bytes, shared by all the modes, 0 means that only the cache sizes above apply
+        projector_cache_conf.max_bytes = get_config<size_t>("ASGARD_PROJECTOR_CACHE_MAX_BYTES", projector_cache_conf.max_bytes).get();
+        projector_cache_conf.negative_cache_size = get_config<size_t>("ASGARD_NEGATIVE_CACHE_SIZE", projector_cache_conf.negative_cache_size).get();
+        // in seconds
+        projector_cache_conf.negative_cache_ttl = get_config<size_t>("ASGARD_NEGATIVE_CACHE_TTL", projector_cache_conf.negative_cache_ttl).get();
+        // in degrees, e.g. 1e-5 (about a meter), 0 keeps the exact coordinates in the cache keys
+        projector_cache_conf.key_precision = get_config<double>("ASGARD_PROJECTOR_KEY_PRECISION", projector_cache_conf.key_precision).get();
+        // in meters, 0 reuses a cached projection for any place of the same key
+        projector_cache_conf.key_tolerance = get_config<double>("ASGARD_PROJECTOR_KEY_TOLERANCE", projector_cache_conf.key_tolerance).get();
+        // a file shared by the asgard processes of the host, e.g. in /dev/shm
+        shared_cache_path = get_config<std::string>("ASGARD_SHARED_CACHE_PATH", boost::none);
+        shared_cache_size = get_config<size_t>("ASGARD_SHARED_CACHE_SIZE", 150000).get();
+        // in bytes, the larger projections are not shared
+        shared_cache_slot_size = get_config<size_t>("ASGARD_SHARED_CACHE_SLOT_SIZE", 512).get();
+        // rows of one-to-many matrices, 0 disables the matrix cache
+        matrix_cache_size = get_config<size_t>("ASGARD_MATRIX_CACHE_SIZE", 0).get();
+        matrix_cache_row_size = get_config<size_t>("ASGARD_MATRIX_CACHE_ROW_SIZE", 10000).get();
+        matrix_tree_cache_size = get_config<size_t>("ASGARD_MATRIX_TREE_CACHE_SIZE", 0).get();
+        // the times between the stops written by asgard_fallback_table
+        fallback_table_path = get_config<std::string>("ASGARD_FALLBACK_TABLE_PATH", boost::none);
+        projector_snapshot_path = get_config<std::string>("ASGARD_PROJECTOR_SNAPSHOT_PATH", boost::none);
+        // in seconds, 0 means the snapshot is only written on SIGUSR1 and at shutdown
+        projector_snapshot_interval = get_config<size_t>("ASGARD_PROJECTOR_SNAPSHOT_INTERVAL", 0).get();
+        warmup_file = get_config<std::string>("ASGARD_WARMUP_FILE", boost::none);
         nb_threads = get_config<size_t>("ASGARD_NB_THREADS", 3).get();
+        // threads shared by the workers to split the large projections, 0 means no split
+        nb_projection_threads = get_config<size_t>("ASGARD_PROJECTION_THREADS", 0).get();
+        projection_batch_size = get_config<size_t>("ASGARD_PROJECTION_BATCH_SIZE", 250).get();
+        // threads shared by the workers to split the many-to-many matrices by source, 0 means no split
+        nb_matrix_threads = get_config<size_t>("ASGARD_MATRIX_THREADS", 0).get();
+        // in number of costs, the smaller matrices are computed by the worker alone
+        matrix_min_split_size = get_config<size_t>("ASGARD_MATRIX_MIN_SPLIT_SIZE", 10000).get();
+        // expand the matrices from the targets when they are fewer than the sources, off by default:
+        // a search from the targets is not checked to give the same times as the one from the sources
+        matrix_auto_direction = get_config<bool>("ASGARD_MATRIX_AUTO_DIRECTION", false).get();
+        // expansion or bucket, for the walking and bike many-to-many matrices
+        matrix_engine = parse_matrix_engine(get_config<std::string>("ASGARD_MATRIX_ENGINE", to_string(MatrixEngine::expansion)).get());
+        // compute the car and taxi many-to-many matrices with CostMatrix when it is expected to be faster, off by
+        // default: the crossover with TimeDistanceMatrix is estimated, not measured
+        with_cost_matrix = get_config<bool>("ASGARD_COST_MATRIX", false).get();
+        // neither project nor search the targets further from all the sources than the max duration at the top
+        // speed of the mode, off by default: a target only reached through a ferry can be further
+        crow_fly_filter = get_config<bool>("ASGARD_CROW_FLY_FILTER", false).get();
+        // in meters, added to the crow fly distance for the places projected away from their coordinates
+        crow_fly_margin = get_config<float>("ASGARD_CROW_FLY_MARGIN", 500).get();
+        // build an index of the edges at startup to project without loki
+        edge_index = get_config<bool>("ASGARD_EDGE_INDEX", false).get();
         metrics_binding = get_config<std::string>("ASGARD_METRICS_BINDING", std::string("0.0.0.0:8080"));
         valhalla_service_url = get_config<std::string>("ASGARD_VALHALLA_SERVICE_URL", boost::none);
         auto valhalla_conf_json = get_config<std::string>("ASGARD_VALHALLA_CONF", std::string("/data/valhalla/valhalla.json")).get();
@@ -0,0 +1,144 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#include "asgard/bucket_matrix.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace asgard {
+
+namespace {
+
+// Of the max distance, for each expansion. Half would do with an exact
+// priority queue: the two halves of a path within the max distance meet on
+// an edge. The queue of valhalla only sorts the labels by buckets of the
+// unit size of the costing, so an expansion can stop a bucket before its
+// threshold; the 5% on top cover that with room to spare. It has not been
+// tuned, a larger ratio only makes the expansions longer, and lets the
+// buckets reach a few pairs a bit beyond the max distance.
+const float SEARCH_RATIO = 0.55f;
+
+// The cost of a path going through the edge of both labels, none if there is no such path
+bool join(const ExpansionLabel& forward, const ExpansionLabel& backward, float& cost, valhalla::thor::TimeDistance& result) {
+    if (forward.origin && backward.origin) {
+        // both locations are on the edge, only reachable along it if the target is after the source
+        if (backward.percent_along < forward.percent_along || forward.percent_along >= 1.f) {
+            return false;
+        }
+        const float ratio = (backward.percent_along - forward.percent_along) / (1.f - forward.percent_along);
+        cost = forward.cost * ratio;
+        result = valhalla::thor::TimeDistance(static_cast<uint32_t>(forward.secs * ratio),
+                                              static_cast<uint32_t>(forward.distance * ratio));
+        return true;
+    }
+    // the edge is in both labels, unless one of them only covers the part of the edge of its location
+    const auto& edge = forward.origin ? backward : forward;
+    cost = forward.cost + backward.cost - edge.edge_cost;
+    result = valhalla::thor::TimeDistance(static_cast<uint32_t>(forward.secs + backward.secs - edge.edge_secs),
+                                          static_cast<uint32_t>(forward.distance + backward.distance - edge.edge_length));
+    return true;
+}
+
+} // namespace
+
+MatrixEngine parse_matrix_engine(const std::string& engine) {
+    if (engine == "expansion") {
+        return MatrixEngine::expansion;
+    }
+    if (engine == "bucket") {
+        return MatrixEngine::bucket;
+    }
+    throw std::invalid_argument("Unknown matrix engine: " + engine);
+}
+
+std::string to_string(MatrixEngine engine) {
+    switch (engine) {
+    case MatrixEngine::expansion: return "expansion";
+    case MatrixEngine::bucket: return "bucket";
+    default: throw std::invalid_argument("Bad to_string(MatrixEngine) parameter");
+    }
+}
+
+std::vector<valhalla::thor::TimeDistance> BucketMatrix::source_to_target(const google::protobuf::RepeatedPtrField<valhalla::Location>& sources,
+                                                                         const google::protobuf::RepeatedPtrField<valhalla::Location>& targets,
+                                                                         valhalla::baldr::GraphReader& graph,
+                                                                         ReusableTimeDistanceMatrix& matrix,
+                                                                         const Costing& costing,
+                                                                         valhalla::sif::TravelMode mode,
+                                                                         float max_distance) {
+    const google::protobuf::RepeatedPtrField<valhalla::Location> no_location;
+    const float search_distance = max_distance * SEARCH_RATIO;
+    const size_t nb_targets = targets.size();
+
+    // a path settled by the forward expansion up to its target ends on an edge of the target
+    target_edges.clear();
+    for (const auto& target : targets) {
+        for (const auto& path_edge : target.path_edges()) {
+            target_edges.push_back(path_edge.graph_id());
+        }
+    }
+    std::sort(target_edges.begin(), target_edges.end());
+
+    buckets.clear();
+    for (int s = 0; s < sources.size(); ++s) {
+        // without targets, so that the expansion goes up to the distance
+        matrix.one_to_many(sources.Get(s), no_location, graph, costing, mode, search_distance);
+        matrix.get_labels(graph, sources.Get(s), false, labels);
+        matrix.Clear();
+        // the expansion stops on the first label beyond the distance, settled but not expanded: the most costly one
+        float last_settled = 0;
+        for (const auto& label : labels) {
+            if (label.settled) {
+                last_settled = std::max(last_settled, label.cost);
+            }
+        }
+        for (const auto& label : labels) {
+            if (!label.settled || label.cost >= last_settled || std::binary_search(target_edges.begin(), target_edges.end(), label.edge)) {
+                buckets.push_back(Entry{static_cast<uint32_t>(s), label});
+            }
+        }
+        if (graph.OverCommitted()) { graph.Clear(); }
+    }
+    std::sort(buckets.begin(), buckets.end(), [](const Entry& a, const Entry& b) { return a.label.edge < b.label.edge; });
+
+    std::vector<valhalla::thor::TimeDistance> result(sources.size() * nb_targets,
+                                                     valhalla::thor::TimeDistance(valhalla::thor::kMaxCost, valhalla::thor::kMaxCost));
+    best_costs.assign(result.size(), std::numeric_limits<float>::max());
+    float cost = 0;
+    valhalla::thor::TimeDistance joined;
+    for (size_t t = 0; t < nb_targets; ++t) {
+        matrix.many_to_one(targets.Get(t), no_location, graph, costing, mode, search_distance);
+        matrix.get_labels(graph, targets.Get(t), true, labels);
+        matrix.Clear();
+        for (const auto& label : labels) {
+            auto it = std::lower_bound(buckets.begin(), buckets.end(), label.edge, [](const Entry& e, uint64_t edge) { return e.label.edge < edge; });
+            for (; it != buckets.end() && it->label.edge == label.edge; ++it) {
+                const auto position = it->source * nb_targets + t;
+                if (join(it->label, label, cost, joined) && cost < best_costs[position]) {
+                    best_costs[position] = cost;
+                    result[position] = joined;
+                }
+            }
+        }
+        if (graph.OverCommitted()) { graph.Clear(); }
+    }
+    return result;
+}
+
+} // namespace asgard
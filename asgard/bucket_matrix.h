@@ -0,0 +1,88 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "asgard/mode_costing.h"
+#include "asgard/shortest_path_tree.h"
+
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/proto/tripcommon.pb.h>
+#include <valhalla/sif/costconstants.h>
+#include <valhalla/thor/timedistancematrix.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace asgard {
+
+enum class MatrixEngine {
+    // one expansion per source, or per target, of TimeDistanceMatrix
+    expansion,
+    // an expansion from every source and every target, to half the distance,
+    // joined on the edges they share (see BucketMatrix)
+    bucket
+};
+
+MatrixEngine parse_matrix_engine(const std::string& engine);
+std::string to_string(MatrixEngine engine);
+
+/**
+ * Many-to-many matrices from buckets of labels, instead of one full
+ * expansion per source.
+ *
+ * Every source is expanded forward and every target backward, each to a
+ * bit more than half of the max distance, with TimeDistanceMatrix. A
+ * shortest path within the max distance has an edge labeled exactly by
+ * both expansions: the first edge its forward expansion did not expand.
+ * So only the labels of the sources which were not expanded, and the ones on
+ * the edges of the targets, are kept in the buckets, sorted by edge. Each label of
+ * a target is then joined with the bucket of its edge:
+ *
+ *   cost(source, target) = min over the edges of forward + backward - edge
+ *
+ * Each search covers about a third (0.55²) of the area of a full one, so
+ * this should win when the sides of the matrix are close in size, and the
+ * expansion of the smaller side otherwise: benchmark_matrix --compare_engines
+ * times both, with CostMatrix, on the same projections.
+ */
+class BucketMatrix {
+public:
+    // The costs are sorted by source then by target, as SourceToTarget's
+    std::vector<valhalla::thor::TimeDistance> source_to_target(const google::protobuf::RepeatedPtrField<valhalla::Location>& sources,
+                                                               const google::protobuf::RepeatedPtrField<valhalla::Location>& targets,
+                                                               valhalla::baldr::GraphReader& graph,
+                                                               ReusableTimeDistanceMatrix& matrix,
+                                                               const Costing& costing,
+                                                               valhalla::sif::TravelMode mode,
+                                                               float max_distance);
+
+private:
+    struct Entry {
+        uint32_t source;
+        ExpansionLabel label;
+    };
+
+    // sorted by edge, reused from one matrix to the other
+    std::vector<Entry> buckets;
+    std::vector<ExpansionLabel> labels;
+    std::vector<uint64_t> target_edges;
+    std::vector<float> best_costs;
+};
+
+} // namespace asgard
@@ -0,0 +1,158 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#include "asgard/compact_projection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace asgard {
+
+namespace {
+
+const double COORD_PRECISION = 1e7;
+
+int32_t to_fixed_point(double coord) {
+    return static_cast<int32_t>(std::lround(coord * COORD_PRECISION));
+}
+
+double from_fixed_point(int32_t coord) {
+    return coord / COORD_PRECISION;
+}
+
+uint16_t saturate(unsigned int reach) {
+    return static_cast<uint16_t>(std::min<unsigned int>(reach, std::numeric_limits<uint16_t>::max()));
+}
+
+} // namespace
+
+static_assert(sizeof(CompactEdge) == 40, "CompactEdge should stay packed in 40 bytes");
+
+CompactProjection::CompactProjection(const valhalla::baldr::PathLocation& location) : origin_lng(to_fixed_point(location.latlng_.lng())),
+                                                                                      origin_lat(to_fixed_point(location.latlng_.lat())) {
+    edges.reserve(location.edges.size() + location.filtered_edges.size());
+    pack(location.edges, false);
+    pack(location.filtered_edges, true);
+}
+
+CompactProjection::CompactProjection(const valhalla::baldr::PathLocation& location, const valhalla::Location& pbf) : CompactProjection(location) {
+    if (static_cast<size_t>(pbf.path_edges_size()) != location.edges.size() ||
+        static_cast<size_t>(pbf.filtered_edges_size()) != location.filtered_edges.size()) {
+        return;
+    }
+    // the edges are packed in the same order
+    auto edge = edges.begin();
+    for (const auto* pbf_edges : {&pbf.path_edges(), &pbf.filtered_edges()}) {
+        for (const auto& pbf_edge : *pbf_edges) {
+            edge->nb_names = static_cast<uint8_t>(std::min<int>(pbf_edge.names_size(), std::numeric_limits<uint8_t>::max()));
+            for (int i = 0; i < edge->nb_names; ++i) {
+                names.append(pbf_edge.names(i));
+                names.push_back('\0');
+            }
+            ++edge;
+        }
+    }
+}
+
+void CompactProjection::pack(const std::vector<PathEdge>& path_edges, bool filtered) {
+    for (const auto& e : path_edges) {
+        edges.push_back(CompactEdge{static_cast<uint64_t>(e.id),
+                                    e.percent_along,
+                                    to_fixed_point(e.projected.lng()),
+                                    to_fixed_point(e.projected.lat()),
+                                    e.distance,
+                                    saturate(e.outbound_reach),
+                                    saturate(e.inbound_reach),
+                                    static_cast<uint8_t>(e.sos),
+                                    filtered,
+                                    0});
+    }
+}
+
+CompactProjection::PathEdge CompactProjection::unpack(const CompactEdge& e) {
+    return PathEdge(valhalla::baldr::GraphId(e.id),
+                    e.percent_along,
+                    valhalla::midgard::PointLL{from_fixed_point(e.projected_lng), from_fixed_point(e.projected_lat)},
+                    e.distance,
+                    static_cast<valhalla::baldr::PathLocation::SideOfStreet>(e.sos),
+                    e.outbound_reach,
+                    e.inbound_reach);
+}
+
+std::vector<CompactProjection::PathEdge> CompactProjection::unpack(bool filtered) const {
+    std::vector<PathEdge> path_edges;
+    for (const auto& e : edges) {
+        if (e.filtered == filtered) {
+            path_edges.push_back(unpack(e));
+        }
+    }
+    return path_edges;
+}
+
+valhalla::midgard::PointLL CompactProjection::get_origin() const {
+    return {from_fixed_point(origin_lng), from_fixed_point(origin_lat)};
+}
+
+size_t CompactProjection::get_nb_bytes() const {
+    size_t nb_bytes = sizeof(CompactProjection);
+    if (edges.capacity() > nb_inline_edges) {
+        nb_bytes += edges.capacity() * sizeof(CompactEdge);
+    }
+    // short strings are stored inline
+    if (names.capacity() > std::string().capacity()) {
+        nb_bytes += names.capacity() + 1;
+    }
+    return nb_bytes;
+}
+
+valhalla::baldr::PathLocation CompactProjection::to_path_location(const valhalla::baldr::Location& location) const {
+    valhalla::baldr::PathLocation path_location(location);
+    path_location.edges = unpack(false);
+    path_location.filtered_edges = unpack(true);
+    return path_location;
+}
+
+void CompactProjection::to_valhalla_location(const valhalla::baldr::Location& location,
+                                             valhalla::baldr::GraphReader& graph,
+                                             valhalla::Location& pbf) const {
+    // without edges, toPBF only writes the fields of the location and does not read the graph
+    valhalla::baldr::PathLocation::toPBF(valhalla::baldr::PathLocation(location), &pbf, graph);
+    size_t name_begin = 0;
+    for (const auto& compact_edge : edges) {
+        const auto e = unpack(compact_edge);
+        auto* pbf_edge = compact_edge.filtered ? pbf.add_filtered_edges() : pbf.add_path_edges();
+        pbf_edge->set_graph_id(e.id);
+        pbf_edge->set_percent_along(e.percent_along);
+        pbf_edge->mutable_ll()->set_lng(e.projected.lng());
+        pbf_edge->mutable_ll()->set_lat(e.projected.lat());
+        pbf_edge->set_side_of_street(e.sos == valhalla::baldr::PathLocation::LEFT
+                                         ? valhalla::Location::kLeft
+                                         : (e.sos == valhalla::baldr::PathLocation::RIGHT ? valhalla::Location::kRight : valhalla::Location::kNone));
+        pbf_edge->set_distance(e.distance);
+        pbf_edge->set_begin_node(e.begin_node());
+        pbf_edge->set_end_node(e.end_node());
+        pbf_edge->set_outbound_reach(e.outbound_reach);
+        pbf_edge->set_inbound_reach(e.inbound_reach);
+        for (uint8_t i = 0; i < compact_edge.nb_names; ++i) {
+            const auto name_end = names.find('\0', name_begin);
+            pbf_edge->add_names(names.substr(name_begin, name_end - name_begin));
+            name_begin = name_end + 1;
+        }
+    }
+}
+
+} // namespace asgard
@@ -0,0 +1,104 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/baldr/location.h>
+#include <valhalla/baldr/pathlocation.h>
+#include <valhalla/proto/tripcommon.pb.h>
+
+#include <boost/container/small_vector.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace asgard {
+
+// A PathEdge packed in 40 bytes: coordinates are stored in fixed point
+// (1e-7 degree, about 1cm) and the reaches are saturated at 65535.
+// percent_along stays a double, thor interpolates the partial edges with it.
+struct CompactEdge {
+    uint64_t id;
+    double percent_along;
+    int32_t projected_lng;
+    int32_t projected_lat;
+    float distance;
+    uint16_t outbound_reach;
+    uint16_t inbound_reach;
+    uint8_t sos;
+    bool filtered;
+    // in the names of the projection, after the ones of the previous edges
+    uint8_t nb_names;
+};
+
+/**
+ * The result of a projection, as kept in the projector's caches.
+ *
+ * A PathLocation owns a Location (strings, optionals...) and two vectors of
+ * PathEdge, that is several heap blocks per cached coordinate. This class only
+ * keeps the edges, flattened in a single buffer that is stored inline for the
+ * usual projections on 1 or 2 edges. The PathLocation is rebuilt on use.
+ *
+ * The names of the edges are the only part of a valhalla::Location that
+ * PathLocation::toPBF reads from the graph, so they are kept too: a cache
+ * hit builds its valhalla::Location without the graph.
+ */
+class CompactProjection {
+public:
+    using PathEdge = valhalla::baldr::PathLocation::PathEdge;
+
+    CompactProjection() = default;
+    // The edges have no names
+    explicit CompactProjection(const valhalla::baldr::PathLocation& location);
+    // The names of the edges are the ones of pbf, built by PathLocation::toPBF from location
+    CompactProjection(const valhalla::baldr::PathLocation& location, const valhalla::Location& pbf);
+
+    // Rebuild the projection of location
+    valhalla::baldr::PathLocation to_path_location(const valhalla::baldr::Location& location) const;
+    // Write the projection of location in pbf as PathLocation::toPBF does, without reading the graph
+    void to_valhalla_location(const valhalla::baldr::Location& location, valhalla::baldr::GraphReader& graph, valhalla::Location& pbf) const;
+
+    std::vector<PathEdge> get_edges() const { return unpack(false); }
+    std::vector<PathEdge> get_filtered_edges() const { return unpack(true); }
+    size_t get_nb_edges() const { return edges.size(); }
+    // The names of all the edges, each one followed by a '\0'
+    const std::string& get_names() const { return names; }
+    // The place that has been projected
+    valhalla::midgard::PointLL get_origin() const;
+    // Memory used by the projection, the heap blocks it owns included
+    size_t get_nb_bytes() const;
+
+private:
+    // copies the packed edges in and out of its slots
+    friend class SharedProjectorCache;
+
+    static constexpr size_t nb_inline_edges = 2;
+
+    void pack(const std::vector<PathEdge>& path_edges, bool filtered);
+    std::vector<PathEdge> unpack(bool filtered) const;
+    static PathEdge unpack(const CompactEdge& edge);
+
+    boost::container::small_vector<CompactEdge, nb_inline_edges> edges;
+    // in fixed point, like the edges
+    int32_t origin_lng = 0;
+    int32_t origin_lat = 0;
+    // short enough to be stored inline for most of the projections
+    std::string names;
+};
+
+} // namespace asgard
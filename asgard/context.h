@@ -16,8 +16,11 @@
 
 #pragma once
 
+#include "asgard/bucket_matrix.h"
+
 #include <valhalla/baldr/graphreader.h>
 
+#include <boost/optional.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 namespace zmq {
@@ -26,6 +29,9 @@ class context_t;
 
 namespace asgard {
 
+class FallbackTable;
+class MatrixCache;
+class MatrixPool;
 class Metrics;
 class Projector;
 
@@ -35,13 +41,40 @@ struct Context {
     const Metrics& metrics;
     const Projector& projector;
     const boost::optional<std::string>& valhalla_service_url;
+    // nullptr if the matrices are not cached
+    const MatrixCache* matrix_cache;
+    // nullptr if there is no precomputed table between the stops
+    const FallbackTable* fallback_table;
+    // nullptr if the large matrices are not split between threads
+    const MatrixPool* matrix_pool;
+    // false to always expand the matrices from their sources
+    bool matrix_auto_direction;
+    // in meters, added to the max distance of the crow fly filter of the targets, none if they are not filtered
+    boost::optional<float> crow_fly_margin;
+    MatrixEngine matrix_engine;
+    // true to compute the car and taxi matrices with CostMatrix when it is expected to be faster
+    bool with_cost_matrix;
 
     Context(zmq::context_t& zmq_context, valhalla::baldr::GraphReader& graph,
-            const Metrics& metrics, const Projector& projector, const boost::optional<std::string>& valhalla_service_url) : zmq_context(zmq_context),
-                                                                                                                            graph(graph),
-                                                                                                                            metrics(metrics),
-                                                                                                                            projector(projector),
-                                                                                                                            valhalla_service_url(valhalla_service_url) {}
+            const Metrics& metrics, const Projector& projector, const boost::optional<std::string>& valhalla_service_url,
+            const MatrixCache* matrix_cache = nullptr,
+            const FallbackTable* fallback_table = nullptr,
+            const MatrixPool* matrix_pool = nullptr,
+            bool matrix_auto_direction = false,
+            boost::optional<float> crow_fly_margin = boost::none,
+            MatrixEngine matrix_engine = MatrixEngine::expansion,
+            bool with_cost_matrix = false) : zmq_context(zmq_context),
+                                            graph(graph),
+                                            metrics(metrics),
+                                            projector(projector),
+                                            valhalla_service_url(valhalla_service_url),
+                                            matrix_cache(matrix_cache),
+                                            fallback_table(fallback_table),
+                                            matrix_pool(matrix_pool),
+                                            matrix_auto_direction(matrix_auto_direction),
+                                            crow_fly_margin(crow_fly_margin),
+                                            matrix_engine(matrix_engine),
+                                            with_cost_matrix(with_cost_matrix) {}
 };
 
 } // namespace asgard
@@ -0,0 +1,90 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#include "asgard/crow_fly_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace asgard {
+
+namespace {
+
+const double METERS_PER_DEGREE = 111195.;
+const double RAD_PER_DEGREE = M_PI / 180.;
+
+} // namespace
+
+size_t mark_reachable_targets(const std::vector<valhalla::midgard::PointLL>& sources,
+                              const std::vector<valhalla::midgard::PointLL>& targets,
+                              double max_distance,
+                              std::vector<bool>& reachable) {
+    thread_local std::vector<float> target_x;
+    thread_local std::vector<float> target_y;
+    thread_local std::vector<float> target_cos;
+    thread_local std::vector<uint8_t> marks;
+
+    const auto nb_targets = targets.size();
+    reachable.assign(nb_targets, false);
+    if (sources.empty() || nb_targets == 0) {
+        return 0;
+    }
+
+    // relative to the first source, so that floats keep a metric precision
+    const auto origin_lng = sources.front().lng();
+    const auto origin_lat = sources.front().lat();
+    target_x.resize(nb_targets);
+    target_y.resize(nb_targets);
+    target_cos.resize(nb_targets);
+    marks.assign(nb_targets, 0);
+    for (size_t i = 0; i < nb_targets; ++i) {
+        target_x[i] = static_cast<float>(targets[i].lng() - origin_lng);
+        target_y[i] = static_cast<float>(targets[i].lat() - origin_lat);
+        target_cos[i] = static_cast<float>(std::cos(targets[i].lat() * RAD_PER_DEGREE));
+    }
+
+    const auto max_degrees = static_cast<float>(max_distance / METERS_PER_DEGREE);
+    const float limit = max_degrees * max_degrees;
+    const float* tx = target_x.data();
+    const float* ty = target_y.data();
+    const float* tc = target_cos.data();
+    uint8_t* m = marks.data();
+    for (const auto& source : sources) {
+        const auto sx = static_cast<float>(source.lng() - origin_lng);
+        const auto sy = static_cast<float>(source.lat() - origin_lat);
+        const auto sc = static_cast<float>(std::cos(source.lat() * RAD_PER_DEGREE));
+        // without branches, so that the compiler vectorizes it
+        for (size_t i = 0; i < nb_targets; ++i) {
+            const float scale = tc[i] < sc ? tc[i] : sc;
+            const float dx = (tx[i] - sx) * scale;
+            const float dy = ty[i] - sy;
+            m[i] |= static_cast<uint8_t>(dx * dx + dy * dy <= limit);
+        }
+    }
+
+    size_t nb_reachable = 0;
+    for (size_t i = 0; i < nb_targets; ++i) {
+        if (m[i]) {
+            reachable[i] = true;
+            ++nb_reachable;
+        }
+    }
+    return nb_reachable;
+}
+
+} // namespace asgard
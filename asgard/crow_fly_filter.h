@@ -0,0 +1,43 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <valhalla/midgard/pointll.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace asgard {
+
+/**
+ * Marks the targets closer than max_distance, as the crow flies, to at least
+ * one of the sources, and returns their number.
+ *
+ * The distances are equirectangular ones, with the longitudes scaled by the
+ * smallest cosine of the two latitudes, so they are never longer than the
+ * real ones at the scale of a matrix: a target left unmarked is further than
+ * max_distance from all the sources. It is up to the caller to choose a
+ * max_distance no path of the matrix can cover, the max distance of the
+ * matrix search is not one (see get_max_crow_fly_distance).
+ */
+size_t mark_reachable_targets(const std::vector<valhalla::midgard::PointLL>& sources,
+                              const std::vector<valhalla::midgard::PointLL>& targets,
+                              double max_distance,
+                              std::vector<bool>& reachable);
+
+} // namespace asgard
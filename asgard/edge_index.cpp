@@ -0,0 +1,346 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#include "asgard/edge_index.h"
+
+#include <valhalla/midgard/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace asgard {
+
+namespace {
+
+const double COORD_PRECISION = 1e7;
+const double METERS_PER_DEGREE = 111195.;
+const double RAD_PER_DEGREE = M_PI / 180.;
+// The defaults of valhalla::baldr::Location, which the projector never
+// changes. They are not read from loki, and the distances are not computed
+// as loki does: the locations close to these thresholds are left to loki.
+// loki snaps to the node under this distance, in meters
+const double NODE_SNAP_TOLERANCE = 5.;
+// no side of street under this distance, in meters
+const double SIDE_OF_STREET_TOLERANCE = 5.;
+// how far from a threshold a location must be to be answered, in meters
+const double THRESHOLD_MARGIN = 1.;
+// another edge this close to the closest one may be the one loki takes, in degrees
+const float TIE_TOLERANCE = THRESHOLD_MARGIN / METERS_PER_DEGREE;
+
+int32_t to_fixed_point(double coord) {
+    return static_cast<int32_t>(std::lround(coord * COORD_PRECISION));
+}
+
+double from_fixed_point(int32_t coord) {
+    return coord / COORD_PRECISION;
+}
+
+float tie_limit(float best) {
+    const float limit = std::sqrt(best) + TIE_TOLERANCE;
+    return limit * limit;
+}
+
+} // namespace
+
+EdgeIndex::EdgeIndex(valhalla::baldr::GraphReader& graph,
+                     double cell_size,
+                     double max_distance) : cell_size(cell_size),
+                                            max_distance(max_distance) {
+    using valhalla::baldr::GraphId;
+
+    std::vector<std::pair<uint64_t, uint32_t>> entries;
+
+    for (const auto& tile_id : graph.GetTileSet()) {
+        if (graph.OverCommitted()) { graph.Clear(); }
+        const auto tile = graph.GetGraphTile(tile_id);
+        if (!tile) {
+            continue;
+        }
+        for (uint32_t n = 0; n < tile->header()->nodecount(); ++n) {
+            const auto* node = tile->node(n);
+            for (uint32_t i = node->edge_index(); i < node->edge_index() + node->edge_count(); ++i) {
+                const auto* edge = tile->directededge(i);
+                if (edge->is_shortcut() || edge->IsTransitLine() || edge->bss_connection()) {
+                    continue;
+                }
+                // the shape is shared by the two directions, it is indexed once
+                if (!edge->forward()) {
+                    continue;
+                }
+                const auto edge_info = tile->edgeinfo(edge->edgeinfo_offset());
+                const auto shape = edge_info.shape();
+                std::vector<double> lengths(1, 0.);
+                for (size_t k = 1; k < shape.size(); ++k) {
+                    lengths.push_back(lengths.back() + shape[k - 1].Distance(shape[k]));
+                }
+                if (shape.size() < 2 || lengths.back() <= 0) {
+                    continue;
+                }
+                const GraphId edge_id(tile_id.tileid(), tile_id.level(), i);
+                const auto opposing = graph.GetOpposingEdgeId(edge_id);
+                for (size_t k = 0; k + 1 < shape.size(); ++k) {
+                    const auto& a = shape[k];
+                    const auto& b = shape[k + 1];
+                    const auto segment = static_cast<uint32_t>(segments.size());
+                    segments.push_back(Segment{static_cast<uint64_t>(edge_id),
+                                               static_cast<uint64_t>(opposing),
+                                               to_fixed_point(a.lng()),
+                                               to_fixed_point(a.lat()),
+                                               to_fixed_point(b.lng()),
+                                               to_fixed_point(b.lat()),
+                                               static_cast<float>(lengths[k] / lengths.back()),
+                                               static_cast<float>(lengths[k + 1] / lengths.back()),
+                                               static_cast<float>(edge->length()),
+                                               static_cast<uint16_t>(edge->forwardaccess()),
+                                               static_cast<uint16_t>(edge->reverseaccess())});
+                    // in every cell of the bounding box of the segment
+                    const auto min_row = static_cast<int64_t>(std::floor(std::min(a.lat(), b.lat()) / cell_size));
+                    const auto max_row = static_cast<int64_t>(std::floor(std::max(a.lat(), b.lat()) / cell_size));
+                    const auto min_col = static_cast<int64_t>(std::floor(std::min(a.lng(), b.lng()) / cell_size));
+                    const auto max_col = static_cast<int64_t>(std::floor(std::max(a.lng(), b.lng()) / cell_size));
+                    for (auto row = min_row; row <= max_row; ++row) {
+                        for (auto col = min_col; col <= max_col; ++col) {
+                            entries.emplace_back(cell_key(row, col), segment);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // the entries of a cell are contiguous
+    std::sort(entries.begin(), entries.end());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const auto key = entries[i].first;
+        if (cell_keys.empty() || cell_keys.back() != key) {
+            cell_keys.push_back(key);
+            cell_begin.push_back(static_cast<uint32_t>(i));
+        }
+        const auto origin_lat = (static_cast<int64_t>(key >> 32) - (int64_t(1) << 31)) * cell_size;
+        const auto origin_lng = (static_cast<int64_t>(key & 0xffffffff) - (int64_t(1) << 31)) * cell_size;
+        const auto& s = segments[entries[i].second];
+        begin_x.push_back(static_cast<float>(from_fixed_point(s.begin_lng) - origin_lng));
+        begin_y.push_back(static_cast<float>(from_fixed_point(s.begin_lat) - origin_lat));
+        end_x.push_back(static_cast<float>(from_fixed_point(s.end_lng) - origin_lng));
+        end_y.push_back(static_cast<float>(from_fixed_point(s.end_lat) - origin_lat));
+        entry_segments.push_back(entries[i].second);
+    }
+    cell_begin.push_back(static_cast<uint32_t>(entries.size()));
+
+    LOG_INFO("Edge index built with " + std::to_string(segments.size()) + " segments in " +
+             std::to_string(cell_keys.size()) + " cells");
+}
+
+uint64_t EdgeIndex::cell_key(int64_t row, int64_t col) const {
+    return (static_cast<uint64_t>(row + (int64_t(1) << 31)) << 32) | static_cast<uint32_t>(col + (int64_t(1) << 31));
+}
+
+void EdgeIndex::search_cell(size_t cell,
+                            const valhalla::midgard::PointLL& place,
+                            float lng_scale,
+                            uint16_t access,
+                            float radius,
+                            float& best,
+                            std::vector<Candidate>& candidates) const {
+    thread_local std::vector<float> distances;
+    thread_local std::vector<float> positions;
+
+    const auto key = cell_keys[cell];
+    const auto origin_lat = (static_cast<int64_t>(key >> 32) - (int64_t(1) << 31)) * cell_size;
+    const auto origin_lng = (static_cast<int64_t>(key & 0xffffffff) - (int64_t(1) << 31)) * cell_size;
+    const auto px = static_cast<float>((place.lng() - origin_lng) * lng_scale);
+    const auto py = static_cast<float>(place.lat() - origin_lat);
+
+    const auto first = cell_begin[cell];
+    const auto nb_entries = cell_begin[cell + 1] - first;
+    distances.resize(nb_entries);
+    positions.resize(nb_entries);
+    const float* ax = begin_x.data() + first;
+    const float* ay = begin_y.data() + first;
+    const float* bx = end_x.data() + first;
+    const float* by = end_y.data() + first;
+    float* d = distances.data();
+    float* t = positions.data();
+    // without branches, so that the compiler vectorizes it
+    for (uint32_t i = 0; i < nb_entries; ++i) {
+        const float x0 = ax[i] * lng_scale;
+        const float dx = bx[i] * lng_scale - x0;
+        const float dy = by[i] - ay[i];
+        const float len = dx * dx + dy * dy;
+        const float q = ((px - x0) * dx + (py - ay[i]) * dy) / (len > 1e-20f ? len : 1e-20f);
+        const float p = q < 0.f ? 0.f : (q > 1.f ? 1.f : q);
+        const float ex = x0 + p * dx - px;
+        const float ey = ay[i] + p * dy - py;
+        d[i] = ex * ex + ey * ey;
+        t[i] = p;
+    }
+
+    auto limit = std::max(radius, tie_limit(best));
+    for (uint32_t i = 0; i < nb_entries; ++i) {
+        if (d[i] > limit) {
+            continue;
+        }
+        const auto segment = entry_segments[first + i];
+        if (!((segments[segment].edge_access | segments[segment].opposing_access) & access)) {
+            continue;
+        }
+        if (d[i] < best) {
+            best = d[i];
+            limit = std::max(radius, tie_limit(best));
+        }
+        candidates.push_back(Candidate{segment, t[i], d[i]});
+    }
+}
+
+bool EdgeIndex::add_edges(const Candidate& candidate,
+                          const valhalla::baldr::Location& location,
+                          ProjectorMode mode,
+                          valhalla::baldr::GraphReader& graph,
+                          const valhalla::sif::EdgeFilter& edge_filter,
+                          valhalla::baldr::PathLocation& projection) const {
+    using valhalla::baldr::PathLocation;
+
+    const auto& s = segments[candidate.segment];
+    const double percent = s.begin_percent + candidate.t * (s.end_percent - s.begin_percent);
+    // close to a node, loki takes all the edges of the node
+    const double node_limit = NODE_SNAP_TOLERANCE + THRESHOLD_MARGIN;
+    if (percent * s.edge_length < node_limit || (1. - percent) * s.edge_length < node_limit) {
+        return false;
+    }
+    const auto access = to_access(mode);
+    const valhalla::baldr::GraphId edge(s.edge);
+    const valhalla::baldr::GraphId opposing(s.opposing);
+    const bool use_edge = s.edge_access & access;
+    const bool use_opposing = opposing.Is_Valid() && (s.opposing_access & access);
+
+    // the costing may refuse an edge its access allows, loki then drops it
+    const auto is_allowed = [&](const valhalla::baldr::GraphId& id) {
+        const auto tile = graph.GetGraphTile(id);
+        return tile && edge_filter(tile->directededge(id)) != 0.f;
+    };
+    if ((use_edge && !is_allowed(edge)) || (use_opposing && !is_allowed(opposing))) {
+        return false;
+    }
+
+    const unsigned int outbound_reach = location.min_outbound_reach_;
+    const unsigned int inbound_reach = location.min_inbound_reach_;
+
+    const valhalla::midgard::PointLL a{from_fixed_point(s.begin_lng), from_fixed_point(s.begin_lat)};
+    const valhalla::midgard::PointLL b{from_fixed_point(s.end_lng), from_fixed_point(s.end_lat)};
+    const valhalla::midgard::PointLL projected{a.lng() + candidate.t * (b.lng() - a.lng()),
+                                               a.lat() + candidate.t * (b.lat() - a.lat())};
+    const auto& place = location.latlng_;
+    const auto distance = place.Distance(projected);
+    if (std::abs(distance - SIDE_OF_STREET_TOLERANCE) < THRESHOLD_MARGIN) {
+        return false;
+    }
+
+    // relative to the direction of the shape
+    auto sos = PathLocation::NONE;
+    if (distance >= SIDE_OF_STREET_TOLERANCE) {
+        const auto cross = (b.lng() - a.lng()) * (place.lat() - a.lat()) - (b.lat() - a.lat()) * (place.lng() - a.lng());
+        sos = cross > 0 ? PathLocation::LEFT : PathLocation::RIGHT;
+    }
+    const auto opposite_sos = sos == PathLocation::LEFT ? PathLocation::RIGHT : (sos == PathLocation::RIGHT ? PathLocation::LEFT : PathLocation::NONE);
+
+    if (use_edge) {
+        projection.edges.emplace_back(edge, percent, projected, distance, sos, outbound_reach, inbound_reach);
+    }
+    if (use_opposing) {
+        projection.edges.emplace_back(opposing, 1. - percent, projected, distance, opposite_sos, outbound_reach, inbound_reach);
+    }
+    return true;
+}
+
+boost::optional<valhalla::baldr::PathLocation> EdgeIndex::find(const valhalla::baldr::Location& location,
+                                                               ProjectorMode mode,
+                                                               valhalla::baldr::GraphReader& graph,
+                                                               const valhalla::sif::cost_ptr_t& costing) const {
+    // loki drops the edges that do not reach enough nodes, which depends on the
+    // costing, the access of the nodes and the transitions: it is left to loki
+    if (location.min_outbound_reach_ > 0 || location.min_inbound_reach_ > 0) {
+        return boost::none;
+    }
+
+    thread_local std::vector<Candidate> candidates;
+    candidates.clear();
+
+    const auto& place = location.latlng_;
+    const auto access = to_access(mode);
+    // a degree of longitude is shorter than a degree of latitude
+    const auto lng_scale = static_cast<float>(std::max(0.01, std::cos(place.lat() * RAD_PER_DEGREE)));
+    const auto max_degrees = static_cast<float>(max_distance / METERS_PER_DEGREE);
+    const auto radius_degrees = static_cast<float>(std::min<double>(location.radius_, max_distance) / METERS_PER_DEGREE);
+    const float radius = radius_degrees * radius_degrees;
+
+    const auto row = static_cast<int64_t>(std::floor(place.lat() / cell_size));
+    const auto col = static_cast<int64_t>(std::floor(place.lng() / cell_size));
+    const auto max_ring = static_cast<int64_t>(std::ceil(max_degrees / (cell_size * lng_scale)));
+    float best = max_degrees * max_degrees;
+    for (int64_t ring = 0; ring <= max_ring; ++ring) {
+        for (auto r = row - ring; r <= row + ring; ++r) {
+            // only the border of the ring, the inside has already been searched
+            const auto step = (r == row - ring || r == row + ring) ? 1 : std::max<int64_t>(1, 2 * ring);
+            for (auto c = col - ring; c <= col + ring; c += step) {
+                const auto key = cell_key(r, c);
+                const auto it = std::lower_bound(cell_keys.begin(), cell_keys.end(), key);
+                if (it != cell_keys.end() && *it == key) {
+                    search_cell(it - cell_keys.begin(), place, lng_scale, access, radius, best, candidates);
+                }
+            }
+        }
+        // the cells of the next rings are further than this
+        const float covered = ring * static_cast<float>(cell_size) * lng_scale;
+        if (covered * covered >= std::max(radius, tie_limit(best))) {
+            break;
+        }
+    }
+
+    const auto limit = std::max(radius, tie_limit(best));
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [limit](const Candidate& c) { return c.distance > limit; }),
+                     candidates.end());
+    if (candidates.empty()) {
+        return boost::none;
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.distance < b.distance; });
+
+    const auto& closest = segments[candidates.front().segment];
+    const auto edge_filter = costing->GetEdgeFilter();
+    valhalla::baldr::PathLocation projection(location);
+    std::vector<uint64_t> projected_edges;
+    for (const auto& c : candidates) {
+        const auto edge = segments[c.segment].edge;
+        if (std::find(projected_edges.begin(), projected_edges.end(), edge) != projected_edges.end()) {
+            continue;
+        }
+        // loki keeps all the equidistant edges, and may not find the same closest one
+        if (c.distance <= tie_limit(candidates.front().distance) && edge != closest.edge) {
+            return boost::none;
+        }
+        if (!add_edges(c, location, mode, graph, edge_filter, projection)) {
+            return boost::none;
+        }
+        projected_edges.push_back(edge);
+    }
+    if (projection.edges.empty()) {
+        return boost::none;
+    }
+    return projection;
+}
+
+} // namespace asgard
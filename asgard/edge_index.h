@@ -0,0 +1,121 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "asgard/projector_cache.h"
+
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/baldr/location.h>
+#include <valhalla/baldr/pathlocation.h>
+#include <valhalla/sif/dynamiccost.h>
+
+#include <boost/optional.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace asgard {
+
+/**
+ * A grid of the segments of the edges' shapes, built once from the tiles,
+ * answering nearest edge queries without loki.
+ *
+ * The segments are stored cell by cell in flat arrays so that the distances
+ * to all the segments of a cell are computed in one vectorizable loop. The
+ * reach of the edges is not known, the locations asking for one are left to
+ * loki.
+ *
+ * The edges found are checked against the edge filter of the costing, as
+ * loki does. The cases where loki does more than taking the closest edge (a
+ * location close to a node, equidistant edges, an edge filtered by the
+ * costing, a minimum reach) are left to loki: find returns boost::none for
+ * them. The node snap and side of street tolerances are loki's defaults,
+ * not read from its configuration, and the distances are approximations of
+ * loki's: the locations within a meter of a threshold are left to loki too.
+ */
+class EdgeIndex {
+public:
+    // cell_size in degrees, max_distance in meters: the places further from every edge are left to loki
+    explicit EdgeIndex(valhalla::baldr::GraphReader& graph,
+                       double cell_size = 0.002,
+                       double max_distance = 500);
+
+    EdgeIndex(const EdgeIndex&) = delete;
+    EdgeIndex& operator=(const EdgeIndex&) = delete;
+
+    // The projection valhalla::loki::Search finds for the simple cases, up to the
+    // rounding of the distances, or boost::none when loki has to be called
+    boost::optional<valhalla::baldr::PathLocation> find(const valhalla::baldr::Location& location,
+                                                        ProjectorMode mode,
+                                                        valhalla::baldr::GraphReader& graph,
+                                                        const valhalla::sif::cost_ptr_t& costing) const;
+
+    size_t get_nb_segments() const { return segments.size(); }
+    size_t get_nb_cells() const { return cell_keys.size(); }
+
+private:
+    struct Segment {
+        // the directed edge going in the direction of the shape, and its opposing edge
+        uint64_t edge;
+        uint64_t opposing;
+        // fixed point coordinates of the ends
+        int32_t begin_lng;
+        int32_t begin_lat;
+        int32_t end_lng;
+        int32_t end_lat;
+        // position of the ends along the edge
+        float begin_percent;
+        float end_percent;
+        // of the whole edge, in meters
+        float edge_length;
+        uint16_t edge_access;
+        uint16_t opposing_access;
+    };
+
+    struct Candidate {
+        uint32_t segment;
+        // position on the segment
+        float t;
+        // squared, in scaled degrees
+        float distance;
+    };
+
+    uint64_t cell_key(int64_t row, int64_t col) const;
+    // Add the candidates of the cell closer than the radius or than the best distance found so far
+    void search_cell(size_t cell, const valhalla::midgard::PointLL& place, float lng_scale, uint16_t access,
+                     float radius, float& best, std::vector<Candidate>& candidates) const;
+    // Add the edges of the candidate to the projection, false if loki has to be called
+    bool add_edges(const Candidate& candidate, const valhalla::baldr::Location& location, ProjectorMode mode,
+                   valhalla::baldr::GraphReader& graph, const valhalla::sif::EdgeFilter& edge_filter,
+                   valhalla::baldr::PathLocation& projection) const;
+
+    double cell_size;
+    double max_distance;
+    std::vector<Segment> segments;
+    // the cells, sorted by key; the entries of cell i are in [cell_begin[i], cell_begin[i + 1])
+    std::vector<uint64_t> cell_keys;
+    std::vector<uint32_t> cell_begin;
+    // the entries: the segments' ends relative to the corner of the cell, in degrees
+    std::vector<float> begin_x;
+    std::vector<float> begin_y;
+    std::vector<float> end_x;
+    std::vector<float> end_y;
+    std::vector<uint32_t> entry_segments;
+};
+
+} // namespace asgard
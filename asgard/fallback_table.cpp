@@ -0,0 +1,271 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#include "asgard/fallback_table.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+namespace asgard {
+
+namespace {
+
+const char MAGIC[8] = {'A', 'S', 'G', 'F', 'A', 'L', 'L', '\0'};
+const uint32_t VERSION = 1;
+// the stops are identified by their coordinates rounded to the micro degree
+const double KEY_PRECISION = 1e6;
+
+uint64_t make_key(const valhalla::midgard::PointLL& place) {
+    const auto lng = static_cast<int32_t>(std::lround(place.lng() * KEY_PRECISION));
+    const auto lat = static_cast<int32_t>(std::lround(place.lat() * KEY_PRECISION));
+    return (static_cast<uint64_t>(static_cast<uint32_t>(lng)) << 32) | static_cast<uint32_t>(lat);
+}
+
+struct ModeHeader {
+    char name[8];
+    uint64_t costing_hash;
+    uint32_t max_duration;
+    float max_distance;
+    uint64_t nb_stops;
+    uint64_t nb_pairs;
+};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_modes;
+    uint64_t tileset_fingerprint;
+};
+
+template<typename T>
+void write_value(std::ofstream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+void write_values(std::ofstream& out, const std::vector<T>& values) {
+    out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+// the arrays are aligned in the file, they are used in place
+template<typename T>
+bool map_values(const char*& cursor, const char* end, const T*& values, size_t nb_values) {
+    if (reinterpret_cast<uintptr_t>(cursor) % alignof(T) != 0 ||
+        static_cast<size_t>(end - cursor) / sizeof(T) < nb_values) {
+        return false;
+    }
+    values = reinterpret_cast<const T*>(cursor);
+    cursor += nb_values * sizeof(T);
+    return true;
+}
+
+} // namespace
+
+FallbackTable::FallbackTable(const std::string& path) : file(path) {
+    const char* cursor = file.data();
+    const char* end = cursor + file.size();
+    auto fail = [&]() { return std::runtime_error(path + " is not a fallback table"); };
+
+    const FileHeader* header = nullptr;
+    if (!map_values(cursor, end, header, 1) ||
+        std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header->version != VERSION) {
+        throw fail();
+    }
+    tileset_fingerprint = header->tileset_fingerprint;
+
+    const ModeHeader* mode_headers = nullptr;
+    if (!map_values(cursor, end, mode_headers, header->nb_modes)) {
+        throw fail();
+    }
+    for (uint32_t m = 0; m < header->nb_modes; ++m) {
+        const auto& mode_header = mode_headers[m];
+        Mode mode;
+        mode.name = std::string(mode_header.name, strnlen(mode_header.name, sizeof(mode_header.name)));
+        mode.costing_hash = mode_header.costing_hash;
+        mode.max_duration = mode_header.max_duration;
+        mode.max_distance = mode_header.max_distance;
+        mode.nb_stops = mode_header.nb_stops;
+        if (!map_values(cursor, end, mode.keys, mode.nb_stops) ||
+            !map_values(cursor, end, mode.first_pairs, mode.nb_stops + 1) ||
+            !map_values(cursor, end, mode.pairs, mode_header.nb_pairs) ||
+            mode.first_pairs[mode.nb_stops] != mode_header.nb_pairs) {
+            throw fail();
+        }
+        modes.push_back(mode);
+    }
+}
+
+void FallbackTable::save(const std::string& path, uint64_t tileset_fingerprint, const std::vector<ModeTable>& modes) {
+    const auto tmp_path = path + ".tmp";
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot open fallback table " + tmp_path);
+    }
+
+    FileHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.nb_modes = static_cast<uint32_t>(modes.size());
+    header.tileset_fingerprint = tileset_fingerprint;
+    write_value(out, header);
+
+    // the stops of each mode, sorted by key, and their index in the mode table
+    std::vector<std::vector<std::pair<uint64_t, uint32_t>>> sorted_stops;
+    for (const auto& mode : modes) {
+        if (mode.mode.size() > sizeof(ModeHeader::name) || mode.pairs.size() != mode.stops.size()) {
+            throw std::runtime_error("Invalid fallback table for mode " + mode.mode);
+        }
+        sorted_stops.emplace_back();
+        auto& stops = sorted_stops.back();
+        for (size_t i = 0; i < mode.stops.size(); ++i) {
+            stops.emplace_back(make_key(mode.stops[i]), static_cast<uint32_t>(i));
+        }
+        std::sort(stops.begin(), stops.end());
+        stops.erase(std::unique(stops.begin(), stops.end(), [](const auto& a, const auto& b) { return a.first == b.first; }), stops.end());
+
+        size_t nb_pairs = 0;
+        for (const auto& stop : stops) {
+            nb_pairs += mode.pairs[stop.second].size();
+        }
+        ModeHeader mode_header{};
+        std::memcpy(mode_header.name, mode.mode.data(), mode.mode.size());
+        mode_header.costing_hash = mode.costing_hash;
+        mode_header.max_duration = mode.max_duration;
+        mode_header.max_distance = mode.max_distance;
+        mode_header.nb_stops = stops.size();
+        mode_header.nb_pairs = nb_pairs;
+        write_value(out, mode_header);
+    }
+
+    for (size_t m = 0; m < modes.size(); ++m) {
+        const auto& mode = modes[m];
+        const auto& stops = sorted_stops[m];
+        // the targets are renumbered in the order of the keys, the duplicated stops are dropped
+        std::vector<uint32_t> new_index(mode.stops.size(), std::numeric_limits<uint32_t>::max());
+        std::vector<uint64_t> keys;
+        for (size_t i = 0; i < stops.size(); ++i) {
+            new_index[stops[i].second] = static_cast<uint32_t>(i);
+            keys.push_back(stops[i].first);
+        }
+        std::vector<uint64_t> first_pairs;
+        std::vector<Pair> pairs;
+        for (const auto& stop : stops) {
+            first_pairs.push_back(pairs.size());
+            const auto first = pairs.size();
+            for (const auto& pair : mode.pairs[stop.second]) {
+                if (pair.target < new_index.size() && new_index[pair.target] != std::numeric_limits<uint32_t>::max()) {
+                    pairs.push_back(Pair{new_index[pair.target], pair.duration});
+                }
+            }
+            std::sort(pairs.begin() + first, pairs.end(), [](const Pair& a, const Pair& b) { return a.target < b.target; });
+        }
+        first_pairs.push_back(pairs.size());
+        write_values(out, keys);
+        write_values(out, first_pairs);
+        write_values(out, pairs);
+    }
+
+    out.close();
+    if (!out) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Cannot write fallback table " + tmp_path);
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Cannot rename fallback table " + tmp_path + " to " + path);
+    }
+}
+
+const FallbackTable::Mode* FallbackTable::find_mode(const std::string& mode) const {
+    const auto it = std::find_if(modes.begin(), modes.end(), [&](const Mode& m) { return m.name == mode; });
+    return it == modes.end() ? nullptr : &*it;
+}
+
+size_t FallbackTable::find_stop(const Mode& mode, const valhalla::midgard::PointLL& place) const {
+    const auto key = make_key(place);
+    const auto* end = mode.keys + mode.nb_stops;
+    const auto* it = std::lower_bound(mode.keys, end, key);
+    return (it == end || *it != key) ? mode.nb_stops : static_cast<size_t>(it - mode.keys);
+}
+
+size_t FallbackTable::mode_index(const std::string& mode) {
+    static const std::array<std::string, nb_modes> names = {{"walking", "bike", "car", "taxi", "bss"}};
+    return static_cast<size_t>(std::find(names.begin(), names.end(), mode) - names.begin());
+}
+
+bool FallbackTable::find(const std::string& mode,
+                         size_t costing_hash,
+                         uint32_t max_duration,
+                         float max_distance,
+                         const std::vector<valhalla::midgard::PointLL>& sources,
+                         const std::vector<valhalla::midgard::PointLL>& targets,
+                         std::vector<valhalla::thor::TimeDistance>& costs) const {
+    const auto* m = find_mode(mode);
+    if (!m || m->costing_hash != costing_hash || max_duration != m->max_duration || max_distance != m->max_distance) {
+        return false;
+    }
+    auto find_stops = [&](const std::vector<valhalla::midgard::PointLL>& places, std::vector<size_t>& stops) {
+        stops.clear();
+        for (const auto& place : places) {
+            stops.push_back(find_stop(*m, place));
+            if (stops.back() == m->nb_stops) {
+                return false;
+            }
+        }
+        return true;
+    };
+    std::vector<size_t> source_stops;
+    std::vector<size_t> target_stops;
+    if (!find_stops(sources, source_stops) || !find_stops(targets, target_stops)) {
+        return false;
+    }
+
+    costs.assign(sources.size() * targets.size(), valhalla::thor::TimeDistance(valhalla::thor::kMaxCost, 0));
+    for (size_t s = 0; s < source_stops.size(); ++s) {
+        const auto* first = m->pairs + m->first_pairs[source_stops[s]];
+        const auto* last = m->pairs + m->first_pairs[source_stops[s] + 1];
+        for (size_t t = 0; t < target_stops.size(); ++t) {
+            const auto it = std::lower_bound(first, last, target_stops[t], [](const Pair& p, size_t target) { return p.target < target; });
+            if (it != last && it->target == target_stops[t]) {
+                costs[s * targets.size() + t] = valhalla::thor::TimeDistance(it->duration, 0);
+            }
+        }
+    }
+    const auto index = mode_index(mode);
+    if (index < nb_modes) {
+        nb_hits[index].fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+size_t FallbackTable::get_nb_stops(const std::string& mode) const {
+    const auto* m = find_mode(mode);
+    return m ? m->nb_stops : 0;
+}
+
+size_t FallbackTable::get_nb_hits(const std::string& mode) const {
+    const auto index = mode_index(mode);
+    return index < nb_modes ? nb_hits[index].load() : 0;
+}
+
+} // namespace asgard
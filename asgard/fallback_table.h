@@ -0,0 +1,117 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+/**
+ * Times between stops, computed offline for each mode
+ *
+ * The stop-to-stop transfers and the fallbacks of the stop areas are asked
+ * again and again with the same coordinates, and only change with the data.
+ * The table holds the duration of every pair of stops reached within a bound,
+ * computed once by asgard_fallback_table with the same Handler as the
+ * requests, so a matrix whose places are all stops of the table is answered
+ * without any projection nor graph search, when it asks for the same bounds.
+ *   header, modes (name, costing hash, bounds, sizes), then for each mode:
+ *   sorted stop keys, index of the first pair of each stop, pairs (stop, duration)
+ * The arrays are 8 bytes aligned and mapped as they are.
+ */
+
+#pragma once
+
+#include <valhalla/midgard/pointll.h>
+#include <valhalla/thor/timedistancematrix.h>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace asgard {
+
+class FallbackTable {
+public:
+    struct Pair {
+        uint32_t target;
+        // in seconds
+        uint32_t duration;
+    };
+
+    struct ModeTable {
+        std::string mode;
+        size_t costing_hash = 0;
+        // the bounds of the matrices computed for the table
+        uint32_t max_duration = 0;
+        float max_distance = 0;
+        std::vector<valhalla::midgard::PointLL> stops;
+        // for each stop, its pairs sorted by target
+        std::vector<std::vector<Pair>> pairs;
+    };
+
+    // Map a saved table, throws if the file is not a fallback table
+    explicit FallbackTable(const std::string& path);
+
+    FallbackTable(const FallbackTable&) = delete;
+    FallbackTable& operator=(const FallbackTable&) = delete;
+
+    static void save(const std::string& path, uint64_t tileset_fingerprint, const std::vector<ModeTable>& modes);
+
+    // Fill the costs of the matrix (sources x targets) if all the places are stops of the mode, and if the
+    // table has been computed with the same costing and the same bounds as the request's: with other bounds,
+    // the search would not stop at the same place. The pairs not in the table are unreached, the distances
+    // are not kept.
+    bool find(const std::string& mode,
+              size_t costing_hash,
+              uint32_t max_duration,
+              float max_distance,
+              const std::vector<valhalla::midgard::PointLL>& sources,
+              const std::vector<valhalla::midgard::PointLL>& targets,
+              std::vector<valhalla::thor::TimeDistance>& costs) const;
+
+    uint64_t get_tileset_fingerprint() const { return tileset_fingerprint; }
+    size_t get_nb_stops(const std::string& mode) const;
+    // Counted by matrix served
+    size_t get_nb_hits(const std::string& mode) const;
+
+private:
+    struct Mode {
+        std::string name;
+        size_t costing_hash;
+        uint32_t max_duration;
+        float max_distance;
+        size_t nb_stops;
+        // in the mapped file
+        const uint64_t* keys;
+        const uint64_t* first_pairs;
+        const Pair* pairs;
+    };
+
+    const Mode* find_mode(const std::string& mode) const;
+    // the index of the stop in the mode, nb_stops if not found
+    size_t find_stop(const Mode& mode, const valhalla::midgard::PointLL& place) const;
+
+    static constexpr size_t nb_modes = 5;
+    static size_t mode_index(const std::string& mode);
+
+    uint64_t tileset_fingerprint = 0;
+    std::vector<Mode> modes;
+    boost::iostreams::mapped_file_source file;
+    mutable std::array<std::atomic<size_t>, nb_modes> nb_hits{};
+};
+
+} // namespace asgard
@@ -0,0 +1,279 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+/**
+ * Precompute the times between the stops, for the matrices served by asgard
+ * without any graph search (see fallback_table.h)
+ *
+ *   asgard_fallback_table -c valhalla.json -s stops.txt -o asgard_fallback.bin
+ *
+ * The stops are read in the format of the warmup file, one coordinate per
+ * line followed by its modes. Each stop is the source of a one-to-many
+ * matrix, handled by the same Handler as the requests, towards the stops
+ * close enough to be reached within the maximum duration at the top speed
+ * of the mode, ferries aside. The speeds must be the ones of the coverage,
+ * the table is only used by the requests with the same costing.
+ */
+
+#include "asgard/context.h"
+#include "asgard/fallback_table.h"
+#include "asgard/handler.h"
+#include "asgard/metrics.h"
+#include "asgard/projector.h"
+#include "asgard/request.pb.h"
+#include "asgard/warmup.h"
+
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/midgard/logging.h>
+#include <valhalla/midgard/pointll.h>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <zmq.hpp>
+
+namespace po = boost::program_options;
+using namespace asgard;
+using valhalla::midgard::PointLL;
+
+namespace {
+
+// in meters, for the crow fly filter of the targets
+const double METERS_PER_DEGREE = 111320;
+// in meters, added to the crow fly distance for the stops projected away from their coordinates
+const double CROW_FLY_MARGIN = 500;
+
+std::string make_place(const PointLL& p) {
+    return "coord:" + std::to_string(p.lng()) + ":" + std::to_string(p.lat());
+}
+
+pbnavitia::Request make_request(const std::string& mode,
+                                uint32_t max_duration,
+                                const pbnavitia::StreetNetworkParams& params,
+                                const PointLL& source,
+                                const std::vector<PointLL>& targets) {
+    pbnavitia::Request request;
+    request.set_requested_api(pbnavitia::street_network_routing_matrix);
+    auto* sn_request = request.mutable_sn_routing_matrix();
+    sn_request->set_mode(mode);
+    sn_request->set_max_duration(max_duration);
+    sn_request->mutable_streetnetwork_params()->CopyFrom(params);
+    auto* origin = sn_request->add_origins();
+    origin->set_place(make_place(source));
+    origin->set_access_duration(0);
+    for (const auto& target : targets) {
+        auto* destination = sn_request->add_destinations();
+        destination->set_place(make_place(target));
+        destination->set_access_duration(0);
+    }
+    return request;
+}
+
+// The matrices from every stop, the stops which cannot be projected are left out
+FallbackTable::ModeTable compute_mode_table(const std::string& mode,
+                                            const std::vector<PointLL>& stops,
+                                            uint32_t max_duration,
+                                            const pbnavitia::StreetNetworkParams& params,
+                                            const Projector& projector,
+                                            const boost::property_tree::ptree& graph_conf,
+                                            size_t nb_threads) {
+    const auto template_request = make_request(mode, max_duration, params, PointLL(), {});
+    const auto max_distance = get_max_distance(mode, template_request.sn_routing_matrix());
+    // the max distance bounds the search, not the length of the paths
+    const double max_crow_fly_distance = get_max_crow_fly_distance(mode, template_request.sn_routing_matrix()) + CROW_FLY_MARGIN;
+
+    // the stops sorted by latitude, to only ask for the ones close enough
+    std::vector<size_t> by_lat(stops.size());
+    for (size_t i = 0; i < stops.size(); ++i) {
+        by_lat[i] = i;
+    }
+    std::sort(by_lat.begin(), by_lat.end(), [&](size_t a, size_t b) { return stops[a].lat() < stops[b].lat(); });
+    const double max_delta_lat = max_crow_fly_distance / METERS_PER_DEGREE;
+
+    std::vector<std::vector<FallbackTable::Pair>> pairs(stops.size());
+    // written by all the threads, not packed
+    std::vector<uint8_t> projected(stops.size(), 1);
+    std::atomic<size_t> next_source{0};
+    std::atomic<size_t> nb_done{0};
+    zmq::context_t zmq_context(1);
+    const Metrics metrics{boost::none};
+    const boost::optional<std::string> valhalla_service_url;
+
+    auto work = [&]() {
+        valhalla::baldr::GraphReader graph(graph_conf);
+        Handler handler(Context(zmq_context, graph, metrics, projector, valhalla_service_url));
+        std::vector<size_t> targets;
+        std::vector<PointLL> target_places;
+        for (size_t s = next_source++; s < stops.size(); s = next_source++) {
+            const auto& source = stops[s];
+            targets.clear();
+            target_places.clear();
+            const auto first = std::lower_bound(by_lat.begin(), by_lat.end(), source.lat() - max_delta_lat,
+                                                [&](size_t i, double lat) { return stops[i].lat() < lat; });
+            for (auto it = first; it != by_lat.end() && stops[*it].lat() <= source.lat() + max_delta_lat; ++it) {
+                if (source.Distance(stops[*it]) <= max_crow_fly_distance) {
+                    targets.push_back(*it);
+                    target_places.push_back(stops[*it]);
+                }
+            }
+
+            const auto response = handler.handle(make_request(mode, max_duration, params, source, target_places));
+            if (response.has_error() || response.sn_routing_matrix().rows_size() != 1 ||
+                response.sn_routing_matrix().rows(0).routing_response_size() != static_cast<int>(targets.size())) {
+                projected[s] = 0;
+            } else {
+                const auto& row = response.sn_routing_matrix().rows(0);
+                for (size_t t = 0; t < targets.size(); ++t) {
+                    if (row.routing_response(t).routing_status() == pbnavitia::RoutingStatus::reached) {
+                        pairs[s].push_back(FallbackTable::Pair{static_cast<uint32_t>(targets[t]),
+                                                               static_cast<uint32_t>(row.routing_response(t).duration())});
+                    }
+                }
+            }
+            const auto done = ++nb_done;
+            if (done % 1000 == 0) {
+                LOG_INFO(mode + ": " + std::to_string(done) + "/" + std::to_string(stops.size()) + " stops done");
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::max<size_t>(1, nb_threads); ++i) {
+        threads.emplace_back(work);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    // the stops that cannot be projected are left to the graph search, as the pairs towards them
+    FallbackTable::ModeTable table;
+    table.mode = mode;
+    table.costing_hash = hash_value(make_modecosting_args(template_request.sn_routing_matrix()));
+    table.max_duration = max_duration;
+    table.max_distance = max_distance;
+    std::vector<uint32_t> new_index(stops.size(), 0);
+    for (size_t i = 0; i < stops.size(); ++i) {
+        if (projected[i]) {
+            new_index[i] = static_cast<uint32_t>(table.stops.size());
+            table.stops.push_back(stops[i]);
+        }
+    }
+    for (size_t i = 0; i < stops.size(); ++i) {
+        if (!projected[i]) {
+            continue;
+        }
+        table.pairs.emplace_back();
+        for (const auto& pair : pairs[i]) {
+            if (projected[pair.target]) {
+                table.pairs.back().push_back(FallbackTable::Pair{new_index[pair.target], pair.duration});
+            }
+        }
+    }
+    return table;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    po::options_description desc("Precompute the times between the stops for asgard");
+    std::string conf_path;
+    std::string stops_path;
+    std::string output_path;
+    std::string modes_option;
+    uint32_t max_duration = 0;
+    size_t nb_threads = 0;
+    float walking_speed = 0;
+    float bike_speed = 0;
+    float bss_speed = 0;
+    float car_speed = 0;
+    float car_no_park_speed = 0;
+
+    // clang-format off
+    desc.add_options()
+            ("help", "Show this message")
+            ("conf_path,c", po::value<std::string>(&conf_path)->required(), "valhalla configuration")
+            ("stops,s", po::value<std::string>(&stops_path)->required(), "stops, in the format of the warmup file")
+            ("output,o", po::value<std::string>(&output_path)->default_value("asgard_fallback.bin"), "fallback table")
+            ("modes", po::value<std::string>(&modes_option)->default_value("walking,bike"), "modes of the table")
+            ("max_duration", po::value<uint32_t>(&max_duration)->default_value(1800), "in seconds, the pairs beyond are not reached")
+            ("threads,t", po::value<size_t>(&nb_threads)->default_value(std::thread::hardware_concurrency()), "number of threads")
+            ("walking_speed", po::value<float>(&walking_speed)->default_value(1.12f), "in m/s")
+            ("bike_speed", po::value<float>(&bike_speed)->default_value(4.1f), "in m/s")
+            ("bss_speed", po::value<float>(&bss_speed)->default_value(4.1f), "in m/s")
+            ("car_speed", po::value<float>(&car_speed)->default_value(11.11f), "in m/s")
+            ("car_no_park_speed", po::value<float>(&car_no_park_speed)->default_value(6.94f), "in m/s");
+    // clang-format on
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+    po::notify(vm);
+
+    boost::property_tree::ptree conf;
+    boost::property_tree::read_json(conf_path, conf);
+    const auto& graph_conf = conf.get_child("mjolnir");
+    const auto reachability = conf.get<unsigned int>("loki.service_defaults.minimum_reachability", 0);
+    const auto radius = conf.get<unsigned int>("loki.service_defaults.radius", 0);
+
+    // the other parameters keep the defaults of the requests
+    pbnavitia::StreetNetworkParams params;
+    params.set_walking_speed(walking_speed);
+    params.set_bike_speed(bike_speed);
+    params.set_bss_speed(bss_speed);
+    params.set_car_speed(car_speed);
+    params.set_car_no_park_speed(car_no_park_speed);
+
+    std::vector<std::string> modes;
+    boost::split(modes, modes_option, boost::is_any_of(","));
+    auto stops = warmup::read_warmup_file(stops_path);
+
+    // every stop is projected once
+    size_t nb_stops = 0;
+    for (const auto& mode : modes) {
+        nb_stops = std::max(nb_stops, stops[mode].size());
+    }
+    const Projector projector(nb_stops, nb_stops, nb_stops, nb_stops, reachability, reachability, radius);
+
+    std::vector<FallbackTable::ModeTable> tables;
+    for (const auto& mode : modes) {
+        const auto start = std::chrono::steady_clock::now();
+        tables.push_back(compute_mode_table(mode, stops[mode], max_duration, params, projector, graph_conf, nb_threads));
+        size_t nb_pairs = 0;
+        for (const auto& p : tables.back().pairs) {
+            nb_pairs += p.size();
+        }
+        const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+        std::cout << mode << ": " << tables.back().stops.size() << "/" << stops[mode].size() << " stops projected, "
+                  << nb_pairs << " pairs reached in " << duration.count() << "s" << std::endl;
+    }
+
+    valhalla::baldr::GraphReader graph(graph_conf);
+    FallbackTable::save(output_path, get_tileset_fingerprint(graph), tables);
+    std::cout << "fallback table written in " << output_path << std::endl;
+    return 0;
+}
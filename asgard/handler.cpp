@@ -17,7 +17,11 @@
 #include "asgard/handler.h"
 #include "utils/coord_parser.h"
 #include "asgard/context.h"
+#include "asgard/crow_fly_filter.h"
 #include "asgard/direct_path_response_builder.h"
+#include "asgard/fallback_table.h"
+#include "asgard/matrix_cache.h"
+#include "asgard/matrix_pool.h"
 #include "asgard/metrics.h"
 #include "asgard/projector.h"
 #include "asgard/request.pb.h"
@@ -31,6 +35,7 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/range/join.hpp>
 
+#include <algorithm>
 #include <ctime>
 #include <numeric>
 #include <utility>
@@ -39,13 +44,6 @@ using namespace valhalla;
 
 namespace asgard {
 
-using ValhallaLocations = google::protobuf::RepeatedPtrField<valhalla::Location>;
-using ProjectedLocations = std::unordered_map<midgard::PointLL, valhalla::baldr::PathLocation>;
-
-// The max size of matrix in jormungandr is 5000 so far...
-constexpr size_t MAX_MASK_SIZE = 10000;
-using ProjectionFailedMask = std::bitset<MAX_MASK_SIZE>;
-
 // The AVERAGE_SPEED is used to compute the cost_threshold, which is a safeguard on matrix's computation.
 // In valhalla, the cost_threshold is computed by dividing the distance by the average speed of the chosen travel mode.
 // This way of calculating is very approximate which caused the insufficient fallback duration in Navitia.
@@ -76,6 +74,15 @@ static const std::unordered_map<std::string, float> MAX_SPEED = {{"walking", 4},
                                                                  {"car", 50},
                                                                  {"taxi", 50}};
 
+// The fastest a path can go, in m/s: the walking speed is clamped to MAX_SPEED, the bikes
+// go up to twice their speed downhill, and no road is faster than MAX_SPEED for the cars.
+// The ferries are not bounded, a path taking one can go further.
+static const std::unordered_map<std::string, float> CROW_FLY_SPEED = {{"walking", 4},
+                                                                      {"bike", 30},
+                                                                      {"bss", 30},
+                                                                      {"car", 50},
+                                                                      {"taxi", 50}};
+
 namespace {
 
 pbnavitia::Response make_error_response(pbnavitia::Error_error_id err_id, const std::string& err_msg) {
@@ -87,40 +94,6 @@ pbnavitia::Response make_error_response(pbnavitia::Error_error_id err_id, const
     return error_response;
 }
 
-float get_max_distance(const std::string& mode, const pbnavitia::StreetNetworkRoutingMatrixRequest& request) {
-
-    const auto duration = request.max_duration();
-
-    if (duration < 0) {
-        throw std::runtime_error("Matrix max duration is negative");
-    }
-    float max_distance = 1;
-    auto const& params = request.streetnetwork_params();
-
-    switch (util::convert_navitia_to_streetnetwork_mode(mode)) {
-    case pbnavitia::StreetNetworkMode::Walking:
-        max_distance = duration * std::max(params.walking_speed(), AVERAGE_SPEED.at(mode)) * request.asgard_max_walking_duration_coeff();
-        break;
-    case pbnavitia::StreetNetworkMode::Bike:
-        max_distance = duration * std::max(params.bike_speed(), AVERAGE_SPEED.at(mode)) * request.asgard_max_bike_duration_coeff();
-        break;
-    case pbnavitia::StreetNetworkMode::Bss:
-        max_distance = duration * std::max(params.bss_speed(), AVERAGE_SPEED.at(mode)) * request.asgard_max_bss_duration_coeff();
-        break;
-    case pbnavitia::StreetNetworkMode::Car:
-    case pbnavitia::StreetNetworkMode::Taxi:
-        max_distance = duration * std::max(params.car_speed(), AVERAGE_SPEED.at(mode)) * request.asgard_max_car_duration_coeff();
-        break;
-    default:
-        throw std::runtime_error(std::string("Cannot compute max duration for mode: ") + mode);
-    }
-    if (max_distance > MAX_MATRIX_DISTANCE.at(mode)) {
-        LOG_ERROR(std::string("Matrix distance for mode ") + mode + " is too large, we have to clamp it");
-        return MAX_MATRIX_DISTANCE.at(mode);
-    }
-    return max_distance;
-}
-
 void clamp_speed(ModeCostingArgs& args) {
     for (const auto& mode : {"walking", "bike", "car", "taxi"}) {
         if (args.speeds[util::convert_navitia_to_valhalla_costing(mode)] > MAX_SPEED.at(mode)) {
@@ -175,38 +148,14 @@ make_modecosting_args(const pbnavitia::DirectPathRequest& request) {
     return args;
 }
 
-ModeCostingArgs
-make_modecosting_args(const pbnavitia::StreetNetworkRoutingMatrixRequest& request) {
-    ModeCostingArgs args{};
-
-    args.mode = request.mode();
-    auto const& request_params = request.streetnetwork_params();
-    fill_args_with_streetnetwork_params(request_params, args);
-    return args;
-}
-
-std::pair<ValhallaLocations, ProjectionFailedMask>
-make_valhalla_locations_from_projected_locations(const std::vector<midgard::PointLL>& navitia_locations,
-                                                 const ProjectedLocations& projected_locations,
-                                                 valhalla::baldr::GraphReader& graph) {
-    ValhallaLocations valhalla_locations;
-    // This mask is used to remember the index of navitia locations whose projection has failed
-    // 0 means projection OK, 1 means projection KO
-    ProjectionFailedMask projection_failed_mask;
-
-    size_t source_idx = -1;
-    for (const auto& l : navitia_locations) {
-        ++source_idx;
-        auto it = projected_locations.find(l);
-        if (it == projected_locations.end()) {
-            projection_failed_mask.set(source_idx);
+void log_projection_failures(const std::vector<midgard::PointLL>& navitia_locations,
+                             const std::vector<bool>& projected) {
+    for (size_t i = 0; i < navitia_locations.size(); ++i) {
+        if (!projected[i]) {
+            const auto& l = navitia_locations[i];
             LOG_ERROR("Cannot project coord: " + std::to_string(l.lng()) + ";" + std::to_string(l.lat()));
-            continue;
         }
-        baldr::PathLocation::toPBF(it->second, valhalla_locations.Add(), graph);
     }
-
-    return std::make_pair(std::move(valhalla_locations), projection_failed_mask);
 }
 
 template<typename T>
@@ -234,10 +183,69 @@ Finally<T> make_finally(T&& t) {
 
 } // namespace
 
+float get_max_distance(const std::string& mode, const pbnavitia::StreetNetworkRoutingMatrixRequest& request) {
+
+    const auto duration = request.max_duration();
+
+    if (duration < 0) {
+        throw std::runtime_error("Matrix max duration is negative");
+    }
+    float max_distance = 1;
+    auto const& params = request.streetnetwork_params();
+
+    switch (util::convert_navitia_to_streetnetwork_mode(mode)) {
+    case pbnavitia::StreetNetworkMode::Walking:
+        max_distance = duration * std::max(params.walking_speed(), AVERAGE_SPEED.at(mode)) * request.asgard_max_walking_duration_coeff();
+        break;
+    case pbnavitia::StreetNetworkMode::Bike:
+        max_distance = duration * std::max(params.bike_speed(), AVERAGE_SPEED.at(mode)) * request.asgard_max_bike_duration_coeff();
+        break;
+    case pbnavitia::StreetNetworkMode::Bss:
+        max_distance = duration * std::max(params.bss_speed(), AVERAGE_SPEED.at(mode)) * request.asgard_max_bss_duration_coeff();
+        break;
+    case pbnavitia::StreetNetworkMode::Car:
+    case pbnavitia::StreetNetworkMode::Taxi:
+        max_distance = duration * std::max(params.car_speed(), AVERAGE_SPEED.at(mode)) * request.asgard_max_car_duration_coeff();
+        break;
+    default:
+        throw std::runtime_error(std::string("Cannot compute max duration for mode: ") + mode);
+    }
+    if (max_distance > MAX_MATRIX_DISTANCE.at(mode)) {
+        LOG_ERROR(std::string("Matrix distance for mode ") + mode + " is too large, we have to clamp it");
+        return MAX_MATRIX_DISTANCE.at(mode);
+    }
+    return max_distance;
+}
+
+float get_max_crow_fly_distance(const std::string& mode, const pbnavitia::StreetNetworkRoutingMatrixRequest& request) {
+    const auto it = CROW_FLY_SPEED.find(mode);
+    if (it == CROW_FLY_SPEED.end()) {
+        throw std::runtime_error(std::string("Cannot compute max crow fly distance for mode: ") + mode);
+    }
+    return std::max(request.max_duration(), 0) * it->second;
+}
+
+ModeCostingArgs
+make_modecosting_args(const pbnavitia::StreetNetworkRoutingMatrixRequest& request) {
+    ModeCostingArgs args{};
+
+    args.mode = request.mode();
+    auto const& request_params = request.streetnetwork_params();
+    fill_args_with_streetnetwork_params(request_params, args);
+    return args;
+}
+
 Handler::Handler(const Context& context) : graph(context.graph),
                                            metrics(context.metrics),
                                            projector(context.projector),
-                                           valhalla_service_url(context.valhalla_service_url) {
+                                           valhalla_service_url(context.valhalla_service_url),
+                                           matrix_cache(context.matrix_cache),
+                                           fallback_table(context.fallback_table),
+                                           matrix_pool(context.matrix_pool),
+                                           matrix_auto_direction(context.matrix_auto_direction),
+                                           crow_fly_margin(context.crow_fly_margin),
+                                           matrix_engine(context.matrix_engine),
+                                           with_cost_matrix(context.with_cost_matrix) {
 }
 
 pbnavitia::Response Handler::handle(const pbnavitia::Request& request) {
@@ -269,97 +277,287 @@ pbnavitia::Response Handler::handle_matrix(const pbnavitia::Request& request) {
     const auto navitia_sources = util::convert_locations_to_pointLL(request.sn_routing_matrix().origins());
     const auto navitia_targets = util::convert_locations_to_pointLL(request.sn_routing_matrix().destinations());
 
-    mode_costing.update_costing(make_modecosting_args(request.sn_routing_matrix()));
-
-    const auto costing = mode_costing.get_costing_for_mode(mode);
+    const auto costing_args = make_modecosting_args(request.sn_routing_matrix());
+    mode_costing.update_costing(costing_args);
 
-    // We use the cache only when there are more than one element in the sources/targets, so the cache will keep only stop_points coord
-    bool use_cache = (navitia_sources.size() > 1);
-
-    const auto projected_sources_locations = projector(begin(navitia_sources), end(navitia_sources), graph, mode, costing, use_cache);
-    if (projected_sources_locations.empty()) {
-        LOG_ERROR("All sources projections failed!");
-        return make_error_response(pbnavitia::Error::no_origin, "origins projection failed!");
+    const auto max_distance = get_max_distance(mode, request.sn_routing_matrix());
+    std::vector<valhalla::thor::TimeDistance> res;
+    // the matrices between the stops of the precomputed table are neither projected nor searched
+    const bool in_fallback_table = fallback_table &&
+                                   fallback_table->find(mode, hash_value(costing_args), static_cast<uint32_t>(request.sn_routing_matrix().max_duration()),
+                                                        max_distance, navitia_sources, navitia_targets, res);
+    // nor are the targets further than the max distance from all the sources, as the crow flies
+    size_t nb_reachable_targets = navitia_targets.size();
+    if (!in_fallback_table && crow_fly_margin) {
+        const auto max_crow_fly_distance = get_max_crow_fly_distance(mode, request.sn_routing_matrix()) + *crow_fly_margin;
+        nb_reachable_targets = mark_reachable_targets(navitia_sources, navitia_targets, max_crow_fly_distance, reachable_targets);
     }
 
-    use_cache = (navitia_targets.size() > 1);
-    const auto projected_targets_locations = projector(begin(navitia_targets), end(navitia_targets), graph, mode, costing, use_cache);
-    if (projected_targets_locations.empty()) {
-        LOG_ERROR("All targets projections failed!");
-        return make_error_response(pbnavitia::Error::no_destination, "destinations projection failed!");
-    }
+    if (in_fallback_table) {
+        LOG_INFO("Matrix found in the fallback table");
+        projected_sources.assign(navitia_sources.size(), true);
+        projected_targets.assign(navitia_targets.size(), true);
+        metrics.observe_nb_fallback_table_hits(mode, fallback_table->get_nb_hits(mode));
+    } else if (nb_reachable_targets == 0) {
+        LOG_INFO("All targets are out of reach");
+        projected_sources.assign(navitia_sources.size(), false);
+        projected_targets.assign(navitia_targets.size(), false);
+    } else {
+        const auto costing = mode_costing.get_costing_for_mode(mode);
+        const auto costing_hash = hash_value(costing_args);
+
+        // We use the cache only when there are more than one element in the sources/targets, so the cache will keep only stop_points coord,
+        // unless the cache filters its admissions by itself
+        bool use_cache = (navitia_sources.size() > 1) || projector.has_admission_policy();
+
+        // the locations are written in the handler's buffers, to reuse their memory from one request to the other
+        projector.project_to_valhalla_locations(begin(navitia_sources), end(navitia_sources), graph, mode, costing, use_cache,
+                                                valhalla_location_sources, projected_sources, costing_hash);
+        if (valhalla_location_sources.empty()) {
+            LOG_ERROR("All sources projections failed!");
+            return make_error_response(pbnavitia::Error::no_origin, "origins projection failed!");
+        }
 
-    ValhallaLocations valhalla_location_sources;
-    ProjectionFailedMask projection_mask_sources;
-    std::tie(valhalla_location_sources, projection_mask_sources) = make_valhalla_locations_from_projected_locations(navitia_sources, projected_sources_locations, graph);
+        const bool some_out_of_reach = nb_reachable_targets < navitia_targets.size();
+        navitia_reachable_targets.clear();
+        if (some_out_of_reach) {
+            for (size_t i = 0; i < navitia_targets.size(); ++i) {
+                if (reachable_targets[i]) {
+                    navitia_reachable_targets.push_back(navitia_targets[i]);
+                }
+            }
+        }
+        const auto& projected_navitia_targets = some_out_of_reach ? navitia_reachable_targets : navitia_targets;
+
+        use_cache = (navitia_targets.size() > 1) || projector.has_admission_policy();
+        projector.project_to_valhalla_locations(begin(projected_navitia_targets), end(projected_navitia_targets), graph, mode, costing, use_cache,
+                                                valhalla_location_targets, projected_targets, costing_hash);
+        if (valhalla_location_targets.empty()) {
+            LOG_ERROR("All targets projections failed!");
+            return make_error_response(pbnavitia::Error::no_destination, "destinations projection failed!");
+        }
 
-    ValhallaLocations valhalla_location_targets;
-    ProjectionFailedMask projection_mask_targets;
-    std::tie(valhalla_location_targets, projection_mask_targets) = make_valhalla_locations_from_projected_locations(navitia_targets, projected_targets_locations, graph);
+        log_projection_failures(navitia_sources, projected_sources);
+        log_projection_failures(projected_navitia_targets, projected_targets);
 
-    LOG_INFO(std::to_string(projection_mask_sources.count()) + " origin(s) projection failed " +
-             std::to_string(projection_mask_targets.count()) + " target(s) projection failed");
+        LOG_INFO(std::to_string(navitia_sources.size() - valhalla_location_sources.size()) + " origin(s) projection failed " +
+                 std::to_string(projected_navitia_targets.size() - valhalla_location_targets.size()) + " target(s) projection failed " +
+                 std::to_string(navitia_targets.size() - projected_navitia_targets.size()) + " target(s) out of reach");
 
-    std::vector<valhalla::thor::TimeDistance> res;
-    if (mode == "bss") {
-        res = bss_matrix.SourceToTarget(valhalla_location_sources,
-                                        valhalla_location_targets,
-                                        graph,
-                                        mode_costing.get_costing(),
-                                        util::convert_navitia_to_valhalla_mode(mode),
-                                        get_max_distance(mode, request.sn_routing_matrix()));
+        // back to a mask of all the targets, those out of reach have no location either
+        if (some_out_of_reach) {
+            size_t projected = 0;
+            for (size_t i = 0; i < navitia_targets.size(); ++i) {
+                if (reachable_targets[i]) {
+                    reachable_targets[i] = projected_targets[projected++];
+                }
+            }
+            projected_targets.swap(reachable_targets);
+        }
 
-    } else {
-        res = matrix.SourceToTarget(valhalla_location_sources,
-                                    valhalla_location_targets,
-                                    graph,
-                                    mode_costing.get_costing(),
-                                    util::convert_navitia_to_valhalla_mode(mode),
-                                    get_max_distance(mode, request.sn_routing_matrix()));
+        if (matrix_cache && (navitia_sources.size() == 1 || navitia_targets.size() == 1)) {
+            res = compute_matrix_with_cache(mode, max_distance, costing_hash, navitia_sources, navitia_targets);
+            metrics.observe_matrix_cache(mode, matrix_cache->get_nb_hits(mode), matrix_cache->get_nb_miss(mode), matrix_cache->get_nb_tree_hits(mode));
+        } else {
+            res = compute_matrix(mode, max_distance, valhalla_location_sources, valhalla_location_targets);
+        }
+    }
+
+    // a cost per pair of projected locations, whatever the size of the matrix
+    const auto nb_costs = static_cast<size_t>(std::count(projected_sources.begin(), projected_sources.end(), true)) *
+                          static_cast<size_t>(std::count(projected_targets.begin(), projected_targets.end(), true));
+    // the response is built by walking the costs, a missing one would read past them
+    if (res.size() != nb_costs) {
+        const auto message = "Matrix computed with " + std::to_string(res.size()) + " costs instead of " + std::to_string(nb_costs);
+        LOG_ERROR(message);
+        return make_error_response(pbnavitia::Error::internal_error, message);
     }
 
     pbnavitia::Response response;
     int nb_unreached = 0;
+
     //in fact jormun don't want a real matrix, only a vector of solution :(
+    // so the one-to-many and many-to-one matrices are in a single row, the many-to-many ones have a row per source
+    const bool single_row = navitia_sources.size() == 1 || navitia_targets.size() == 1;
     auto* row = response.mutable_sn_routing_matrix()->add_rows();
-    assert(res.size() == valhalla_location_sources.size() * valhalla_location_targets.size());
-
-    const auto& failed_projection_mask = (navitia_sources.size() == 1) ? projection_mask_targets : projection_mask_sources;
-    size_t elt_idx = -1;
-    size_t resp_row_size = navitia_sources.size() == 1 ? navitia_targets.size() : navitia_sources.size();
-    assert(resp_row_size == failed_projection_mask.count() + res.size());
-
     auto res_it = res.cbegin();
-    while (++elt_idx < resp_row_size) {
-        auto* k = row->add_routing_response();
-        if (failed_projection_mask[elt_idx]) {
-            k->set_duration(-1);
-            k->set_routing_status(pbnavitia::RoutingStatus::unreached);
-            ++nb_unreached;
-        } else if (res_it != res.cend()) {
-            k->set_duration(res_it->time);
-            if (res_it->time == thor::kMaxCost ||
-                res_it->time > uint32_t(request.sn_routing_matrix().max_duration())) {
+    for (size_t source_idx = 0; source_idx < navitia_sources.size(); ++source_idx) {
+        if (!single_row && source_idx > 0) {
+            row = response.mutable_sn_routing_matrix()->add_rows();
+        }
+        for (size_t target_idx = 0; target_idx < navitia_targets.size(); ++target_idx) {
+            auto* k = row->add_routing_response();
+            if (!projected_sources[source_idx] || !projected_targets[target_idx]) {
+                k->set_duration(-1);
                 k->set_routing_status(pbnavitia::RoutingStatus::unreached);
                 ++nb_unreached;
             } else {
-                k->set_routing_status(pbnavitia::RoutingStatus::reached);
+                k->set_duration(res_it->time);
+                if (res_it->time == thor::kMaxCost ||
+                    res_it->time > uint32_t(request.sn_routing_matrix().max_duration())) {
+                    k->set_routing_status(pbnavitia::RoutingStatus::unreached);
+                    ++nb_unreached;
+                } else {
+                    k->set_routing_status(pbnavitia::RoutingStatus::reached);
+                }
+                ++res_it;
             }
-            ++res_it;
         }
     }
 
     LOG_INFO("Matrix Request done with " + std::to_string(nb_unreached) + " unreached");
 
     const auto duration = pt::microsec_clock::universal_time() - start;
-    metrics.observe_handle_matrix(mode, duration.total_milliseconds() / 1000.0);
-    for (auto const& mode : {"walking", "bike", "car"}) {
+    metrics.observe_handle_matrix(mode, matrix_algorithm ? to_string(*matrix_algorithm) : std::string("none"),
+                                  duration.total_milliseconds() / 1000.0);
+    for (auto const& mode : {"walking", "bike", "car", "taxi"}) {
         metrics.observe_nb_cache_miss(mode, projector.get_nb_cache_miss(mode), projector.get_nb_cache_calls(mode));
         metrics.observe_cache_size(mode, projector.get_current_cache_size(mode));
+        metrics.observe_cache_bytes(mode, projector.get_current_cache_bytes(mode));
+        metrics.observe_nb_cache_rejected(mode, projector.get_nb_cache_rejected(mode));
+        metrics.observe_negative_cache(mode, projector.get_nb_negative_cache_hits(mode), projector.get_negative_cache_size());
+        metrics.observe_nb_edge_index_hits(mode, projector.get_nb_edge_index_hits(mode));
+        metrics.observe_nb_shared_cache_hits(mode, projector.get_nb_shared_cache_hits(mode));
     }
     return response;
 }
 
+std::vector<thor::TimeDistance> Handler::compute_matrix(const std::string& mode,
+                                                        float max_distance,
+                                                        const google::protobuf::RepeatedPtrField<valhalla::Location>& sources,
+                                                        const google::protobuf::RepeatedPtrField<valhalla::Location>& targets) {
+    matrix_algorithm = choose_matrix_algorithm(mode, sources.size(), targets.size(), max_distance, matrix_engine, with_cost_matrix);
+    if (*matrix_algorithm == MatrixAlgorithm::bucket) {
+        return bucket_matrix.source_to_target(sources, targets, graph, matrix, mode_costing.get_costing(),
+                                              util::convert_navitia_to_valhalla_mode(mode), max_distance);
+    }
+    // a single search for the whole matrix, which is not split between threads
+    if (*matrix_algorithm == MatrixAlgorithm::cost_matrix) {
+        return cost_matrix.SourceToTarget(sources,
+                                          targets,
+                                          graph,
+                                          mode_costing.get_costing(),
+                                          util::convert_navitia_to_valhalla_mode(mode),
+                                          max_distance);
+    }
+    const auto direction = matrix_auto_direction ? choose_direction(sources.size(), targets.size()) : MatrixDirection::forward;
+    if (matrix_pool && matrix_pool->is_split(sources.size(), targets.size(), direction)) {
+        return matrix_pool->source_to_target(mode, sources, targets, direction, graph, matrix, bss_matrix, mode_costing.get_costing(), max_distance);
+    }
+    if (matrix_auto_direction) {
+        return compute_matrix_by_expansion(mode, sources, targets, direction, graph, matrix, bss_matrix, mode_costing.get_costing(), max_distance);
+    }
+    auto costs = mode == "bss" ? bss_matrix.SourceToTarget(sources,
+                                                           targets,
+                                                           graph,
+                                                           mode_costing.get_costing(),
+                                                           util::convert_navitia_to_valhalla_mode(mode),
+                                                           max_distance)
+                               : matrix.SourceToTarget(sources,
+                                                       targets,
+                                                       graph,
+                                                       mode_costing.get_costing(),
+                                                       util::convert_navitia_to_valhalla_mode(mode),
+                                                       max_distance);
+    // with fewer targets than sources, SourceToTarget expands from the targets and sorts the costs by target
+    if (sources.size() > targets.size()) {
+        return transpose(costs, sources.size(), targets.size());
+    }
+    return costs;
+}
+
+std::vector<thor::TimeDistance> Handler::compute_matrix_with_cache(const std::string& mode,
+                                                                   float max_distance,
+                                                                   size_t costing_hash,
+                                                                   const std::vector<midgard::PointLL>& navitia_sources,
+                                                                   const std::vector<midgard::PointLL>& navitia_targets) {
+    // many-to-one matrices have their own rows
+    const bool reverse = navitia_sources.size() != 1;
+    const auto& navitia_places = reverse ? navitia_sources : navitia_targets;
+    const auto& projected = reverse ? projected_sources : projected_targets;
+    const auto& locations = reverse ? valhalla_location_sources : valhalla_location_targets;
+
+    MatrixRowKey key;
+    key.location = (reverse ? valhalla_location_targets : valhalla_location_sources).Get(0).SerializeAsString();
+    key.mode = mode;
+    key.costing_hash = costing_hash;
+    key.max_distance = max_distance;
+    key.reverse = reverse;
+
+    // in the order of the projected locations
+    std::vector<midgard::PointLL> places;
+    for (size_t i = 0; i < navitia_places.size(); ++i) {
+        if (projected[i]) {
+            places.push_back(navitia_places[i]);
+        }
+    }
+    std::vector<boost::optional<MatrixCache::Cost>> cached;
+    const auto nb_cached = matrix_cache->find(key, places, cached);
+
+    // the edges settled by the last expansion from the source give the costs of the places on them,
+    // only when the cache keeps the trees: building one copies and sorts all the labels
+    size_t nb_tree_hits = 0;
+    const bool use_tree = !reverse && mode != "bss" && matrix_cache->keeps_trees();
+    if (use_tree && nb_cached < places.size()) {
+        const auto tree = matrix_cache->find_tree(key);
+        if (tree) {
+            std::vector<midgard::PointLL> tree_places;
+            std::vector<MatrixCache::Cost> tree_costs;
+            for (size_t i = 0; i < places.size(); ++i) {
+                if (cached[i]) {
+                    continue;
+                }
+                cached[i] = tree->find(locations.Get(i));
+                if (cached[i]) {
+                    tree_places.push_back(places[i]);
+                    tree_costs.push_back(*cached[i]);
+                }
+            }
+            nb_tree_hits = tree_places.size();
+            matrix_cache->insert(key, tree_places, tree_costs);
+            matrix_cache->add_tree_hits(mode, nb_tree_hits);
+        }
+    }
+
+    std::vector<thor::TimeDistance> res(places.size());
+    if (nb_cached + nb_tree_hits < places.size()) {
+        valhalla_location_missing.Clear();
+        std::vector<midgard::PointLL> missing_places;
+        std::vector<size_t> missing_positions;
+        for (size_t i = 0; i < places.size(); ++i) {
+            if (!cached[i]) {
+                valhalla_location_missing.Add()->CopyFrom(locations.Get(i));
+                missing_places.push_back(places[i]);
+                missing_positions.push_back(i);
+            }
+        }
+        std::vector<thor::TimeDistance> computed;
+        if (use_tree) {
+            matrix_algorithm = MatrixAlgorithm::time_distance;
+            computed = matrix.one_to_many(valhalla_location_sources.Get(0), valhalla_location_missing, graph, mode_costing.get_costing(),
+                                          util::convert_navitia_to_valhalla_mode(mode), max_distance);
+            matrix_cache->insert_tree(key, matrix.get_tree());
+            // one_to_many keeps its labels until then
+            matrix.Clear();
+        } else {
+            computed = reverse ? compute_matrix(mode, max_distance, valhalla_location_missing, valhalla_location_targets)
+                               : compute_matrix(mode, max_distance, valhalla_location_sources, valhalla_location_missing);
+        }
+        matrix_cache->insert(key, missing_places, computed);
+        for (size_t i = 0; i < computed.size() && i < missing_positions.size(); ++i) {
+            res[missing_positions[i]] = computed[i];
+        }
+    }
+    for (size_t i = 0; i < places.size(); ++i) {
+        if (cached[i]) {
+            res[i] = *cached[i];
+        }
+    }
+    LOG_INFO(std::to_string(nb_cached) + "/" + std::to_string(places.size()) + " matrix costs found in the cache, " +
+             std::to_string(nb_tree_hits) + " in the shortest path tree");
+    return res;
+}
+
 // TODO: Since there are more and more algorithms appearing and developped over different usages,
 //       we are supposed to enrich this function as what's done here:
 //       https://github.com/valhalla/valhalla/blob/master/src/thor/route_action.cc#L273
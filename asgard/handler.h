@@ -16,26 +16,41 @@
 
 #pragma once
 
+#include "asgard/bucket_matrix.h"
+#include "asgard/matrix_algorithm.h"
 #include "asgard/mode_costing.h"
 #include "asgard/response.pb.h"
+#include "asgard/shortest_path_tree.h"
 
 #include <valhalla/baldr/graphreader.h>
+#include <valhalla/midgard/pointll.h>
 #include <valhalla/thor/astar_bss.h>
 #include <valhalla/thor/bidirectional_astar.h>
+#include <valhalla/thor/costmatrix.h>
 #include <valhalla/thor/timedistancebssmatrix.h>
 #include <valhalla/thor/timedistancematrix.h>
 #include <valhalla/thor/unidirectional_astar.h>
 
 namespace pbnavitia {
 class Request;
+class StreetNetworkRoutingMatrixRequest;
 }
 
 namespace asgard {
 
 struct Context;
+class FallbackTable;
+class MatrixCache;
+class MatrixPool;
 class Metrics;
 class Projector;
 
+// The costing of a matrix request, and the distance beyond which its search stops
+ModeCostingArgs make_modecosting_args(const pbnavitia::StreetNetworkRoutingMatrixRequest& request);
+float get_max_distance(const std::string& mode, const pbnavitia::StreetNetworkRoutingMatrixRequest& request);
+// The distance as the crow flies that a path of the request can cover within its max duration, ferries aside
+float get_max_crow_fly_distance(const std::string& mode, const pbnavitia::StreetNetworkRoutingMatrixRequest& request);
+
 struct Handler {
     explicit Handler(const Context&);
     pbnavitia::Response handle(const pbnavitia::Request&);
@@ -44,6 +59,18 @@ private:
     pbnavitia::Response handle_matrix(const pbnavitia::Request&);
     pbnavitia::Response handle_direct_path(const pbnavitia::Request&);
 
+    std::vector<valhalla::thor::TimeDistance> compute_matrix(const std::string& mode,
+                                                             float max_distance,
+                                                             const google::protobuf::RepeatedPtrField<valhalla::Location>& sources,
+                                                             const google::protobuf::RepeatedPtrField<valhalla::Location>& targets);
+    // Only compute the places unknown by the row of the single source (or target) in the matrix cache,
+    // or by the shortest path tree kept for the single source
+    std::vector<valhalla::thor::TimeDistance> compute_matrix_with_cache(const std::string& mode,
+                                                                        float max_distance,
+                                                                        size_t costing_hash,
+                                                                        const std::vector<valhalla::midgard::PointLL>& navitia_sources,
+                                                                        const std::vector<valhalla::midgard::PointLL>& navitia_targets);
+
     valhalla::thor::PathAlgorithm& get_path_algorithm(const valhalla::Location& origin,
                                                       const valhalla::Location& destination,
                                                       const std::string& mode);
@@ -52,22 +79,47 @@ private:
         if (graph.OverCommitted()) { graph.Clear(); }
         matrix.Clear();
         bss_matrix.Clear();
+        cost_matrix.Clear();
+        matrix_algorithm = boost::none;
         bss_astar.Clear();
         bda.Clear();
         timedep_forward.Clear();
     };
 
     valhalla::baldr::GraphReader& graph;
-    valhalla::thor::TimeDistanceMatrix matrix;
+    ReusableTimeDistanceMatrix matrix;
     valhalla::thor::TimeDistanceBSSMatrix bss_matrix;
+    BucketMatrix bucket_matrix;
+    valhalla::thor::CostMatrix cost_matrix;
+    // the algorithm of the last matrix computed, none when all its costs were known
+    boost::optional<MatrixAlgorithm> matrix_algorithm;
 
     valhalla::thor::AStarBSSAlgorithm bss_astar;
     valhalla::thor::BidirectionalAStar bda;
     valhalla::thor::TimeDepForward timedep_forward;
     ModeCosting mode_costing;
+
+    // the projections of the matrix, kept to reuse their memory
+    google::protobuf::RepeatedPtrField<valhalla::Location> valhalla_location_sources;
+    google::protobuf::RepeatedPtrField<valhalla::Location> valhalla_location_targets;
+    std::vector<bool> projected_sources;
+    std::vector<bool> projected_targets;
+    // the targets kept by the crow fly filter, and their coordinates
+    std::vector<bool> reachable_targets;
+    std::vector<valhalla::midgard::PointLL> navitia_reachable_targets;
+    // the places missing from the matrix cache
+    google::protobuf::RepeatedPtrField<valhalla::Location> valhalla_location_missing;
+
     const Metrics& metrics;
     const Projector& projector;
     const boost::optional<std::string>& valhalla_service_url;
+    const MatrixCache* matrix_cache;
+    const FallbackTable* fallback_table;
+    const MatrixPool* matrix_pool;
+    const bool matrix_auto_direction;
+    const boost::optional<float> crow_fly_margin;
+    const MatrixEngine matrix_engine;
+    const bool with_cost_matrix;
 };
 
 } // namespace asgard
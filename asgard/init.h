@@ -96,6 +96,26 @@ inline void init_signal_handling() {
     signal(SIGINT, before_exit);
 }
 
+// Set by the signal handlers, polled by the thread writing the projector's snapshot
+volatile std::sig_atomic_t snapshot_requested = 0;
+volatile std::sig_atomic_t shutdown_requested = 0;
+
+void request_snapshot(int) {
+    snapshot_requested = 1;
+}
+
+void request_shutdown(int) {
+    shutdown_requested = 1;
+}
+
+// When the projector's cache is persisted, SIGUSR1 asks for a snapshot and
+// SIGTERM/SIGINT let the snapshot thread write a last one before exiting
+inline void init_snapshot_signal_handling() {
+    signal(SIGUSR1, request_snapshot);
+    signal(SIGTERM, request_shutdown);
+    signal(SIGINT, request_shutdown);
+}
+
 inline void init_app() {
     init_signal_handling();
 }
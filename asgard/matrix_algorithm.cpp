@@ -0,0 +1,72 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#include "asgard/matrix_algorithm.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace asgard {
+
+namespace {
+
+// Both constants are guesses, not measures: they have to be checked with
+// benchmark_matrix --compare_engines on a real coverage before
+// ASGARD_COST_MATRIX is turned on.
+// A label of CostMatrix costs more than a label of TimeDistanceMatrix
+const double COST_MATRIX_LABEL_OVERHEAD = 1.2;
+// The check of a connection, in square meters of expansion
+const double COST_MATRIX_CONNECTION_AREA = 1e4;
+
+double area(double distance) {
+    return distance * distance;
+}
+
+} // namespace
+
+std::string to_string(MatrixAlgorithm algorithm) {
+    switch (algorithm) {
+    case MatrixAlgorithm::time_distance: return "time_distance";
+    case MatrixAlgorithm::bucket: return "bucket";
+    case MatrixAlgorithm::cost_matrix: return "cost_matrix";
+    default: throw std::invalid_argument("Bad to_string(MatrixAlgorithm) parameter");
+    }
+}
+
+MatrixAlgorithm choose_matrix_algorithm(const std::string& mode,
+                                        size_t nb_sources,
+                                        size_t nb_targets,
+                                        float max_distance,
+                                        MatrixEngine engine,
+                                        bool with_cost_matrix) {
+    // a single expansion is as good as it gets
+    if (nb_sources <= 1 || nb_targets <= 1) {
+        return MatrixAlgorithm::time_distance;
+    }
+    if (engine == MatrixEngine::bucket && (mode == "walking" || mode == "bike")) {
+        return MatrixAlgorithm::bucket;
+    }
+    if (with_cost_matrix && (mode == "car" || mode == "taxi")) {
+        const double time_distance = std::min(nb_sources, nb_targets) * area(max_distance);
+        const double cost_matrix = (nb_sources + nb_targets) * area(max_distance / 2.) * COST_MATRIX_LABEL_OVERHEAD +
+                                   static_cast<double>(nb_sources) * nb_targets * COST_MATRIX_CONNECTION_AREA;
+        return cost_matrix < time_distance ? MatrixAlgorithm::cost_matrix : MatrixAlgorithm::time_distance;
+    }
+    return MatrixAlgorithm::time_distance;
+}
+
+} // namespace asgard
@@ -0,0 +1,56 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "asgard/bucket_matrix.h"
+
+#include <cstddef>
+#include <string>
+
+namespace asgard {
+
+enum class MatrixAlgorithm {
+    // TimeDistanceMatrix or TimeDistanceBSSMatrix, one expansion per source or per target
+    time_distance,
+    // BucketMatrix
+    bucket,
+    // CostMatrix, a bidirectional search per pair of locations, sharing the expansions
+    cost_matrix
+};
+
+std::string to_string(MatrixAlgorithm algorithm);
+
+/**
+ * The algorithm expected to compute the matrix the fastest.
+ *
+ * The bucket engine, once configured, computes all the many-to-many walking
+ * and bike matrices. For car and taxi, as in valhalla's matrix service,
+ * CostMatrix competes with the expansions of TimeDistanceMatrix: an expansion
+ * settles about the edges of the disk of its distance, so
+ *  - time_distance costs min(S, T) expansions to the max distance
+ *  - cost_matrix costs S + T expansions to half of it, with heavier labels,
+ *    and the connections between every pair
+ */
+MatrixAlgorithm choose_matrix_algorithm(const std::string& mode,
+                                        size_t nb_sources,
+                                        size_t nb_targets,
+                                        float max_distance,
+                                        MatrixEngine engine,
+                                        bool with_cost_matrix);
+
+} // namespace asgard
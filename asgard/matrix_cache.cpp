@@ -0,0 +1,170 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#include "asgard/matrix_cache.h"
+
+#include <boost/functional/hash.hpp>
+
+#include <algorithm>
+
+namespace asgard {
+
+size_t MatrixRowKeyHash::operator()(const MatrixRowKey& key) const {
+    size_t seed = std::hash<std::string>()(key.location);
+    boost::hash_combine(seed, key.mode);
+    boost::hash_combine(seed, key.costing_hash);
+    boost::hash_combine(seed, key.max_distance);
+    boost::hash_combine(seed, key.reverse);
+    return seed;
+}
+
+MatrixCache::MatrixCache(size_t max_nb_rows, size_t max_row_size, size_t max_nb_trees) : max_nb_rows(max_nb_rows),
+                                                                                         max_row_size(max_row_size),
+                                                                                         max_nb_trees(max_nb_trees) {}
+
+boost::optional<size_t> MatrixCache::mode_index(const std::string& mode) {
+    static const std::array<std::string, nb_modes> modes = {{"walking", "bike", "car", "taxi", "bss"}};
+    const auto it = std::find(modes.begin(), modes.end(), mode);
+    if (it == modes.end()) {
+        return boost::none;
+    }
+    return static_cast<size_t>(it - modes.begin());
+}
+
+size_t MatrixCache::find(const MatrixRowKey& key,
+                         const std::vector<valhalla::midgard::PointLL>& places,
+                         std::vector<boost::optional<Cost>>& costs) const {
+    costs.assign(places.size(), boost::none);
+    size_t nb_found = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& list = rows.get<0>();
+        const auto& map = rows.get<1>();
+        const auto search = map.find(key);
+        if (search != map.end()) {
+            list.relocate(list.begin(), rows.project<0>(search));
+            const auto& row = search->second;
+            for (size_t i = 0; i < places.size(); ++i) {
+                const auto cost = row.find(places[i]);
+                if (cost != row.end()) {
+                    costs[i] = cost->second;
+                    ++nb_found;
+                }
+            }
+        }
+    }
+    const auto m = mode_index(key.mode);
+    if (m) {
+        nb_hits[*m].fetch_add(nb_found, std::memory_order_relaxed);
+        nb_miss[*m].fetch_add(places.size() - nb_found, std::memory_order_relaxed);
+    }
+    return nb_found;
+}
+
+void MatrixCache::insert(const MatrixRowKey& key,
+                         const std::vector<valhalla::midgard::PointLL>& places,
+                         const std::vector<Cost>& costs) const {
+    if (max_nb_rows == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& list = rows.get<0>();
+    auto& map = rows.get<1>();
+    auto search = map.find(key);
+    if (search == map.end()) {
+        list.push_front(std::make_pair(key, Row()));
+        search = map.find(key);
+    } else {
+        list.relocate(list.begin(), rows.project<0>(search));
+    }
+    map.modify(search, [&](value_type& value) {
+        auto& row = value.second;
+        for (size_t i = 0; i < places.size() && i < costs.size() && row.size() < max_row_size; ++i) {
+            row[places[i]] = costs[i];
+        }
+    });
+    while (list.size() > max_nb_rows) {
+        list.pop_back();
+    }
+}
+
+std::shared_ptr<const ShortestPathTree> MatrixCache::find_tree(const MatrixRowKey& key) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& list = trees.get<0>();
+    const auto& map = trees.get<1>();
+    const auto search = map.find(key);
+    if (search == map.end()) {
+        return nullptr;
+    }
+    list.relocate(list.begin(), trees.project<0>(search));
+    return search->second;
+}
+
+void MatrixCache::insert_tree(const MatrixRowKey& key, std::shared_ptr<const ShortestPathTree> tree) const {
+    if (max_nb_trees == 0 || !tree) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& list = trees.get<0>();
+    auto& map = trees.get<1>();
+    auto search = map.find(key);
+    if (search == map.end()) {
+        list.push_front(std::make_pair(key, std::move(tree)));
+    } else {
+        list.relocate(list.begin(), trees.project<0>(search));
+        if (tree->get_nb_labels() > search->second->get_nb_labels()) {
+            map.modify(search, [&](tree_type& value) { value.second = std::move(tree); });
+        }
+    }
+    while (list.size() > max_nb_trees) {
+        list.pop_back();
+    }
+}
+
+void MatrixCache::add_tree_hits(const std::string& mode, size_t nb) const {
+    const auto m = mode_index(mode);
+    if (m) {
+        nb_tree_hits[*m].fetch_add(nb, std::memory_order_relaxed);
+    }
+}
+
+size_t MatrixCache::get_nb_hits(const std::string& mode) const {
+    const auto m = mode_index(mode);
+    return m ? nb_hits[*m].load() : 0;
+}
+
+size_t MatrixCache::get_nb_miss(const std::string& mode) const {
+    const auto m = mode_index(mode);
+    return m ? nb_miss[*m].load() : 0;
+}
+
+size_t MatrixCache::get_nb_tree_hits(const std::string& mode) const {
+    const auto m = mode_index(mode);
+    return m ? nb_tree_hits[*m].load() : 0;
+}
+
+size_t MatrixCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return rows.size();
+}
+
+size_t MatrixCache::get_nb_trees() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return trees.size();
+}
+
+} // namespace asgard
@@ -0,0 +1,125 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "asgard/shortest_path_tree.h"
+
+#include <valhalla/midgard/pointll.h>
+#include <valhalla/thor/timedistancematrix.h>
+
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/optional.hpp>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace asgard {
+
+struct MatrixRowKey {
+    // the serialized projection of the single location of the matrix
+    std::string location;
+    std::string mode;
+    size_t costing_hash = 0;
+    float max_distance = 0;
+    // the costs are from the places to the location
+    bool reverse = false;
+
+    bool operator==(const MatrixRowKey& other) const {
+        return location == other.location && mode == other.mode && costing_hash == other.costing_hash &&
+               max_distance == other.max_distance && reverse == other.reverse;
+    }
+};
+
+struct MatrixRowKeyHash {
+    size_t operator()(const MatrixRowKey& key) const;
+};
+
+/**
+ * The rows of the one-to-many (and many-to-one) matrices, kept from one
+ * request to the other.
+ *
+ * Jormungandr asks again and again for the fallback of the same stop area,
+ * towards overlapping sets of places. A row holds the time and distance to
+ * every place computed so far for the same location, mode, costing and
+ * search distance, so only the places it does not know are computed.
+ * The least recently used rows are dropped first.
+ *
+ * The shortest path trees of the last forward expansions can be kept as
+ * well: a place missing from the row is read from the tree when all its
+ * edges were settled by the expansion.
+ */
+class MatrixCache {
+public:
+    using Cost = valhalla::thor::TimeDistance;
+
+    // A row stops growing at max_row_size places
+    explicit MatrixCache(size_t max_nb_rows, size_t max_row_size = 10000, size_t max_nb_trees = 0);
+
+    // Set costs[i] for the places known by the row, return how many there are
+    size_t find(const MatrixRowKey& key,
+                const std::vector<valhalla::midgard::PointLL>& places,
+                std::vector<boost::optional<Cost>>& costs) const;
+    void insert(const MatrixRowKey& key,
+                const std::vector<valhalla::midgard::PointLL>& places,
+                const std::vector<Cost>& costs) const;
+
+    std::shared_ptr<const ShortestPathTree> find_tree(const MatrixRowKey& key) const;
+    // The tree already kept for the key is only replaced by a larger one
+    void insert_tree(const MatrixRowKey& key, std::shared_ptr<const ShortestPathTree> tree) const;
+    // Count the places read from a tree instead of being computed
+    void add_tree_hits(const std::string& mode, size_t nb) const;
+
+    // Counted by place, bss included, the unknown modes are not counted
+    size_t get_nb_hits(const std::string& mode) const;
+    size_t get_nb_miss(const std::string& mode) const;
+    size_t get_nb_tree_hits(const std::string& mode) const;
+    size_t size() const;
+    size_t get_nb_trees() const;
+    // False when max_nb_trees is 0, no tree is worth building then
+    bool keeps_trees() const { return max_nb_trees > 0; }
+
+private:
+    static constexpr size_t nb_modes = 5;
+    static boost::optional<size_t> mode_index(const std::string& mode);
+
+    using Row = std::unordered_map<valhalla::midgard::PointLL, Cost>;
+    using value_type = std::pair<const MatrixRowKey, Row>;
+    using Cache = boost::multi_index_container<value_type, boost::multi_index::indexed_by<boost::multi_index::sequenced<>, boost::multi_index::hashed_unique<boost::multi_index::member<value_type, const MatrixRowKey, &value_type::first>, MatrixRowKeyHash>>>;
+    using tree_type = std::pair<const MatrixRowKey, std::shared_ptr<const ShortestPathTree>>;
+    using TreeCache = boost::multi_index_container<tree_type, boost::multi_index::indexed_by<boost::multi_index::sequenced<>, boost::multi_index::hashed_unique<boost::multi_index::member<tree_type, const MatrixRowKey, &tree_type::first>, MatrixRowKeyHash>>>;
+
+    const size_t max_nb_rows;
+    const size_t max_row_size;
+    const size_t max_nb_trees;
+    mutable Cache rows;
+    mutable TreeCache trees;
+    mutable std::mutex mutex;
+    mutable std::array<std::atomic<size_t>, nb_modes> nb_hits{};
+    mutable std::array<std::atomic<size_t>, nb_modes> nb_miss{};
+    mutable std::array<std::atomic<size_t>, nb_modes> nb_tree_hits{};
+};
+
+} // namespace asgard
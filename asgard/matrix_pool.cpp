@@ -0,0 +1,213 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#include "asgard/matrix_pool.h"
+#include "asgard/util.h"
+
+#include <valhalla/midgard/logging.h>
+
+#include <algorithm>
+#include <exception>
+#include <future>
+#include <memory>
+
+namespace asgard {
+
+namespace {
+
+using Costs = std::vector<valhalla::thor::TimeDistance>;
+
+// The expansions [begin, end) of the side of the direction, the costs are sorted by expansion
+Costs expand(const std::string& mode,
+             const google::protobuf::RepeatedPtrField<valhalla::Location>& sources,
+             const google::protobuf::RepeatedPtrField<valhalla::Location>& targets,
+             MatrixDirection direction,
+             size_t begin,
+             size_t end,
+             valhalla::baldr::GraphReader& graph,
+             ReusableTimeDistanceMatrix& matrix,
+             valhalla::thor::TimeDistanceBSSMatrix& bss_matrix,
+             const Costing& costing,
+             float max_distance) {
+    const bool forward = direction == MatrixDirection::forward;
+    const auto& others = forward ? targets : sources;
+    Costs costs;
+    costs.reserve((end - begin) * others.size());
+    const auto travel_mode = util::convert_navitia_to_valhalla_mode(mode);
+    google::protobuf::RepeatedPtrField<valhalla::Location> location;
+    for (size_t i = begin; i < end; ++i) {
+        Costs line;
+        if (mode == "bss") {
+            // the bss matrix has no direct access to its expansions, a single source or target is expanded from
+            location.Clear();
+            location.Add()->CopyFrom(forward ? sources.Get(i) : targets.Get(i));
+            line = forward ? bss_matrix.SourceToTarget(location, targets, graph, costing, travel_mode, max_distance)
+                           : bss_matrix.SourceToTarget(sources, location, graph, costing, travel_mode, max_distance);
+        } else {
+            line = forward ? matrix.one_to_many(sources.Get(i), targets, graph, costing, travel_mode, max_distance)
+                           : matrix.many_to_one(targets.Get(i), sources, graph, costing, travel_mode, max_distance);
+            matrix.Clear();
+        }
+        costs.insert(costs.end(), line.begin(), line.end());
+        if (graph.OverCommitted()) { graph.Clear(); }
+    }
+    return costs;
+}
+
+} // namespace
+
+std::vector<valhalla::thor::TimeDistance> transpose(const std::vector<valhalla::thor::TimeDistance>& costs, size_t nb_sources, size_t nb_targets) {
+    Costs transposed(costs.size());
+    for (size_t t = 0; t < nb_targets; ++t) {
+        for (size_t s = 0; s < nb_sources; ++s) {
+            transposed[s * nb_targets + t] = costs[t * nb_sources + s];
+        }
+    }
+    return transposed;
+}
+
+MatrixDirection choose_direction(size_t nb_sources, size_t nb_targets) {
+    return nb_targets < nb_sources ? MatrixDirection::reverse : MatrixDirection::forward;
+}
+
+std::vector<valhalla::thor::TimeDistance> compute_matrix_by_expansion(const std::string& mode,
+                                                                      const google::protobuf::RepeatedPtrField<valhalla::Location>& sources,
+                                                                      const google::protobuf::RepeatedPtrField<valhalla::Location>& targets,
+                                                                      MatrixDirection direction,
+                                                                      valhalla::baldr::GraphReader& graph,
+                                                                      ReusableTimeDistanceMatrix& matrix,
+                                                                      valhalla::thor::TimeDistanceBSSMatrix& bss_matrix,
+                                                                      const Costing& costing,
+                                                                      float max_distance) {
+    if (direction == MatrixDirection::forward) {
+        return expand(mode, sources, targets, direction, 0, sources.size(), graph, matrix, bss_matrix, costing, max_distance);
+    }
+    return transpose(expand(mode, sources, targets, direction, 0, targets.size(), graph, matrix, bss_matrix, costing, max_distance),
+                     sources.size(), targets.size());
+}
+
+MatrixPool::MatrixPool(const boost::property_tree::ptree& graph_conf, size_t nb_threads, size_t min_matrix_size) : min_matrix_size(std::max<size_t>(1, min_matrix_size)) {
+    for (size_t i = 0; i < nb_threads; ++i) {
+        threads.emplace_back(&MatrixPool::run, this, graph_conf);
+    }
+    LOG_INFO("Matrix pool started with " + std::to_string(nb_threads) + " threads");
+}
+
+MatrixPool::~MatrixPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    tasks_available.notify_all();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+void MatrixPool::run(const boost::property_tree::ptree& graph_conf) {
+    valhalla::baldr::GraphReader graph(graph_conf);
+    ReusableTimeDistanceMatrix matrix;
+    valhalla::thor::TimeDistanceBSSMatrix bss_matrix;
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            tasks_available.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task(graph, matrix, bss_matrix);
+        matrix.Clear();
+        bss_matrix.Clear();
+        if (graph.OverCommitted()) { graph.Clear(); }
+    }
+}
+
+bool MatrixPool::is_split(size_t nb_sources, size_t nb_targets, MatrixDirection direction) const {
+    const auto nb_expansions = direction == MatrixDirection::forward ? nb_sources : nb_targets;
+    return !threads.empty() && nb_expansions > 1 && nb_sources * nb_targets >= min_matrix_size;
+}
+
+std::vector<valhalla::thor::TimeDistance> MatrixPool::source_to_target(const std::string& mode,
+                                                                       const google::protobuf::RepeatedPtrField<valhalla::Location>& sources,
+                                                                       const google::protobuf::RepeatedPtrField<valhalla::Location>& targets,
+                                                                       MatrixDirection direction,
+                                                                       valhalla::baldr::GraphReader& graph,
+                                                                       ReusableTimeDistanceMatrix& matrix,
+                                                                       valhalla::thor::TimeDistanceBSSMatrix& bss_matrix,
+                                                                       const Costing& costing,
+                                                                       float max_distance) const {
+    if (!is_split(sources.size(), targets.size(), direction)) {
+        return compute_matrix_by_expansion(mode, sources, targets, direction, graph, matrix, bss_matrix, costing, max_distance);
+    }
+
+    const size_t nb_expansions = direction == MatrixDirection::forward ? sources.size() : targets.size();
+    const size_t nb_batches = std::min(threads.size() + 1, nb_expansions);
+    const size_t batch_size = (nb_expansions + nb_batches - 1) / nb_batches;
+    auto batch_begin = [&](size_t i) { return std::min(nb_expansions, i * batch_size); };
+
+    // the tasks use the locations of the caller, which waits for all of them before returning
+    std::vector<std::future<Costs>> futures;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 1; i < nb_batches; ++i) {
+            auto promise = std::make_shared<std::promise<Costs>>();
+            futures.push_back(promise->get_future());
+            tasks.emplace_back([promise, &mode, &sources, &targets, direction, costing, max_distance, begin = batch_begin(i), end = batch_begin(i + 1)](
+                                   valhalla::baldr::GraphReader& graph,
+                                   ReusableTimeDistanceMatrix& matrix,
+                                   valhalla::thor::TimeDistanceBSSMatrix& bss_matrix) {
+                try {
+                    promise->set_value(expand(mode, sources, targets, direction, begin, end, graph, matrix, bss_matrix, costing, max_distance));
+                } catch (...) {
+                    promise->set_exception(std::current_exception());
+                }
+            });
+        }
+    }
+    tasks_available.notify_all();
+
+    // the calling thread does its share of the work instead of waiting
+    std::exception_ptr error;
+    Costs costs;
+    try {
+        costs = expand(mode, sources, targets, direction, 0, batch_begin(1), graph, matrix, bss_matrix, costing, max_distance);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    costs.reserve(sources.size() * targets.size());
+    for (auto& f : futures) {
+        try {
+            const auto batch_costs = f.get();
+            costs.insert(costs.end(), batch_costs.begin(), batch_costs.end());
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (direction == MatrixDirection::reverse) {
+        return transpose(costs, sources.size(), targets.size());
+    }
+    return costs;
+}
+
+} // namespace asgard
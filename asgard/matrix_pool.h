@@ -0,0 +1,113 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include "asgard/mode_costing.h"
+#include "asgard/shortest_path_tree.h"
+
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/proto/tripcommon.pb.h>
+#include <valhalla/thor/timedistancebssmatrix.h>
+#include <valhalla/thor/timedistancematrix.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace asgard {
+
+// The side of the matrix the expansions start from: one expansion per source
+// for forward, one reverse expansion per target for reverse
+enum class MatrixDirection {
+    forward,
+    reverse
+};
+
+// The side with the fewest locations, as each expansion costs about the same
+MatrixDirection choose_direction(size_t nb_sources, size_t nb_targets);
+
+// The costs of a matrix sorted by target then by source, sorted by source then by target
+std::vector<valhalla::thor::TimeDistance> transpose(const std::vector<valhalla::thor::TimeDistance>& costs, size_t nb_sources, size_t nb_targets);
+
+// One expansion per source, or per target, the costs are sorted by source then by target whatever the direction
+std::vector<valhalla::thor::TimeDistance> compute_matrix_by_expansion(const std::string& mode,
+                                                                      const google::protobuf::RepeatedPtrField<valhalla::Location>& sources,
+                                                                      const google::protobuf::RepeatedPtrField<valhalla::Location>& targets,
+                                                                      MatrixDirection direction,
+                                                                      valhalla::baldr::GraphReader& graph,
+                                                                      ReusableTimeDistanceMatrix& matrix,
+                                                                      valhalla::thor::TimeDistanceBSSMatrix& bss_matrix,
+                                                                      const Costing& costing,
+                                                                      float max_distance);
+
+/**
+ * Threads shared by all the workers to compute large many-to-many matrices.
+ *
+ * TimeDistanceMatrix runs the expansions of the sources one after the other.
+ * A large matrix is split in batches of sources (or of targets, when the
+ * expansions start from them): the calling thread computes the first one with
+ * its own matrix, while the pool's threads, each with its own GraphReader and
+ * matrices, compute the others. A single expansion, as in a one-to-many
+ * matrix, is never split.
+ */
+class MatrixPool {
+public:
+    // Matrices of less than min_matrix_size costs are not split
+    MatrixPool(const boost::property_tree::ptree& graph_conf, size_t nb_threads, size_t min_matrix_size);
+    ~MatrixPool();
+
+    MatrixPool(const MatrixPool&) = delete;
+    MatrixPool& operator=(const MatrixPool&) = delete;
+
+    bool is_split(size_t nb_sources, size_t nb_targets, MatrixDirection direction) const;
+
+    // Same as compute_matrix_by_expansion, the costs are sorted by source then by target
+    std::vector<valhalla::thor::TimeDistance> source_to_target(const std::string& mode,
+                                                               const google::protobuf::RepeatedPtrField<valhalla::Location>& sources,
+                                                               const google::protobuf::RepeatedPtrField<valhalla::Location>& targets,
+                                                               MatrixDirection direction,
+                                                               valhalla::baldr::GraphReader& graph,
+                                                               ReusableTimeDistanceMatrix& matrix,
+                                                               valhalla::thor::TimeDistanceBSSMatrix& bss_matrix,
+                                                               const Costing& costing,
+                                                               float max_distance) const;
+
+    size_t get_nb_threads() const { return threads.size(); }
+
+private:
+    using Task = std::function<void(valhalla::baldr::GraphReader&,
+                                    ReusableTimeDistanceMatrix&,
+                                    valhalla::thor::TimeDistanceBSSMatrix&)>;
+
+    void run(const boost::property_tree::ptree& graph_conf);
+
+    const size_t min_matrix_size;
+    std::vector<std::thread> threads;
+    mutable std::deque<Task> tasks;
+    mutable std::mutex mutex;
+    mutable std::condition_variable tasks_available;
+    bool stopping = false;
+};
+
+} // namespace asgard
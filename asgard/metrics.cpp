@@ -2,6 +2,7 @@
 
 #include "asgard/asgard_conf.h"
 #include "asgard/conf.h"
+#include "asgard/matrix_algorithm.h"
 
 #include <prometheus/exposer.h>
 #include <prometheus/family.h>
@@ -71,7 +72,26 @@ Metrics::Metrics(const boost::optional<const AsgardConf&>& config) {
         {"max_walking_cache_size", std::to_string(conf.cache_size.at("walking"))},
         {"max_bike_cache_size", std::to_string(conf.cache_size.at("bike"))},
         {"max_car_cache_size", std::to_string(conf.cache_size.at("car"))},
+        {"max_taxi_cache_size", std::to_string(conf.cache_size.at("taxi"))},
+        {"projector_cache_shards", std::to_string(conf.projector_cache_conf.nb_shards)},
+        {"projector_cache_policy", to_string(conf.projector_cache_conf.policy)},
+        {"projector_cache_max_bytes", std::to_string(conf.projector_cache_conf.max_bytes)},
+        {"max_negative_cache_size", std::to_string(conf.projector_cache_conf.negative_cache_size)},
+        {"negative_cache_ttl", std::to_string(conf.projector_cache_conf.negative_cache_ttl)},
+        {"projector_key_precision", std::to_string(conf.projector_cache_conf.key_precision)},
+        {"projector_key_tolerance", std::to_string(conf.projector_cache_conf.key_tolerance)},
         {"nb_threads", std::to_string(conf.nb_threads)},
+        {"nb_projection_threads", std::to_string(conf.nb_projection_threads)},
+        {"nb_matrix_threads", std::to_string(conf.nb_matrix_threads)},
+        {"matrix_auto_direction", std::to_string(conf.matrix_auto_direction)},
+        {"matrix_engine", to_string(conf.matrix_engine)},
+        {"cost_matrix", std::to_string(conf.with_cost_matrix)},
+        {"crow_fly_margin", conf.crow_fly_filter ? std::to_string(conf.crow_fly_margin) : std::string("")},
+        {"matrix_cache_size", std::to_string(conf.matrix_cache_size)},
+        {"matrix_tree_cache_size", std::to_string(conf.matrix_tree_cache_size)},
+        {"fallback_table", conf.fallback_table_path ? *conf.fallback_table_path : std::string("")},
+        {"shared_cache_size", conf.shared_cache_path ? std::to_string(conf.shared_cache_size) : std::string("0")},
+        {"edge_index", std::to_string(conf.edge_index)},
         {"reachability", std::to_string(conf.reachability)},
         {"radius", std::to_string(conf.radius)}};
 
@@ -82,6 +102,12 @@ Metrics::Metrics(const boost::optional<const AsgardConf&>& config) {
                               .Register(*registry);
     this->status_family = &status_family.Add({});
 
+    auto& ready_family = prometheus::BuildGauge()
+                             .Name("asgard_ready")
+                             .Help("1 when the caches are warm and requests are accepted")
+                             .Register(*registry);
+    this->ready = &ready_family.Add({});
+
     auto& in_flight_family = prometheus::BuildGauge()
                                  .Name("asgard_request_in_flight")
                                  .Help("Number of requests currently being processed")
@@ -102,11 +128,45 @@ Metrics::Metrics(const boost::optional<const AsgardConf&>& config) {
     for (auto const& mode : list_modes) {
         auto& histo_direct_path = direct_path_family.Add({{"mode", mode}}, create_fixed_duration_buckets());
         this->handle_direct_path_histogram[mode] = &histo_direct_path;
-        auto& histo_matrix = matrix_family.Add({{"mode", mode}}, create_fixed_duration_buckets());
-        this->handle_matrix_histogram[mode] = &histo_matrix;
+        // none when no matrix algorithm ran: the costs came from the caches or the fallback table, or were all out of reach
+        for (const auto& algorithm : {to_string(MatrixAlgorithm::time_distance), to_string(MatrixAlgorithm::bucket),
+                                      to_string(MatrixAlgorithm::cost_matrix), std::string("none")}) {
+            auto& histo_matrix = matrix_family.Add({{"mode", mode}, {"algorithm", algorithm}}, create_fixed_duration_buckets());
+            this->handle_matrix_histogram[{mode, algorithm}] = &histo_matrix;
+        }
+
+        nb_matrix_cache_hits_gauge[mode] = &prometheus::BuildGauge()
+                                                .Name("nb_matrix_cache_hits_" + mode)
+                                                .Help("Nb of matrix costs[" + mode + "] found in the matrix cache from the start of app")
+                                                .Register(*registry)
+                                                .Add({});
+
+        nb_matrix_cache_miss_gauge[mode] = &prometheus::BuildGauge()
+                                                .Name("nb_matrix_cache_miss_" + mode)
+                                                .Help("Nb of matrix costs[" + mode + "] computed because the matrix cache missed them from the start of app")
+                                                .Register(*registry)
+                                                .Add({});
+
+        nb_matrix_tree_hits_gauge[mode] = &prometheus::BuildGauge()
+                                               .Name("nb_matrix_tree_hits_" + mode)
+                                               .Help("Nb of matrix costs[" + mode + "] read from a kept shortest path tree from the start of app")
+                                               .Register(*registry)
+                                               .Add({});
+
+        nb_fallback_table_hits_gauge[mode] = &prometheus::BuildGauge()
+                                                  .Name("nb_fallback_table_hits_" + mode)
+                                                  .Help("Nb of matrices[" + mode + "] served by the fallback table from the start of app")
+                                                  .Register(*registry)
+                                                  .Add({});
     }
 
-    for (auto const& mode : {"walking", "bike", "car"}) {
+    negative_cache_size = &prometheus::BuildGauge()
+                               .Name("negative_cache_size")
+                               .Help("current number of coordinates known to fail the projection")
+                               .Register(*registry)
+                               .Add({});
+
+    for (auto const& mode : {"walking", "bike", "car", "taxi"}) {
         nb_cache_miss_gauge[mode] = &prometheus::BuildGauge()
                                          .Name(std::string("nb_cache_miss_") + mode)
                                          .Help(std::string("Nb of projector's cache[") + mode + std::string("] miss from the start of app"))
@@ -124,6 +184,42 @@ Metrics::Metrics(const boost::optional<const AsgardConf&>& config) {
                                         .Help(std::string("current cache[") + mode + std::string("]size"))
                                         .Register(*registry)
                                         .Add({});
+
+        current_cache_bytes[mode] = &prometheus::BuildGauge()
+                                         .Name(std::string("cache_bytes_") + mode)
+                                         .Help(std::string("current memory used by cache[") + mode + std::string("] in bytes"))
+                                         .Register(*registry)
+                                         .Add({});
+
+        cache_hit_ratio[mode] = &prometheus::BuildGauge()
+                                     .Name(std::string("cache_hit_ratio_") + mode)
+                                     .Help(std::string("Ratio of projector's cache[") + mode + std::string("] calls that hit from the start of app"))
+                                     .Register(*registry)
+                                     .Add({});
+
+        nb_cache_rejected_gauge[mode] = &prometheus::BuildGauge()
+                                             .Name(std::string("nb_cache_rejected_") + mode)
+                                             .Help(std::string("Nb of projections refused by the admission policy of cache[") + mode + std::string("] from the start of app"))
+                                             .Register(*registry)
+                                             .Add({});
+
+        nb_negative_cache_hits_gauge[mode] = &prometheus::BuildGauge()
+                                                  .Name(std::string("nb_negative_cache_hits_") + mode)
+                                                  .Help(std::string("Nb of known projection failures[") + mode + std::string("] answered without loki from the start of app"))
+                                                  .Register(*registry)
+                                                  .Add({});
+
+        nb_edge_index_hits_gauge[mode] = &prometheus::BuildGauge()
+                                              .Name(std::string("nb_edge_index_hits_") + mode)
+                                              .Help(std::string("Nb of projections[") + mode + std::string("] answered by the edge index instead of loki from the start of app"))
+                                              .Register(*registry)
+                                              .Add({});
+
+        nb_shared_cache_hits_gauge[mode] = &prometheus::BuildGauge()
+                                                .Name(std::string("nb_shared_cache_hits_") + mode)
+                                                .Help(std::string("Nb of projections[") + mode + std::string("] found in the cache shared with the other processes from the start of app"))
+                                                .Register(*registry)
+                                                .Add({});
     }
 }
 
@@ -134,6 +230,13 @@ InFlightGuard Metrics::start_in_flight() const {
     return InFlightGuard(this->in_flight);
 }
 
+void Metrics::set_ready() const {
+    if (!registry) {
+        return;
+    }
+    ready->Set(1);
+}
+
 void Metrics::observe_handle_direct_path(const std::string& mode, double duration) const {
     if (!registry) {
         return;
@@ -146,15 +249,15 @@ void Metrics::observe_handle_direct_path(const std::string& mode, double duratio
     }
 }
 
-void Metrics::observe_handle_matrix(const std::string& mode, double duration) const {
+void Metrics::observe_handle_matrix(const std::string& mode, const std::string& algorithm, double duration) const {
     if (!registry) {
         return;
     }
-    auto it = this->handle_matrix_histogram.find(mode);
+    auto it = this->handle_matrix_histogram.find({mode, algorithm});
     if (it != std::end(this->handle_matrix_histogram)) {
         it->second->Observe(duration);
     } else {
-        LOG_WARN("mode " + mode + " not found in metrics");
+        LOG_WARN("mode " + mode + " with algorithm " + algorithm + " not found in metrics");
     }
 }
 
@@ -164,6 +267,9 @@ void Metrics::observe_nb_cache_miss(const std::string& mode, uint64_t nb_cache_m
     }
     nb_cache_miss_gauge.at(mode)->Set(nb_cache_miss);
     nb_cache_call_gauge.at(mode)->Set(nb_cache_calls);
+    if (nb_cache_calls > 0) {
+        cache_hit_ratio.at(mode)->Set(1. - static_cast<double>(nb_cache_miss) / nb_cache_calls);
+    }
 }
 
 void Metrics::observe_cache_size(const std::string& mode, uint64_t cache_size) const {
@@ -173,4 +279,69 @@ void Metrics::observe_cache_size(const std::string& mode, uint64_t cache_size) c
     current_cache_size.at(mode)->Set(cache_size);
 }
 
+void Metrics::observe_cache_bytes(const std::string& mode, uint64_t cache_bytes) const {
+    if (!registry) {
+        return;
+    }
+    current_cache_bytes.at(mode)->Set(cache_bytes);
+}
+
+void Metrics::observe_nb_cache_rejected(const std::string& mode, uint64_t nb_cache_rejected) const {
+    if (!registry) {
+        return;
+    }
+    nb_cache_rejected_gauge.at(mode)->Set(nb_cache_rejected);
+}
+
+void Metrics::observe_negative_cache(const std::string& mode, uint64_t nb_negative_cache_hits, uint64_t cache_size) const {
+    if (!registry) {
+        return;
+    }
+    nb_negative_cache_hits_gauge.at(mode)->Set(nb_negative_cache_hits);
+    negative_cache_size->Set(cache_size);
+}
+
+void Metrics::observe_nb_edge_index_hits(const std::string& mode, uint64_t nb_edge_index_hits) const {
+    if (!registry) {
+        return;
+    }
+    nb_edge_index_hits_gauge.at(mode)->Set(nb_edge_index_hits);
+}
+
+void Metrics::observe_nb_fallback_table_hits(const std::string& mode, uint64_t nb_fallback_table_hits) const {
+    if (!registry) {
+        return;
+    }
+    auto it = nb_fallback_table_hits_gauge.find(mode);
+    if (it != std::end(nb_fallback_table_hits_gauge)) {
+        it->second->Set(nb_fallback_table_hits);
+    } else {
+        LOG_WARN("mode " + mode + " not found in metrics");
+    }
+}
+
+void Metrics::observe_matrix_cache(const std::string& mode, uint64_t nb_hits, uint64_t nb_miss, uint64_t nb_tree_hits) const {
+    if (!registry) {
+        return;
+    }
+    auto hits = nb_matrix_cache_hits_gauge.find(mode);
+    auto miss = nb_matrix_cache_miss_gauge.find(mode);
+    auto tree_hits = nb_matrix_tree_hits_gauge.find(mode);
+    if (hits != std::end(nb_matrix_cache_hits_gauge) && miss != std::end(nb_matrix_cache_miss_gauge) &&
+        tree_hits != std::end(nb_matrix_tree_hits_gauge)) {
+        hits->second->Set(nb_hits);
+        miss->second->Set(nb_miss);
+        tree_hits->second->Set(nb_tree_hits);
+    } else {
+        LOG_WARN("mode " + mode + " not found in metrics");
+    }
+}
+
+void Metrics::observe_nb_shared_cache_hits(const std::string& mode, uint64_t nb_shared_cache_hits) const {
+    if (!registry) {
+        return;
+    }
+    nb_shared_cache_hits_gauge.at(mode)->Set(nb_shared_cache_hits);
+}
+
 } // namespace asgard
@@ -7,6 +7,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <utility>
 
 namespace prometheus {
 class Registry;
@@ -36,20 +37,40 @@ protected:
     std::shared_ptr<prometheus::Registry> registry;
     prometheus::Gauge* in_flight;
     prometheus::Gauge* status_family;
+    prometheus::Gauge* ready;
     std::map<const std::string, prometheus::Histogram*> handle_direct_path_histogram;
-    std::map<const std::string, prometheus::Histogram*> handle_matrix_histogram;
+    std::map<std::pair<std::string, std::string>, prometheus::Histogram*> handle_matrix_histogram;
     std::unordered_map<std::string, prometheus::Gauge*> nb_cache_miss_gauge;
     std::unordered_map<std::string, prometheus::Gauge*> nb_cache_call_gauge;
     std::unordered_map<std::string, prometheus::Gauge*> current_cache_size;
+    std::unordered_map<std::string, prometheus::Gauge*> current_cache_bytes;
+    std::unordered_map<std::string, prometheus::Gauge*> cache_hit_ratio;
+    std::unordered_map<std::string, prometheus::Gauge*> nb_cache_rejected_gauge;
+    std::unordered_map<std::string, prometheus::Gauge*> nb_negative_cache_hits_gauge;
+    prometheus::Gauge* negative_cache_size;
+    std::unordered_map<std::string, prometheus::Gauge*> nb_edge_index_hits_gauge;
+    std::unordered_map<std::string, prometheus::Gauge*> nb_shared_cache_hits_gauge;
+    std::unordered_map<std::string, prometheus::Gauge*> nb_matrix_cache_hits_gauge;
+    std::unordered_map<std::string, prometheus::Gauge*> nb_matrix_cache_miss_gauge;
+    std::unordered_map<std::string, prometheus::Gauge*> nb_matrix_tree_hits_gauge;
+    std::unordered_map<std::string, prometheus::Gauge*> nb_fallback_table_hits_gauge;
 
 public:
     explicit Metrics(const boost::optional<const AsgardConf&>& config);
     InFlightGuard start_in_flight() const;
+    void set_ready() const;
 
     void observe_handle_direct_path(const std::string&, double duration) const;
-    void observe_handle_matrix(const std::string&, double duration) const;
+    void observe_handle_matrix(const std::string& mode, const std::string& algorithm, double duration) const;
     void observe_nb_cache_miss(const std::string& mode, uint64_t nb_cache_miss, uint64_t nb_cache_calls) const;
     void observe_cache_size(const std::string& mode, uint64_t cache_size) const;
+    void observe_cache_bytes(const std::string& mode, uint64_t cache_bytes) const;
+    void observe_nb_cache_rejected(const std::string& mode, uint64_t nb_cache_rejected) const;
+    void observe_negative_cache(const std::string& mode, uint64_t nb_negative_cache_hits, uint64_t cache_size) const;
+    void observe_nb_edge_index_hits(const std::string& mode, uint64_t nb_edge_index_hits) const;
+    void observe_nb_shared_cache_hits(const std::string& mode, uint64_t nb_shared_cache_hits) const;
+    void observe_nb_fallback_table_hits(const std::string& mode, uint64_t nb_fallback_table_hits) const;
+    void observe_matrix_cache(const std::string& mode, uint64_t nb_hits, uint64_t nb_miss, uint64_t nb_tree_hits) const;
 };
 
 } // namespace asgard
@@ -5,6 +5,8 @@
 #include <valhalla/proto/options.pb.h>
 #include <valhalla/sif/costconstants.h>
 
+#include <boost/functional/hash.hpp>
+
 using namespace valhalla;
 using vc = valhalla::Costing;
 
@@ -69,6 +71,20 @@ Options make_costing_option(const ModeCostingArgs& args) {
 }
 } // namespace
 
+size_t hash_value(const ModeCostingArgs& args) {
+    size_t seed = std::hash<std::string>()(args.mode);
+    boost::hash_range(seed, args.speeds.begin(), args.speeds.end());
+    for (const auto value : {args.bss_rent_duration, args.bss_rent_penalty, args.bss_return_duration, args.bss_return_penalty,
+                             args.bike_use_roads, args.bike_use_hills, args.bike_use_ferry, args.bike_avoid_bad_surfaces,
+                             args.bike_use_living_streets, args.bike_maneuver_penalty, args.bike_service_penalty,
+                             args.bike_service_factor, args.bike_country_crossing_cost, args.bike_country_crossing_penalty}) {
+        boost::hash_combine(seed, value);
+    }
+    boost::hash_combine(seed, args.bike_shortest);
+    boost::hash_combine(seed, static_cast<int>(args.bicycle_type));
+    return seed;
+}
+
 ModeCosting::ModeCosting() {
     Options options;
     rapidjson::Document doc;
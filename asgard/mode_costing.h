@@ -56,6 +56,9 @@ struct ModeCostingArgs {
     }
 };
 
+// Identify the costing parameters, to cache what has been computed with them
+size_t hash_value(const ModeCostingArgs& args);
+
 class ModeCosting {
 public:
     ModeCosting();
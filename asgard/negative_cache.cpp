@@ -0,0 +1,67 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#include "asgard/negative_cache.h"
+
+#include <boost/functional/hash.hpp>
+
+namespace asgard {
+
+size_t NegativeCacheKeyHash::operator()(const NegativeCacheKey& key) const {
+    size_t seed = ProjectorKeyHash()(key.first);
+    boost::hash_combine(seed, key.second);
+    return seed;
+}
+
+bool NegativeCache::contains(const key_type& key, clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto& map = cache.get<1>();
+    const auto search = map.find(key);
+    if (search == map.end()) {
+        return false;
+    }
+    if (search->expiration <= now) {
+        remove_expired(now);
+        return false;
+    }
+    return true;
+}
+
+void NegativeCache::insert(const key_type& key, clock::time_point now) {
+    if (max_size == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    remove_expired(now);
+    auto& list = cache.get<0>();
+    auto& map = cache.get<1>();
+    // a key inserted again starts a new ttl
+    map.erase(key);
+    list.push_front(Entry{key, now + ttl});
+    while (list.size() > max_size) { list.pop_back(); }
+}
+
+void NegativeCache::remove_expired(clock::time_point now) {
+    auto& list = cache.get<0>();
+    while (!list.empty() && list.back().expiration <= now) { list.pop_back(); }
+}
+
+size_t NegativeCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return cache.size();
+}
+
+} // namespace asgard
@@ -0,0 +1,75 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "asgard/projector_cache.h"
+
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index_container.hpp>
+
+#include <chrono>
+#include <mutex>
+
+namespace asgard {
+
+// A failure depends on the costing options (e.g. the restrictions of a
+// profile), so the hash of the costing arguments is part of the key
+using NegativeCacheKey = std::pair<ProjectorKey, size_t>;
+
+struct NegativeCacheKeyHash {
+    size_t operator()(const NegativeCacheKey& key) const;
+};
+
+/**
+ * Remember the coordinates that could not be projected (in the water, out
+ * of the tileset, not reachable enough...), so that they are not searched
+ * again by loki on every request.
+ *
+ * The entries expire after a fixed ttl, so they are kept in insertion order
+ * and the oldest entry is both the first to expire and the first evicted.
+ */
+class NegativeCache {
+public:
+    using key_type = NegativeCacheKey;
+    using clock = std::chrono::steady_clock;
+
+    NegativeCache(size_t max_size, std::chrono::seconds ttl) : max_size(max_size), ttl(ttl) {}
+
+    // Return true if key is a known failure
+    bool contains(const key_type& key, clock::time_point now = clock::now());
+    void insert(const key_type& key, clock::time_point now = clock::now());
+
+    size_t size() const;
+
+private:
+    struct Entry {
+        key_type key;
+        clock::time_point expiration;
+    };
+    using Cache = boost::multi_index_container<Entry, boost::multi_index::indexed_by<boost::multi_index::sequenced<>, boost::multi_index::hashed_unique<boost::multi_index::member<Entry, key_type, &Entry::key>, NegativeCacheKeyHash>>>;
+
+    void remove_expired(clock::time_point now);
+
+    const size_t max_size;
+    const std::chrono::seconds ttl;
+    Cache cache;
+    mutable std::mutex mutex;
+};
+
+} // namespace asgard
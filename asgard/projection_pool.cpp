@@ -0,0 +1,105 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#include "asgard/projection_pool.h"
+
+#include <valhalla/loki/search.h>
+#include <valhalla/midgard/logging.h>
+
+#include <algorithm>
+#include <future>
+#include <memory>
+
+namespace asgard {
+
+ProjectionPool::ProjectionPool(const boost::property_tree::ptree& graph_conf, size_t nb_threads, size_t min_batch_size) : min_batch_size(std::max<size_t>(1, min_batch_size)) {
+    for (size_t i = 0; i < nb_threads; ++i) {
+        threads.emplace_back(&ProjectionPool::run, this, graph_conf);
+    }
+    LOG_INFO("Projection pool started with " + std::to_string(nb_threads) + " threads");
+}
+
+ProjectionPool::~ProjectionPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    tasks_available.notify_all();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+void ProjectionPool::run(const boost::property_tree::ptree& graph_conf) {
+    valhalla::baldr::GraphReader graph(graph_conf);
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            tasks_available.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task(graph);
+        if (graph.OverCommitted()) { graph.Clear(); }
+    }
+}
+
+ProjectionPool::Results ProjectionPool::search(const std::vector<valhalla::baldr::Location>& locations,
+                                               valhalla::baldr::GraphReader& graph,
+                                               const valhalla::sif::cost_ptr_t& costing) const {
+    const size_t nb_batches = std::min(threads.size() + 1, locations.size() / min_batch_size);
+    if (nb_batches < 2) {
+        return valhalla::loki::Search(locations, graph, costing);
+    }
+
+    const size_t batch_size = (locations.size() + nb_batches - 1) / nb_batches;
+    auto batch = [&](size_t i) {
+        const auto begin = locations.begin() + std::min(locations.size(), i * batch_size);
+        const auto end = locations.begin() + std::min(locations.size(), (i + 1) * batch_size);
+        return std::vector<valhalla::baldr::Location>(begin, end);
+    };
+
+    std::vector<std::future<Results>> futures;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 1; i < nb_batches; ++i) {
+            auto promise = std::make_shared<std::promise<Results>>();
+            futures.push_back(promise->get_future());
+            tasks.emplace_back([promise, costing, batch_locations = batch(i)](valhalla::baldr::GraphReader& graph) {
+                try {
+                    promise->set_value(valhalla::loki::Search(batch_locations, graph, costing));
+                } catch (...) {
+                    promise->set_exception(std::current_exception());
+                }
+            });
+        }
+    }
+    tasks_available.notify_all();
+
+    // the calling thread does its share of the work instead of waiting
+    auto results = valhalla::loki::Search(batch(0), graph, costing);
+    for (auto& f : futures) {
+        auto batch_results = f.get();
+        results.insert(std::make_move_iterator(batch_results.begin()), std::make_move_iterator(batch_results.end()));
+    }
+    return results;
+}
+
+} // namespace asgard
@@ -0,0 +1,74 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/baldr/location.h>
+#include <valhalla/baldr/pathlocation.h>
+#include <valhalla/sif/dynamiccost.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace asgard {
+
+/**
+ * Threads shared by all the workers to project large sets of locations.
+ *
+ * A large search is split in batches: the calling thread projects the first
+ * one with its own graph, while the pool's threads, each with its own
+ * GraphReader, project the others.
+ */
+class ProjectionPool {
+public:
+    using Results = std::unordered_map<valhalla::baldr::Location, valhalla::baldr::PathLocation>;
+
+    // Searches on less than 2 * min_batch_size locations are not split
+    ProjectionPool(const boost::property_tree::ptree& graph_conf, size_t nb_threads, size_t min_batch_size);
+    ~ProjectionPool();
+
+    ProjectionPool(const ProjectionPool&) = delete;
+    ProjectionPool& operator=(const ProjectionPool&) = delete;
+
+    // Same as valhalla::loki::Search
+    Results search(const std::vector<valhalla::baldr::Location>& locations,
+                   valhalla::baldr::GraphReader& graph,
+                   const valhalla::sif::cost_ptr_t& costing) const;
+
+    size_t get_nb_threads() const { return threads.size(); }
+
+private:
+    using Task = std::function<void(valhalla::baldr::GraphReader&)>;
+
+    void run(const boost::property_tree::ptree& graph_conf);
+
+    const size_t min_batch_size;
+    std::vector<std::thread> threads;
+    mutable std::deque<Task> tasks;
+    mutable std::mutex mutex;
+    mutable std::condition_variable tasks_available;
+    bool stopping = false;
+};
+
+} // namespace asgard
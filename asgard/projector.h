@@ -1,14 +1,22 @@
 #pragma once
 
 #include "utils/coord_parser.h"
+#include "asgard/edge_index.h"
+#include "asgard/negative_cache.h"
+#include "asgard/projection_pool.h"
+#include "asgard/projector_cache.h"
+#include "asgard/projector_snapshot.h"
+#include "asgard/shared_projector_cache.h"
 
 #include <valhalla/loki/search.h>
+#include <valhalla/midgard/logging.h>
 #include <valhalla/midgard/pointll.h>
+#include <valhalla/proto/tripcommon.pb.h>
 
-#include <boost/multi_index/hashed_index.hpp>
-#include <boost/multi_index/member.hpp>
+#include <boost/filesystem.hpp>
 
-#include <mutex>
+#include <array>
+#include <atomic>
 
 namespace asgard {
 
@@ -16,28 +24,34 @@ class Projector {
 private:
     friend class UnitTestProjector;
 
-    typedef std::pair<valhalla::midgard::PointLL, std::string> key_type;
-    using mapped_type = valhalla::baldr::PathLocation;
-    using value_type = std::pair<const key_type, mapped_type>;
-    using Cache = boost::multi_index_container<value_type, boost::multi_index::indexed_by<boost::multi_index::sequenced<>, boost::multi_index::hashed_unique<boost::multi_index::member<value_type, const key_type, &value_type::first>>>>;
-
-    // maximal cached values
-    std::unordered_map<std::string, size_t> cache_size_;
-
     unsigned int min_outbound_reach;
     unsigned int min_inbound_reach;
 
     unsigned int radius;
 
-    // the cache, mutable because side effect are not visible from the
+    CachePolicy cache_policy;
+    double key_precision;
+    double key_tolerance;
+
+    // the caches, mutable because side effect are not visible from the
     // exterior because of the purity of f
-    mutable std::unordered_map<std::string, Cache> cache_{
-        {"walking", Cache()}, {"bike", Cache()}, {"car", Cache()}};
-    mutable std::unordered_map<std::string, size_t> nb_cache_miss_{
-        {"walking", 0}, {"bike", 0}, {"car", 0}};
-    mutable std::unordered_map<std::string, size_t> nb_cache_calls_{
-        {"walking", 0}, {"bike", 0}, {"car", 0}};
-    mutable std::mutex mutex;
+    mutable std::array<ProjectorCache, nb_projector_modes> cache_;
+    mutable std::array<std::atomic<size_t>, nb_projector_modes> nb_cache_miss_{};
+    mutable std::array<std::atomic<size_t>, nb_projector_modes> nb_cache_calls_{};
+    // the coordinates loki failed to project
+    mutable NegativeCache negative_cache_;
+    mutable std::array<std::atomic<size_t>, nb_projector_modes> nb_negative_cache_hits_{};
+    // the projections answered by the edge index, without loki
+    mutable std::array<std::atomic<size_t>, nb_projector_modes> nb_edge_index_hits_{};
+    // the projections found in the cache shared with the other processes
+    mutable std::array<std::atomic<size_t>, nb_projector_modes> nb_shared_cache_hits_{};
+
+    // to split the large searches, optional
+    std::shared_ptr<const ProjectionPool> projection_pool_;
+    // to avoid loki on the simple cases, optional
+    std::shared_ptr<const EdgeIndex> edge_index_;
+    // behind the caches of the process, optional
+    std::shared_ptr<SharedProjectorCache> shared_cache_;
 
     valhalla::baldr::Location build_location(const valhalla::midgard::PointLL& place,
                                              unsigned int min_outbound_reach,
@@ -55,14 +69,18 @@ public:
     explicit Projector(size_t cache_size_walking = 1000,
                        size_t cache_size_bike = 1000,
                        size_t cache_size_car = 1000,
+                       size_t cache_size_taxi = 1000,
                        unsigned int min_outbound_reach = 0,
                        unsigned int min_inbound_reach = 0,
-                       unsigned int radius = 0) : cache_size_({{"walking", cache_size_walking},
-                                                               {"bike", cache_size_walking},
-                                                               {"car", cache_size_walking}}),
-                                                  min_outbound_reach(min_outbound_reach),
-                                                  min_inbound_reach(min_inbound_reach),
-                                                  radius(radius) {}
+                       unsigned int radius = 0,
+                       const ProjectorCacheConf& cache_conf = ProjectorCacheConf()) : min_outbound_reach(min_outbound_reach),
+                                                                                      min_inbound_reach(min_inbound_reach),
+                                                                                      radius(radius),
+                                                                                      cache_policy(cache_conf.policy),
+                                                                                      key_precision(cache_conf.key_precision),
+                                                                                      key_tolerance(cache_conf.key_tolerance),
+                                                                                      cache_(make_caches({{cache_size_walking, cache_size_bike, cache_size_car, cache_size_taxi}}, cache_conf)),
+                                                                                      negative_cache_(cache_conf.negative_cache_size, std::chrono::seconds(cache_conf.negative_cache_ttl)) {}
 
     template<typename T>
     std::unordered_map<valhalla::midgard::PointLL, valhalla::baldr::PathLocation>
@@ -71,102 +89,370 @@ public:
                valhalla::baldr::GraphReader& graph,
                const std::string& mode,
                const valhalla::sif::cost_ptr_t& costing,
-               const bool use_cache = true) const {
+               const bool use_cache = true,
+               const size_t costing_hash = 0) const {
+        std::unordered_map<valhalla::midgard::PointLL, valhalla::baldr::PathLocation> results;
+        if (use_cache) {
+            project_with_cache(
+                places_begin, places_end, graph, mode, costing, costing_hash,
+                [&](size_t, const valhalla::midgard::PointLL& place, const CompactProjection& cached) {
+                    results.emplace(place, cached.to_path_location(build_location(place, min_outbound_reach, min_inbound_reach, radius)));
+                },
+                [&](size_t, const valhalla::midgard::PointLL& place, const valhalla::baldr::PathLocation& projected, valhalla::Location&&) {
+                    results.emplace(place, projected);
+                });
+        } else {
+            project_without_cache(places_begin, places_end, graph, mode, costing,
+                                  [&](size_t, const valhalla::midgard::PointLL& place, const valhalla::baldr::PathLocation& projected) {
+                                      results.emplace(place, projected);
+                                  });
+        }
+        return results;
+    }
+
+    // Project the places, ready to be used by valhalla. The projections are
+    // written in locations in the order of the places, the ones that failed
+    // being skipped: projected[i] tells if the i-th place was projected.
+    // A cache hit costs neither a loki search nor the graph lookups of
+    // PathLocation::toPBF. The buffers are meant to be reused from one call
+    // to the other, the messages cleared in locations are filled again.
+    // costing_hash identifies the costing options in the negative cache.
+    template<typename T>
+    void project_to_valhalla_locations(const T places_begin,
+                                       const T places_end,
+                                       valhalla::baldr::GraphReader& graph,
+                                       const std::string& mode,
+                                       const valhalla::sif::cost_ptr_t& costing,
+                                       const bool use_cache,
+                                       google::protobuf::RepeatedPtrField<valhalla::Location>& locations,
+                                       std::vector<bool>& projected,
+                                       const size_t costing_hash = 0) const {
+        const auto nb_places = static_cast<size_t>(std::distance(places_begin, places_end));
+        locations.Clear();
+        projected.assign(nb_places, false);
+        // one slot by place, the cleared messages are reused
+        for (size_t i = 0; i < nb_places; ++i) {
+            locations.Add();
+        }
         if (use_cache) {
-            return project_with_cache(places_begin, places_end, graph, mode, costing);
+            project_with_cache(
+                places_begin, places_end, graph, mode, costing, costing_hash,
+                [&](size_t position, const valhalla::midgard::PointLL& place, const CompactProjection& cached) {
+                    auto& location = *locations.Mutable(position);
+                    location.Clear();
+                    cached.to_valhalla_location(build_location(place, min_outbound_reach, min_inbound_reach, radius), graph, location);
+                    if (key_precision > 0) {
+                        // the projection may have been computed for a close place
+                        location.mutable_ll()->set_lng(place.lng());
+                        location.mutable_ll()->set_lat(place.lat());
+                    }
+                    projected[position] = true;
+                },
+                [&](size_t position, const valhalla::midgard::PointLL&, const valhalla::baldr::PathLocation&, valhalla::Location&& location) {
+                    locations.Mutable(position)->Swap(&location);
+                    projected[position] = true;
+                });
+        } else {
+            project_without_cache(places_begin, places_end, graph, mode, costing,
+                                  [&](size_t position, const valhalla::midgard::PointLL&, const valhalla::baldr::PathLocation& path_location) {
+                                      auto& location = *locations.Mutable(position);
+                                      location.Clear();
+                                      valhalla::baldr::PathLocation::toPBF(path_location, &location, graph);
+                                      projected[position] = true;
+                                  });
         }
-        return project_without_cache(places_begin, places_end, graph, mode, costing);
+        // pack the projected locations at the beginning, in the same order
+        int nb_projected = 0;
+        for (size_t i = 0; i < nb_places; ++i) {
+            if (projected[i]) {
+                if (static_cast<int>(i) != nb_projected) {
+                    locations.SwapElements(i, nb_projected);
+                }
+                ++nb_projected;
+            }
+        }
+        while (locations.size() > nb_projected) {
+            locations.RemoveLast();
+        }
+    }
+
+    void set_projection_pool(std::shared_ptr<const ProjectionPool> pool) {
+        projection_pool_ = std::move(pool);
     }
 
+    void set_edge_index(std::shared_ptr<const EdgeIndex> index) {
+        edge_index_ = std::move(index);
+    }
+
+    void set_shared_cache(std::shared_ptr<SharedProjectorCache> cache) {
+        shared_cache_ = std::move(cache);
+    }
+
+    // bss shares the cache and the counters of walking, the unknown modes have none
     size_t get_nb_cache_miss(const std::string& mode) const {
-        auto it = nb_cache_miss_.find(mode);
-        return it != nb_cache_miss_.end() ? it->second : 0;
+        const auto m = parse_projector_mode(mode);
+        return m ? nb_cache_miss_[index(*m)].load() : 0;
     }
     size_t get_nb_cache_calls(const std::string& mode) const {
-        auto it = nb_cache_calls_.find(mode);
-        return it != nb_cache_calls_.end() ? it->second : 0;
+        const auto m = parse_projector_mode(mode);
+        return m ? nb_cache_calls_[index(*m)].load() : 0;
+    }
+    size_t get_nb_negative_cache_hits(const std::string& mode) const {
+        const auto m = parse_projector_mode(mode);
+        return m ? nb_negative_cache_hits_[index(*m)].load() : 0;
+    }
+    size_t get_nb_edge_index_hits(const std::string& mode) const {
+        const auto m = parse_projector_mode(mode);
+        return m ? nb_edge_index_hits_[index(*m)].load() : 0;
+    }
+    size_t get_nb_shared_cache_hits(const std::string& mode) const {
+        const auto m = parse_projector_mode(mode);
+        return m ? nb_shared_cache_hits_[index(*m)].load() : 0;
+    }
+    size_t get_negative_cache_size() const {
+        return negative_cache_.size();
     }
     size_t get_current_cache_size(const std::string& mode) const {
-        auto it = cache_.find(mode);
-        return it != cache_.end() ? it->second.get<0>().size() : 0;
+        const auto m = parse_projector_mode(mode);
+        return m ? cache_[index(*m)].size() : 0;
+    }
+    size_t get_current_cache_bytes(const std::string& mode) const {
+        const auto m = parse_projector_mode(mode);
+        return m ? cache_[index(*m)].get_nb_bytes() : 0;
+    }
+    size_t get_nb_cache_rejected(const std::string& mode) const {
+        const auto m = parse_projector_mode(mode);
+        return m ? cache_[index(*m)].get_nb_rejected() : 0;
+    }
+
+    // With an admission policy, one-shot coordinates cannot evict the
+    // frequently used ones, so every request can go through the cache
+    bool has_admission_policy() const { return cache_policy == CachePolicy::tinylfu; }
+
+    // The tileset and the projection parameters the cached projections depend on
+    SnapshotHeader make_snapshot_header(valhalla::baldr::GraphReader& graph) const {
+        SnapshotHeader header;
+        header.tileset_fingerprint = get_tileset_fingerprint(graph);
+        header.min_outbound_reach = min_outbound_reach;
+        header.min_inbound_reach = min_inbound_reach;
+        header.radius = radius;
+        header.key_precision = key_precision;
+        return header;
+    }
+
+    // Write the content of the caches in a snapshot file, return the number of entries written
+    size_t save(const std::string& path, valhalla::baldr::GraphReader& graph) const {
+        SnapshotWriter writer(path, make_snapshot_header(graph));
+        for (const auto& c : cache_) {
+            c.for_each([&writer](const ProjectorKey& key, const CompactProjection& projection) {
+                writer.write(key, projection);
+            });
+        }
+        writer.commit();
+        return writer.get_nb_entries();
+    }
+
+    // Fill the caches from a snapshot file, return the number of entries loaded.
+    // The snapshot is ignored if it has been built from another tileset or with
+    // other projection parameters.
+    size_t load(const std::string& path, valhalla::baldr::GraphReader& graph) const {
+        if (!boost::filesystem::exists(path)) {
+            LOG_INFO("No projector snapshot found at " + path);
+            return 0;
+        }
+        SnapshotReader reader(path);
+        if (!(reader.get_header() == make_snapshot_header(graph))) {
+            LOG_WARN("Projector snapshot " + path + " does not match the tileset or the projection parameters, ignoring it");
+            return 0;
+        }
+        size_t nb_loaded = 0;
+        size_t nb_invalid = 0;
+        while (auto entry = reader.next()) {
+            const auto mode = parse_projector_mode(entry->key.second);
+            if (!mode) {
+                continue;
+            }
+            if (!is_projection_valid(*entry, graph)) {
+                ++nb_invalid;
+                continue;
+            }
+            // the place actually projected, the key tolerance is measured from it
+            valhalla::baldr::PathLocation location(build_location(entry->origin, min_outbound_reach, min_inbound_reach, radius));
+            location.edges = std::move(entry->edges);
+            location.filtered_edges = std::move(entry->filtered_edges);
+            valhalla::Location pbf;
+            valhalla::baldr::PathLocation::toPBF(location, &pbf, graph);
+            cache_[index(*mode)].insert(make_key(entry->origin, entry->key.second), CompactProjection(location, pbf));
+            ++nb_loaded;
+        }
+        LOG_INFO(std::to_string(nb_loaded) + " projections loaded from " + path + ", " +
+                 std::to_string(nb_invalid) + " invalid projections ignored");
+        return nb_loaded;
     }
 
 private:
-    template<typename T>
-    std::unordered_map<valhalla::midgard::PointLL, valhalla::baldr::PathLocation>
-    project_with_cache(const T places_begin,
-                       const T places_end,
-                       valhalla::baldr::GraphReader& graph,
-                       const std::string& mode,
-                       const valhalla::sif::cost_ptr_t& costing) const {
-        std::unordered_map<valhalla::midgard::PointLL, valhalla::baldr::PathLocation> results;
+    static size_t index(ProjectorMode mode) { return static_cast<size_t>(mode); }
+
+    ProjectorKey make_key(const valhalla::midgard::PointLL& place, const std::string& mode) const {
+        return std::make_pair(quantize(place, key_precision), mode);
+    }
+
+    // A projection shared through a quantized key is only used for the places close enough to the projected one
+    bool is_reusable(const CompactProjection& cached, const valhalla::midgard::PointLL& place) const {
+        return key_tolerance <= 0 || cached.get_origin().Distance(place) <= key_tolerance;
+    }
+
+    static std::array<ProjectorCache, nb_projector_modes> make_caches(const std::array<size_t, nb_projector_modes>& cache_sizes,
+                                                                       const ProjectorCacheConf& cache_conf) {
+        // one budget shared by all the modes
+        std::shared_ptr<CacheByteBudget> budget;
+        if (cache_conf.max_bytes > 0) {
+            budget = std::make_shared<CacheByteBudget>(cache_conf.max_bytes);
+        }
+        auto make_cache = [&](ProjectorMode mode) {
+            return ProjectorCache(cache_sizes[index(mode)], cache_conf.nb_shards, cache_conf.policy, budget);
+        };
+        return {{make_cache(ProjectorMode::walking),
+                 make_cache(ProjectorMode::bike),
+                 make_cache(ProjectorMode::car),
+                 make_cache(ProjectorMode::taxi)}};
+    }
+
+    // Call on_hit(position, place, cached projection) for the places found in the cache and
+    // on_miss(position, place, projection, serialized projection) for the ones projected by loki.
+    // on_hit is called while the cache is locked, it must not use the cache.
+    template<typename T, typename OnHit, typename OnMiss>
+    void project_with_cache(const T places_begin,
+                            const T places_end,
+                            valhalla::baldr::GraphReader& graph,
+                            const std::string& mode,
+                            const valhalla::sif::cost_ptr_t& costing,
+                            const size_t costing_hash,
+                            OnHit on_hit,
+                            OnMiss on_miss) const {
         std::vector<valhalla::baldr::Location> missed;
-        auto it_cache = cache_.find(mode);
-        auto& cache = (it_cache != cache_.end()) ? it_cache->second : cache_["walking"];
-        auto it_cache_size = cache_size_.find(mode);
-        const auto cache_size = (it_cache_size != cache_size_.end()) ? it_cache_size->second : cache_size_.at("walking");
-
-        auto& list = cache.template get<0>();
-        const auto& map = cache.template get<1>();
-        auto projector_mode = mode;
-        if (projector_mode == "bss") {
-            projector_mode = "walking";
-        }
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            for (auto it = places_begin; it != places_end; ++it) {
-                ++nb_cache_calls_[mode];
-                const auto search = map.find(std::make_pair(*it, projector_mode));
-                if (search != map.end()) {
-                    // put the cached value at the begining of the cache
-                    list.relocate(list.begin(), cache.template project<0>(search));
-                    results.emplace(*it, search->second);
-                } else {
-                    ++nb_cache_miss_[mode];
-                    missed.push_back(build_location(*it, min_outbound_reach, min_inbound_reach, radius));
+        std::vector<size_t> missed_positions;
+        const auto parsed_mode = parse_projector_mode(mode);
+        // the unknown modes share the walking cache, under their own name
+        const auto cache_mode = index(parsed_mode.value_or(ProjectorMode::walking));
+        auto& cache = cache_[cache_mode];
+        const auto& projector_mode = parsed_mode ? to_string(*parsed_mode) : mode;
+        size_t position = 0;
+        for (auto it = places_begin; it != places_end; ++it, ++position) {
+            nb_cache_calls_[cache_mode].fetch_add(1, std::memory_order_relaxed);
+            const auto key = make_key(*it, projector_mode);
+            bool reusable = true;
+            const auto hit = cache.visit(key, [&](const CompactProjection& cached) {
+                reusable = is_reusable(cached, *it);
+                if (reusable) {
+                    on_hit(position, *it, cached);
                 }
+            });
+            if (hit && reusable) {
+                continue;
             }
+            if (shared_cache_) {
+                // projected by another process
+                CompactProjection shared;
+                if (shared_cache_->find(key, shared) && is_reusable(shared, *it)) {
+                    nb_shared_cache_hits_[cache_mode].fetch_add(1, std::memory_order_relaxed);
+                    on_hit(position, *it, shared);
+                    cache.insert(key, shared);
+                    continue;
+                }
+            }
+            // the failures are remembered for the exact place and costing only
+            if (negative_cache_.contains(std::make_pair(std::make_pair(*it, projector_mode), costing_hash))) {
+                // a known failure, loki would fail again
+                nb_negative_cache_hits_[cache_mode].fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            nb_cache_miss_[cache_mode].fetch_add(1, std::memory_order_relaxed);
+            missed.push_back(build_location(*it, min_outbound_reach, min_inbound_reach, radius));
+            missed_positions.push_back(position);
         }
-        if (!missed.empty()) {
-            const auto path_locations = valhalla::loki::Search(missed,
-                                                               graph,
-                                                               costing);
+        if (missed.empty()) {
+            return;
+        }
+        const auto path_locations = search(missed, graph, parsed_mode, costing);
+        for (size_t i = 0; i < missed.size(); ++i) {
+            const auto& l = missed[i];
+            const auto projection = path_locations.find(l);
+            if (projection == path_locations.end()) {
+                negative_cache_.insert(std::make_pair(std::make_pair(l.latlng_, projector_mode), costing_hash));
+                continue;
+            }
+            // the edges are still in the graph's cache, reading their names is cheap now
+            valhalla::Location location;
+            valhalla::baldr::PathLocation::toPBF(projection->second, &location, graph);
+            const auto key = make_key(l.latlng_, projector_mode);
+            const CompactProjection compact(projection->second, location);
+            cache.insert(key, compact);
+            if (shared_cache_) {
+                shared_cache_->insert(key, compact);
+            }
+            on_miss(missed_positions[i], l.latlng_, projection->second, std::move(location));
+        }
+    }
 
-            std::lock_guard<std::mutex> lock(mutex);
-            for (const auto& l : path_locations) {
-                list.push_front(std::make_pair(std::make_pair(l.first.latlng_, projector_mode), l.second));
-                results.emplace(l.first.latlng_, l.second);
+    // The edge index answers the simple cases, loki the others
+    std::unordered_map<valhalla::baldr::Location, valhalla::baldr::PathLocation>
+    search(const std::vector<valhalla::baldr::Location>& locations,
+           valhalla::baldr::GraphReader& graph,
+           const boost::optional<ProjectorMode>& mode,
+           const valhalla::sif::cost_ptr_t& costing) const {
+        if (!edge_index_ || !mode) {
+            return search_with_loki(locations, graph, costing);
+        }
+        std::unordered_map<valhalla::baldr::Location, valhalla::baldr::PathLocation> results;
+        std::vector<valhalla::baldr::Location> remaining;
+        for (const auto& l : locations) {
+            auto projection = edge_index_->find(l, *mode, graph, costing);
+            if (projection) {
+                nb_edge_index_hits_[index(*mode)].fetch_add(1, std::memory_order_relaxed);
+                results.emplace(l, std::move(*projection));
+            } else {
+                remaining.push_back(l);
             }
-            while (list.size() > cache_size) { list.pop_back(); }
+        }
+        if (!remaining.empty()) {
+            auto projections = search_with_loki(remaining, graph, costing);
+            results.insert(std::make_move_iterator(projections.begin()), std::make_move_iterator(projections.end()));
         }
         return results;
     }
 
-    template<typename T>
-    std::unordered_map<valhalla::midgard::PointLL, valhalla::baldr::PathLocation>
-    project_without_cache(const T places_begin,
-                          const T places_end,
-                          valhalla::baldr::GraphReader& graph,
-                          const std::string& mode,
-                          const valhalla::sif::cost_ptr_t& costing) const {
-        auto projector_mode = mode;
-        if (projector_mode == "bss") {
-            projector_mode = "walking";
+    std::unordered_map<valhalla::baldr::Location, valhalla::baldr::PathLocation>
+    search_with_loki(const std::vector<valhalla::baldr::Location>& locations,
+                     valhalla::baldr::GraphReader& graph,
+                     const valhalla::sif::cost_ptr_t& costing) const {
+        if (projection_pool_) {
+            return projection_pool_->search(locations, graph, costing);
         }
+        return valhalla::loki::Search(locations, graph, costing);
+    }
+
+    // Call on_result(position, place, projection) for the places projected by loki
+    template<typename T, typename OnResult>
+    void project_without_cache(const T places_begin,
+                               const T places_end,
+                               valhalla::baldr::GraphReader& graph,
+                               const std::string& mode,
+                               const valhalla::sif::cost_ptr_t& costing,
+                               OnResult on_result) const {
         std::vector<valhalla::baldr::Location> locations;
         std::transform(places_begin, places_end, std::back_inserter(locations),
                        [this](const valhalla::midgard::PointLL& place) {
                            return build_location(place, min_outbound_reach, min_inbound_reach, radius);
                        });
-        const auto path_locations = valhalla::loki::Search(locations,
-                                                           graph,
-                                                           costing);
+        const auto path_locations = search(locations, graph, parse_projector_mode(mode), costing);
 
-        std::unordered_map<valhalla::midgard::PointLL, valhalla::baldr::PathLocation> results;
-        for (const auto& l : path_locations) {
-            results.emplace(l.first.latlng_, l.second);
+        for (size_t i = 0; i < locations.size(); ++i) {
+            const auto projection = path_locations.find(locations[i]);
+            if (projection != path_locations.end()) {
+                on_result(i, locations[i].latlng_, projection->second);
+            }
         }
-        return results;
     }
 };
 
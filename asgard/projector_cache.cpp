@@ -0,0 +1,501 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#include "asgard/projector_cache.h"
+
+#include <valhalla/baldr/graphconstants.h>
+
+#include <boost/functional/hash.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <shared_mutex>
+#include <stdexcept>
+
+namespace asgard {
+
+CachePolicy parse_cache_policy(const std::string& policy) {
+    if (policy == "lru") {
+        return CachePolicy::lru;
+    }
+    if (policy == "clock") {
+        return CachePolicy::clock;
+    }
+    if (policy == "tinylfu") {
+        return CachePolicy::tinylfu;
+    }
+    throw std::invalid_argument("Unknown projector cache policy: " + policy);
+}
+
+std::string to_string(CachePolicy policy) {
+    switch (policy) {
+    case CachePolicy::lru: return "lru";
+    case CachePolicy::clock: return "clock";
+    case CachePolicy::tinylfu: return "tinylfu";
+    default: throw std::invalid_argument("Bad to_string(CachePolicy) parameter");
+    }
+}
+
+boost::optional<ProjectorMode> parse_projector_mode(const std::string& mode) {
+    if (mode == "walking" || mode == "bss") {
+        return ProjectorMode::walking;
+    }
+    if (mode == "bike") {
+        return ProjectorMode::bike;
+    }
+    if (mode == "car") {
+        return ProjectorMode::car;
+    }
+    if (mode == "taxi") {
+        return ProjectorMode::taxi;
+    }
+    return boost::none;
+}
+
+const std::string& to_string(ProjectorMode mode) {
+    static const std::array<std::string, nb_projector_modes> names = {{"walking", "bike", "car", "taxi"}};
+    return names.at(static_cast<size_t>(mode));
+}
+
+uint16_t to_access(ProjectorMode mode) {
+    switch (mode) {
+    case ProjectorMode::walking: return valhalla::baldr::kPedestrianAccess;
+    case ProjectorMode::bike: return valhalla::baldr::kBicycleAccess;
+    case ProjectorMode::car: return valhalla::baldr::kAutoAccess;
+    case ProjectorMode::taxi: return valhalla::baldr::kTaxiAccess;
+    default: throw std::invalid_argument("Bad to_access(ProjectorMode) parameter");
+    }
+}
+
+valhalla::midgard::PointLL quantize(const valhalla::midgard::PointLL& place, double precision) {
+    if (precision <= 0) {
+        return place;
+    }
+    return {std::round(place.lng() / precision) * precision, std::round(place.lat() / precision) * precision};
+}
+
+size_t ProjectorKeyHash::operator()(const ProjectorKey& key) const {
+    size_t seed = std::hash<valhalla::midgard::PointLL>()(key.first);
+    boost::hash_combine(seed, key.second);
+    return seed;
+}
+
+void CacheByteBudget::add_shard(CacheShard* shard) {
+    std::lock_guard<std::mutex> lock(mutex);
+    shards.push_back(shard);
+}
+
+void CacheByteBudget::remove_shard(CacheShard* shard) {
+    std::lock_guard<std::mutex> lock(mutex);
+    shards.erase(std::remove(shards.begin(), shards.end(), shard), shards.end());
+    cursor = 0;
+}
+
+void CacheByteBudget::reclaim() {
+    if (get_nb_bytes() <= max_bytes) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    // round robin on the shards of all the modes, so that every cache gives
+    // back memory, a shard being evicted from never waits on another one
+    size_t nb_empty = 0;
+    while (get_nb_bytes() > max_bytes && nb_empty < shards.size()) {
+        cursor = (cursor + 1) % shards.size();
+        if (shards[cursor]->evict() == 0) {
+            ++nb_empty;
+        } else {
+            nb_empty = 0;
+        }
+    }
+}
+
+size_t CacheShard::get_entry_bytes(const key_type& key, const mapped_type& value) {
+    // the nodes of the containers hold a few pointers besides the entry
+    static constexpr size_t node_overhead = 4 * sizeof(void*);
+    size_t nb_bytes = node_overhead + sizeof(key_type) + value.get_nb_bytes();
+    if (key.second.capacity() > std::string().capacity()) {
+        nb_bytes += key.second.capacity() + 1;
+    }
+    return nb_bytes;
+}
+
+size_t CacheShard::account_insert(const key_type& key, const mapped_type& value) {
+    const auto entry_bytes = get_entry_bytes(key, value);
+    nb_bytes.fetch_add(entry_bytes, std::memory_order_relaxed);
+    if (budget) {
+        budget->charge(entry_bytes);
+    }
+    return entry_bytes;
+}
+
+size_t CacheShard::account_erase(const key_type& key, const mapped_type& value) {
+    const auto entry_bytes = get_entry_bytes(key, value);
+    nb_bytes.fetch_sub(entry_bytes, std::memory_order_relaxed);
+    if (budget) {
+        budget->release(entry_bytes);
+    }
+    return entry_bytes;
+}
+
+boost::optional<CacheShard::mapped_type> CacheShard::find(const key_type& key) {
+    boost::optional<mapped_type> value;
+    visit(key, [&value](const mapped_type& v) { value = v; });
+    return value;
+}
+
+bool LruCacheShard::visit(const key_type& key, const Visitor& visitor) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& list = cache.get<0>();
+    const auto& map = cache.get<1>();
+    const auto search = map.find(key);
+    if (search == map.end()) {
+        return false;
+    }
+    // put the cached value at the begining of the cache
+    list.relocate(list.begin(), cache.project<0>(search));
+    visitor(search->second);
+    return true;
+}
+
+void LruCacheShard::insert(const key_type& key, const mapped_type& value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& list = cache.get<0>();
+    const auto inserted = list.push_front(std::make_pair(key, value));
+    if (inserted.second) {
+        account_insert(inserted.first->first, inserted.first->second);
+    }
+    while (list.size() > max_size) { evict_back(); }
+}
+
+size_t LruCacheShard::evict_back() {
+    auto& list = cache.get<0>();
+    const auto nb_bytes = account_erase(list.back().first, list.back().second);
+    list.pop_back();
+    return nb_bytes;
+}
+
+size_t LruCacheShard::evict() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return cache.empty() ? 0 : evict_back();
+}
+
+size_t LruCacheShard::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return cache.size();
+}
+
+std::vector<std::pair<CacheShard::key_type, CacheShard::mapped_type>> LruCacheShard::dump() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto& list = cache.get<0>();
+    return {list.rbegin(), list.rend()};
+}
+
+bool ClockCacheShard::visit(const key_type& key, const Visitor& visitor) {
+    std::shared_lock<ReadMostlyLock> guard(lock);
+    const auto search = index.find(key);
+    if (search == index.end()) {
+        return false;
+    }
+    const auto& slot = slots[search->second];
+    // only write when needed, to keep the cache line shared between cores
+    if (!slot.referenced.load(std::memory_order_relaxed)) {
+        slot.referenced.store(true, std::memory_order_relaxed);
+    }
+    visitor(slot.value);
+    return true;
+}
+
+void ClockCacheShard::insert(const key_type& key, const mapped_type& value) {
+    if (max_size == 0) {
+        return;
+    }
+    std::lock_guard<ReadMostlyLock> guard(lock);
+    if (index.find(key) != index.end()) {
+        return;
+    }
+    if (slots.size() < max_size) {
+        slots.emplace_back(key, value);
+        account_insert(slots.back().key, slots.back().value);
+        index.emplace(key, slots.size() - 1);
+        return;
+    }
+    auto& victim = slots[find_victim()];
+    account_erase(victim.key, victim.value);
+    index.erase(victim.key);
+    victim.key = key;
+    victim.value = value;
+    account_insert(victim.key, victim.value);
+    index.emplace(key, hand);
+    hand = (hand + 1) % slots.size();
+}
+
+size_t ClockCacheShard::find_victim() {
+    // second chance: skip (and clear) the recently referenced entries
+    while (slots[hand].referenced.load(std::memory_order_relaxed)) {
+        slots[hand].referenced.store(false, std::memory_order_relaxed);
+        hand = (hand + 1) % slots.size();
+    }
+    return hand;
+}
+
+size_t ClockCacheShard::evict() {
+    std::lock_guard<ReadMostlyLock> guard(lock);
+    if (slots.empty()) {
+        return 0;
+    }
+    auto& victim = slots[find_victim()];
+    const auto nb_bytes = account_erase(victim.key, victim.value);
+    index.erase(victim.key);
+    // fill the hole with the last slot, so that the slots stay contiguous
+    auto& last = slots.back();
+    if (&victim != &last) {
+        account_erase(last.key, last.value);
+        victim.key = std::move(last.key);
+        victim.value = std::move(last.value);
+        victim.referenced.store(last.referenced.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        account_insert(victim.key, victim.value);
+        index[victim.key] = hand;
+    }
+    slots.pop_back();
+    if (hand >= slots.size()) {
+        hand = 0;
+    }
+    return nb_bytes;
+}
+
+size_t ClockCacheShard::size() const {
+    std::shared_lock<ReadMostlyLock> guard(lock);
+    return slots.size();
+}
+
+std::vector<std::pair<CacheShard::key_type, CacheShard::mapped_type>> ClockCacheShard::dump() const {
+    std::shared_lock<ReadMostlyLock> guard(lock);
+    std::vector<std::pair<key_type, mapped_type>> entries;
+    entries.reserve(slots.size());
+    for (const auto& slot : slots) {
+        entries.emplace_back(slot.key, slot.value);
+    }
+    return entries;
+}
+
+FrequencySketch::FrequencySketch(size_t capacity) {
+    size_t width = 16;
+    while (width < capacity) { width *= 2; }
+    counters.assign(depth * width, 0);
+    width_mask = width - 1;
+    sample_size = 10 * std::max<size_t>(capacity, 1);
+}
+
+size_t FrequencySketch::index(size_t hash, size_t row) const {
+    static const uint64_t seeds[depth] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+    const uint64_t h = (static_cast<uint64_t>(hash) + seeds[row]) * 0x9e3779b97f4a7c15ULL;
+    return row * (width_mask + 1) + ((h >> 32) & width_mask);
+}
+
+void FrequencySketch::increment(size_t hash) {
+    // conservative update: only the smallest counters are incremented
+    const auto current = estimate(hash);
+    if (current < max_count) {
+        for (size_t row = 0; row < depth; ++row) {
+            auto& counter = counters[index(hash, row)];
+            if (counter == current) {
+                ++counter;
+            }
+        }
+    }
+    if (++nb_additions >= sample_size) {
+        age();
+    }
+}
+
+uint8_t FrequencySketch::estimate(size_t hash) const {
+    uint8_t count = max_count;
+    for (size_t row = 0; row < depth; ++row) {
+        count = std::min(count, counters[index(hash, row)]);
+    }
+    return count;
+}
+
+void FrequencySketch::age() {
+    for (auto& counter : counters) {
+        counter /= 2;
+    }
+    nb_additions /= 2;
+}
+
+TinyLfuCacheShard::TinyLfuCacheShard(size_t max_size) : window_max_size(std::min<size_t>(max_size, std::max<size_t>(1, max_size / 100))),
+                                                        main_max_size(max_size - window_max_size),
+                                                        sketch(max_size) {}
+
+bool TinyLfuCacheShard::visit(const key_type& key, const Visitor& visitor) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // misses are counted too, that is how a new key proves it is worth caching
+    sketch.increment(ProjectorKeyHash()(key));
+    for (auto* cache : {&window, &main}) {
+        auto& list = cache->get<0>();
+        const auto& map = cache->get<1>();
+        const auto search = map.find(key);
+        if (search != map.end()) {
+            list.relocate(list.begin(), cache->project<0>(search));
+            visitor(search->second);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TinyLfuCacheShard::insert(const key_type& key, const mapped_type& value) {
+    if (window_max_size == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (window.get<1>().count(key) || main.get<1>().count(key)) {
+        return;
+    }
+    auto& list = window.get<0>();
+    list.push_front(std::make_pair(key, value));
+    account_insert(list.front().first, list.front().second);
+    if (list.size() > window_max_size) {
+        const auto candidate = list.back();
+        account_erase(list.back().first, list.back().second);
+        list.pop_back();
+        admit(candidate);
+    }
+}
+
+void TinyLfuCacheShard::admit(const value_type& candidate) {
+    auto& list = main.get<0>();
+    if (list.size() < main_max_size) {
+        list.push_front(candidate);
+        account_insert(list.front().first, list.front().second);
+        return;
+    }
+    if (main_max_size > 0 &&
+        sketch.estimate(ProjectorKeyHash()(candidate.first)) > sketch.estimate(ProjectorKeyHash()(list.back().first))) {
+        evict_back(main);
+        list.push_front(candidate);
+        account_insert(list.front().first, list.front().second);
+        return;
+    }
+    ++nb_rejected;
+}
+
+size_t TinyLfuCacheShard::evict_back(Cache& cache) {
+    auto& list = cache.get<0>();
+    const auto nb_bytes = account_erase(list.back().first, list.back().second);
+    list.pop_back();
+    return nb_bytes;
+}
+
+size_t TinyLfuCacheShard::evict() {
+    std::lock_guard<std::mutex> lock(mutex);
+    // the main cache holds the entries that proved to be useful, the window goes first
+    if (!window.empty()) {
+        return evict_back(window);
+    }
+    return main.empty() ? 0 : evict_back(main);
+}
+
+size_t TinyLfuCacheShard::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return window.size() + main.size();
+}
+
+std::vector<std::pair<CacheShard::key_type, CacheShard::mapped_type>> TinyLfuCacheShard::dump() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::pair<key_type, mapped_type>> entries(main.get<0>().rbegin(), main.get<0>().rend());
+    entries.insert(entries.end(), window.get<0>().rbegin(), window.get<0>().rend());
+    return entries;
+}
+
+size_t TinyLfuCacheShard::get_nb_rejected() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nb_rejected;
+}
+
+ProjectorCache::ProjectorCache(size_t max_size, size_t nb_shards, CachePolicy policy, std::shared_ptr<CacheByteBudget> budget) : budget(std::move(budget)) {
+    nb_shards = std::max<size_t>(1, std::min(nb_shards, max_size / min_shard_size));
+    // round up so that the shards can hold at least max_size entries
+    const size_t shard_size = (max_size + nb_shards - 1) / nb_shards;
+    for (size_t i = 0; i < nb_shards; ++i) {
+        if (policy == CachePolicy::clock) {
+            shards.push_back(std::make_unique<ClockCacheShard>(shard_size));
+        } else if (policy == CachePolicy::tinylfu) {
+            shards.push_back(std::make_unique<TinyLfuCacheShard>(shard_size));
+        } else {
+            shards.push_back(std::make_unique<LruCacheShard>(shard_size));
+        }
+        if (this->budget) {
+            shards.back()->set_budget(this->budget.get());
+            this->budget->add_shard(shards.back().get());
+        }
+    }
+}
+
+ProjectorCache::~ProjectorCache() {
+    if (budget) {
+        for (const auto& shard : shards) {
+            budget->remove_shard(shard.get());
+        }
+    }
+}
+
+CacheShard& ProjectorCache::get_shard(const key_type& key) {
+    return *shards[ProjectorKeyHash()(key) % shards.size()];
+}
+
+boost::optional<ProjectorCache::mapped_type> ProjectorCache::find(const key_type& key) {
+    return get_shard(key).find(key);
+}
+
+bool ProjectorCache::visit(const key_type& key, const CacheShard::Visitor& visitor) {
+    return get_shard(key).visit(key, visitor);
+}
+
+void ProjectorCache::insert(const key_type& key, const mapped_type& value) {
+    get_shard(key).insert(key, value);
+    // no shard lock is held here, the budget can evict from any of them
+    if (budget) {
+        budget->reclaim();
+    }
+}
+
+size_t ProjectorCache::size() const {
+    size_t size = 0;
+    for (const auto& shard : shards) {
+        size += shard->size();
+    }
+    return size;
+}
+
+size_t ProjectorCache::get_nb_rejected() const {
+    size_t nb_rejected = 0;
+    for (const auto& shard : shards) {
+        nb_rejected += shard->get_nb_rejected();
+    }
+    return nb_rejected;
+}
+
+size_t ProjectorCache::get_nb_bytes() const {
+    size_t nb_bytes = 0;
+    for (const auto& shard : shards) {
+        nb_bytes += shard->get_nb_bytes();
+    }
+    return nb_bytes;
+}
+
+} // namespace asgard
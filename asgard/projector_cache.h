@@ -0,0 +1,310 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "asgard/compact_projection.h"
+#include "asgard/read_mostly_lock.h"
+
+#include <valhalla/midgard/pointll.h>
+
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/optional.hpp>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace asgard {
+
+enum class CachePolicy {
+    // exact LRU, every hit moves the entry at the front of its list
+    lru,
+    // CLOCK/second chance, hits only set a reference bit and never wait
+    // behind other readers
+    clock,
+    // W-TinyLFU, new entries go in a small LRU window and only enter the
+    // main LRU when they are more frequently used than its victim
+    tinylfu
+};
+
+CachePolicy parse_cache_policy(const std::string& policy);
+std::string to_string(CachePolicy policy);
+
+// The modes having their own projector cache
+enum class ProjectorMode {
+    walking,
+    bike,
+    car,
+    taxi
+};
+
+constexpr size_t nb_projector_modes = 4;
+
+// bss is projected as walking, boost::none for the other unknown modes
+boost::optional<ProjectorMode> parse_projector_mode(const std::string& mode);
+const std::string& to_string(ProjectorMode mode);
+// The access bits of the edges usable by the mode
+uint16_t to_access(ProjectorMode mode);
+
+struct ProjectorCacheConf {
+    // Number of independent locks/LRU lists of each mode's cache
+    size_t nb_shards = 16;
+    CachePolicy policy = CachePolicy::lru;
+    // Memory shared by the caches of all the modes, 0 means only the
+    // number of entries of each mode is bounded
+    size_t max_bytes = 0;
+    // Number of coordinates that failed to be projected remembered, and for how long (in seconds).
+    // Off by default: a transient failure would hide a place for the whole ttl
+    size_t negative_cache_size = 0;
+    size_t negative_cache_ttl = 3600;
+    // The places are rounded to this many degrees in the cache keys so that
+    // close places share their projection, 0 keeps the exact coordinates
+    double key_precision = 0;
+    // A cached projection is only reused for the places closer than this
+    // (in meters) to the place actually projected, 0 to always reuse it
+    double key_tolerance = 0;
+};
+
+using ProjectorKey = std::pair<valhalla::midgard::PointLL, std::string>;
+
+// Round the coordinates to a multiple of precision, precision <= 0 keeps them
+valhalla::midgard::PointLL quantize(const valhalla::midgard::PointLL& place, double precision);
+
+struct ProjectorKeyHash {
+    size_t operator()(const ProjectorKey& key) const;
+};
+
+class CacheShard;
+
+// A memory budget shared by several caches. When it is exceeded, the least
+// recently used entries of the shards are evicted in turn.
+class CacheByteBudget {
+public:
+    explicit CacheByteBudget(size_t max_bytes) : max_bytes(max_bytes) {}
+
+    void add_shard(CacheShard* shard);
+    void remove_shard(CacheShard* shard);
+
+    void charge(size_t nb_bytes) { used.fetch_add(nb_bytes, std::memory_order_relaxed); }
+    void release(size_t nb_bytes) { used.fetch_sub(nb_bytes, std::memory_order_relaxed); }
+    // Evict entries until the budget is respected
+    void reclaim();
+
+    size_t get_max_bytes() const { return max_bytes; }
+    size_t get_nb_bytes() const { return used.load(std::memory_order_relaxed); }
+
+private:
+    const size_t max_bytes;
+    std::atomic<size_t> used{0};
+    std::mutex mutex;
+    std::vector<CacheShard*> shards;
+    size_t cursor = 0;
+};
+
+class CacheShard {
+public:
+    using key_type = ProjectorKey;
+    using mapped_type = CompactProjection;
+
+    // Called on a cached value while the shard is locked, it must not use the cache
+    using Visitor = std::function<void(const mapped_type&)>;
+
+    virtual ~CacheShard() = default;
+
+    // Call visitor on the value of key, without copying it, return false on a miss
+    virtual bool visit(const key_type& key, const Visitor& visitor) = 0;
+    boost::optional<mapped_type> find(const key_type& key);
+    virtual void insert(const key_type& key, const mapped_type& value) = 0;
+    // Evict the entry the policy would evict next, return the number of
+    // bytes released, 0 when the shard is empty
+    virtual size_t evict() = 0;
+    virtual size_t size() const = 0;
+    // Copy of the entries, the least recently used first
+    virtual std::vector<std::pair<key_type, mapped_type>> dump() const = 0;
+    // Number of entries the admission policy refused to keep
+    virtual size_t get_nb_rejected() const { return 0; }
+
+    size_t get_nb_bytes() const { return nb_bytes.load(std::memory_order_relaxed); }
+    void set_budget(CacheByteBudget* budget) { this->budget = budget; }
+
+    // Memory used by an entry, the container's node included
+    static size_t get_entry_bytes(const key_type& key, const mapped_type& value);
+
+protected:
+    // To be called by the implementations on every entry they add or drop
+    size_t account_insert(const key_type& key, const mapped_type& value);
+    size_t account_erase(const key_type& key, const mapped_type& value);
+
+private:
+    std::atomic<size_t> nb_bytes{0};
+    CacheByteBudget* budget = nullptr;
+};
+
+// A LRU cache guarded by its own mutex
+class LruCacheShard : public CacheShard {
+public:
+    explicit LruCacheShard(size_t max_size) : max_size(max_size) {}
+
+    bool visit(const key_type& key, const Visitor& visitor) override;
+    void insert(const key_type& key, const mapped_type& value) override;
+    size_t evict() override;
+    size_t size() const override;
+    std::vector<std::pair<key_type, mapped_type>> dump() const override;
+
+private:
+    using value_type = std::pair<const key_type, mapped_type>;
+    using Cache = boost::multi_index_container<value_type, boost::multi_index::indexed_by<boost::multi_index::sequenced<>, boost::multi_index::hashed_unique<boost::multi_index::member<value_type, const key_type, &value_type::first>, ProjectorKeyHash>>>;
+
+    size_t evict_back();
+
+    const size_t max_size;
+    Cache cache;
+    mutable std::mutex mutex;
+};
+
+// A CLOCK cache: a hit only reads the shard and sets the entry's reference
+// bit when it is not already set. Inserts and evictions are serialised.
+class ClockCacheShard : public CacheShard {
+public:
+    explicit ClockCacheShard(size_t max_size) : max_size(max_size) {}
+
+    bool visit(const key_type& key, const Visitor& visitor) override;
+    void insert(const key_type& key, const mapped_type& value) override;
+    size_t evict() override;
+    size_t size() const override;
+    std::vector<std::pair<key_type, mapped_type>> dump() const override;
+
+private:
+    struct Slot {
+        Slot(const key_type& key, const mapped_type& value) : key(key), value(value) {}
+        key_type key;
+        mapped_type value;
+        mutable std::atomic<bool> referenced{false};
+    };
+
+    // Move the hand to the next entry to evict
+    size_t find_victim();
+
+    const size_t max_size;
+    std::unordered_map<key_type, size_t, ProjectorKeyHash> index;
+    // a deque never moves its elements, the atomics stay in place
+    std::deque<Slot> slots;
+    size_t hand = 0;
+    mutable ReadMostlyLock lock;
+};
+
+// Count-Min sketch of the access frequency of the keys. The counters are
+// saturated at 15 and halved periodically, so that old accesses fade away.
+class FrequencySketch {
+public:
+    explicit FrequencySketch(size_t capacity);
+
+    void increment(size_t hash);
+    uint8_t estimate(size_t hash) const;
+
+private:
+    static constexpr size_t depth = 4;
+    static constexpr uint8_t max_count = 15;
+
+    size_t index(size_t hash, size_t row) const;
+    void age();
+
+    std::vector<uint8_t> counters;
+    size_t width_mask;
+    size_t sample_size;
+    size_t nb_additions = 0;
+};
+
+class TinyLfuCacheShard : public CacheShard {
+public:
+    explicit TinyLfuCacheShard(size_t max_size);
+
+    bool visit(const key_type& key, const Visitor& visitor) override;
+    void insert(const key_type& key, const mapped_type& value) override;
+    size_t evict() override;
+    size_t size() const override;
+    std::vector<std::pair<key_type, mapped_type>> dump() const override;
+    size_t get_nb_rejected() const override;
+
+private:
+    using value_type = std::pair<const key_type, mapped_type>;
+    using Cache = boost::multi_index_container<value_type, boost::multi_index::indexed_by<boost::multi_index::sequenced<>, boost::multi_index::hashed_unique<boost::multi_index::member<value_type, const key_type, &value_type::first>, ProjectorKeyHash>>>;
+
+    // Move the window's victim in the main cache if it is used more often than the main's victim
+    void admit(const value_type& candidate);
+    size_t evict_back(Cache& cache);
+
+    const size_t window_max_size;
+    const size_t main_max_size;
+    Cache window;
+    Cache main;
+    FrequencySketch sketch;
+    size_t nb_rejected = 0;
+    mutable std::mutex mutex;
+};
+
+// The cache of one mode, split in several shards so that concurrent
+// workers rarely wait on the same lock
+class ProjectorCache {
+public:
+    using key_type = ProjectorKey;
+    using mapped_type = CompactProjection;
+
+    // A shard should hold at least this many entries, small caches are
+    // thus not split and keep an exact LRU behaviour
+    static constexpr size_t min_shard_size = 64;
+
+    // The shards are registered in budget, when there is one
+    ProjectorCache(size_t max_size, size_t nb_shards, CachePolicy policy = CachePolicy::lru, std::shared_ptr<CacheByteBudget> budget = nullptr);
+    ProjectorCache(ProjectorCache&&) = default;
+    ~ProjectorCache();
+
+    boost::optional<mapped_type> find(const key_type& key);
+    bool visit(const key_type& key, const CacheShard::Visitor& visitor);
+    void insert(const key_type& key, const mapped_type& value);
+    size_t size() const;
+    size_t get_nb_shards() const { return shards.size(); }
+    size_t get_nb_rejected() const;
+    size_t get_nb_bytes() const;
+
+    // Call f on every entry, the shards are copied before so that f is
+    // called without holding any lock
+    template<typename F>
+    void for_each(F f) const {
+        for (const auto& shard : shards) {
+            for (const auto& entry : shard->dump()) {
+                f(entry.first, entry.second);
+            }
+        }
+    }
+
+private:
+    CacheShard& get_shard(const key_type& key);
+
+    std::vector<std::unique_ptr<CacheShard>> shards;
+    std::shared_ptr<CacheByteBudget> budget;
+};
+
+} // namespace asgard
@@ -0,0 +1,202 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#include "asgard/projector_snapshot.h"
+
+#include <valhalla/baldr/graphtile.h>
+
+#include <boost/functional/hash.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace asgard {
+
+namespace {
+
+const char MAGIC[8] = {'A', 'S', 'G', 'P', 'R', 'O', 'J', '\0'};
+const uint32_t VERSION = 2;
+
+template<typename T>
+void write_value(std::ofstream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void write_edges(std::ofstream& out, const std::vector<valhalla::baldr::PathLocation::PathEdge>& edges) {
+    write_value(out, static_cast<uint32_t>(edges.size()));
+    for (const auto& e : edges) {
+        write_value(out, static_cast<uint64_t>(e.id));
+        write_value(out, static_cast<double>(e.percent_along));
+        write_value(out, static_cast<double>(e.projected.lng()));
+        write_value(out, static_cast<double>(e.projected.lat()));
+        write_value(out, static_cast<float>(e.distance));
+        write_value(out, static_cast<uint8_t>(e.sos));
+        write_value(out, static_cast<uint32_t>(e.outbound_reach));
+        write_value(out, static_cast<uint32_t>(e.inbound_reach));
+    }
+}
+
+} // namespace
+
+uint64_t get_tileset_fingerprint(valhalla::baldr::GraphReader& graph) {
+    const auto tiles = graph.GetTileSet();
+    if (tiles.empty()) {
+        return 0;
+    }
+    const auto first_tile_id = *std::min_element(tiles.begin(), tiles.end(), [](const auto& a, const auto& b) {
+        return static_cast<uint64_t>(a) < static_cast<uint64_t>(b);
+    });
+    size_t seed = tiles.size();
+    boost::hash_combine(seed, static_cast<uint64_t>(first_tile_id));
+    const auto tile = graph.GetGraphTile(first_tile_id);
+    if (tile) {
+        boost::hash_combine(seed, tile->header()->dataset_id());
+        boost::hash_combine(seed, tile->header()->directededgecount());
+    }
+    return seed;
+}
+
+bool is_projection_valid(const SnapshotEntry& entry, valhalla::baldr::GraphReader& graph) {
+    for (const auto* edges : {&entry.edges, &entry.filtered_edges}) {
+        for (const auto& e : *edges) {
+            const auto tile = graph.GetGraphTile(e.id);
+            if (!tile || e.id.id() >= tile->header()->directededgecount()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+SnapshotWriter::SnapshotWriter(const std::string& path, const SnapshotHeader& header) : path(path),
+                                                                                         tmp_path(path + ".tmp"),
+                                                                                         out(tmp_path, std::ios::binary | std::ios::trunc) {
+    if (!out) {
+        throw std::runtime_error("Cannot open projector snapshot " + tmp_path);
+    }
+    out.write(MAGIC, sizeof(MAGIC));
+    write_value(out, VERSION);
+    write_value(out, header.tileset_fingerprint);
+    write_value(out, header.min_outbound_reach);
+    write_value(out, header.min_inbound_reach);
+    write_value(out, header.radius);
+    write_value(out, header.key_precision);
+}
+
+void SnapshotWriter::write(const ProjectorKey& key, const CompactProjection& projection) {
+    write_value(out, static_cast<uint8_t>(key.second.size()));
+    out.write(key.second.data(), key.second.size());
+    write_value(out, static_cast<double>(key.first.lng()));
+    write_value(out, static_cast<double>(key.first.lat()));
+    const auto origin = projection.get_origin();
+    write_value(out, static_cast<double>(origin.lng()));
+    write_value(out, static_cast<double>(origin.lat()));
+    write_edges(out, projection.get_edges());
+    write_edges(out, projection.get_filtered_edges());
+    ++nb_entries;
+}
+
+void SnapshotWriter::commit() {
+    out.close();
+    if (!out) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Cannot write projector snapshot " + tmp_path);
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Cannot rename projector snapshot " + tmp_path + " to " + path);
+    }
+}
+
+SnapshotReader::SnapshotReader(const std::string& path) : file(path) {
+    cursor = file.data();
+    end = cursor + file.size();
+
+    char magic[sizeof(MAGIC)];
+    uint32_t version = 0;
+    if (!read(magic) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        !read(version) || version != VERSION ||
+        !read(header.tileset_fingerprint) ||
+        !read(header.min_outbound_reach) ||
+        !read(header.min_inbound_reach) ||
+        !read(header.radius) ||
+        !read(header.key_precision)) {
+        throw std::runtime_error(path + " is not a projector snapshot");
+    }
+}
+
+template<typename T>
+bool SnapshotReader::read(T& value) {
+    if (static_cast<size_t>(end - cursor) < sizeof(T)) {
+        return false;
+    }
+    // the file is not aligned, copy instead of casting
+    std::memcpy(&value, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return true;
+}
+
+boost::optional<SnapshotEntry> SnapshotReader::next() {
+    uint8_t mode_size = 0;
+    if (!read(mode_size) || static_cast<size_t>(end - cursor) < mode_size) {
+        return boost::none;
+    }
+    std::string mode(cursor, mode_size);
+    cursor += mode_size;
+
+    double lng = 0;
+    double lat = 0;
+    double origin_lng = 0;
+    double origin_lat = 0;
+    if (!read(lng) || !read(lat) || !read(origin_lng) || !read(origin_lat)) {
+        return boost::none;
+    }
+    SnapshotEntry entry{std::make_pair(valhalla::midgard::PointLL{lng, lat}, std::move(mode)),
+                        valhalla::midgard::PointLL{origin_lng, origin_lat}, {}, {}};
+
+    for (auto* edges : {&entry.edges, &entry.filtered_edges}) {
+        uint32_t nb_edges = 0;
+        if (!read(nb_edges)) {
+            return boost::none;
+        }
+        for (uint32_t i = 0; i < nb_edges; ++i) {
+            uint64_t id = 0;
+            double percent_along = 0;
+            double projected_lng = 0;
+            double projected_lat = 0;
+            float distance = 0;
+            uint8_t sos = 0;
+            uint32_t outbound_reach = 0;
+            uint32_t inbound_reach = 0;
+            if (!read(id) || !read(percent_along) || !read(projected_lng) || !read(projected_lat) ||
+                !read(distance) || !read(sos) || !read(outbound_reach) || !read(inbound_reach)) {
+                return boost::none;
+            }
+            edges->emplace_back(valhalla::baldr::GraphId(id),
+                                percent_along,
+                                valhalla::midgard::PointLL{projected_lng, projected_lat},
+                                distance,
+                                static_cast<valhalla::baldr::PathLocation::SideOfStreet>(sos),
+                                outbound_reach,
+                                inbound_reach);
+        }
+    }
+    return entry;
+}
+
+} // namespace asgard
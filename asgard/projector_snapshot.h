@@ -0,0 +1,112 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+/**
+ * Binary snapshot of the projector's caches
+ *
+ * The file starts with a header identifying the tileset and the projection
+ * parameters, followed by the cached entries:
+ *   mode, key coordinate, projected coordinate, edges and filtered edges
+ * The key coordinate is rounded to the key precision, the projected one is
+ * the place loki projected, from which the key tolerance is measured.
+ * It is written in a temporary file renamed at the end, so a crash never
+ * leaves a half written snapshot behind.
+ */
+
+#pragma once
+
+#include "asgard/projector_cache.h"
+
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/baldr/pathlocation.h>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/optional.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace asgard {
+
+struct SnapshotHeader {
+    uint64_t tileset_fingerprint = 0;
+    uint32_t min_outbound_reach = 0;
+    uint32_t min_inbound_reach = 0;
+    uint32_t radius = 0;
+    // the keys of another precision would never be looked up
+    double key_precision = 0;
+
+    bool operator==(const SnapshotHeader& other) const {
+        return tileset_fingerprint == other.tileset_fingerprint &&
+               min_outbound_reach == other.min_outbound_reach &&
+               min_inbound_reach == other.min_inbound_reach &&
+               radius == other.radius &&
+               key_precision == other.key_precision;
+    }
+};
+
+struct SnapshotEntry {
+    ProjectorKey key;
+    valhalla::midgard::PointLL origin;
+    std::vector<valhalla::baldr::PathLocation::PathEdge> edges;
+    std::vector<valhalla::baldr::PathLocation::PathEdge> filtered_edges;
+};
+
+// Identify the tileset the graph has been loaded from
+uint64_t get_tileset_fingerprint(valhalla::baldr::GraphReader& graph);
+
+// Check that all the edges of the projection still exist in the graph
+bool is_projection_valid(const SnapshotEntry& entry, valhalla::baldr::GraphReader& graph);
+
+class SnapshotWriter {
+public:
+    SnapshotWriter(const std::string& path, const SnapshotHeader& header);
+
+    void write(const ProjectorKey& key, const CompactProjection& projection);
+    // Flush the snapshot and replace the previous one
+    void commit();
+
+    size_t get_nb_entries() const { return nb_entries; }
+
+private:
+    std::string path;
+    std::string tmp_path;
+    std::ofstream out;
+    size_t nb_entries = 0;
+};
+
+class SnapshotReader {
+public:
+    // Throws if the file cannot be mapped or is not a snapshot
+    explicit SnapshotReader(const std::string& path);
+
+    const SnapshotHeader& get_header() const { return header; }
+    // Return the next entry, none at the end or on a truncated entry
+    boost::optional<SnapshotEntry> next();
+
+private:
+    template<typename T>
+    bool read(T& value);
+
+    boost::iostreams::mapped_file_source file;
+    const char* cursor = nullptr;
+    const char* end = nullptr;
+    SnapshotHeader header;
+};
+
+} // namespace asgard
@@ -0,0 +1,85 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace asgard {
+
+/**
+ * Reader/writer lock for data that is read much more often than written.
+ *
+ * Every reader only increments a counter living on its own cache line, so
+ * concurrent readers never write to the same memory. Writers are serialised,
+ * announce themselves and wait for the readers in progress to leave.
+ */
+class ReadMostlyLock {
+public:
+    void lock_shared() {
+        auto& counter = readers[reader_slot()].counter;
+        while (true) {
+            counter.fetch_add(1, std::memory_order_seq_cst);
+            if (!writer.load(std::memory_order_seq_cst)) {
+                return;
+            }
+            // a writer is coming, let it go first
+            counter.fetch_sub(1, std::memory_order_release);
+            while (writer.load(std::memory_order_acquire)) { std::this_thread::yield(); }
+        }
+    }
+
+    void unlock_shared() {
+        readers[reader_slot()].counter.fetch_sub(1, std::memory_order_release);
+    }
+
+    void lock() {
+        writer_mutex.lock();
+        writer.store(true, std::memory_order_seq_cst);
+        for (auto& r : readers) {
+            while (r.counter.load(std::memory_order_seq_cst) != 0) { std::this_thread::yield(); }
+        }
+    }
+
+    void unlock() {
+        writer.store(false, std::memory_order_release);
+        writer_mutex.unlock();
+    }
+
+private:
+    static constexpr size_t nb_reader_slots = 64;
+
+    // padded so that two counters never share a cache line
+    struct ReaderSlot {
+        std::atomic<size_t> counter{0};
+        char padding[64 - sizeof(std::atomic<size_t>)];
+    };
+
+    static size_t reader_slot() {
+        static thread_local const size_t slot = std::hash<std::thread::id>()(std::this_thread::get_id()) % nb_reader_slots;
+        return slot;
+    }
+
+    std::array<ReaderSlot, nb_reader_slots> readers;
+    std::atomic<bool> writer{false};
+    std::mutex writer_mutex;
+};
+
+} // namespace asgard
@@ -0,0 +1,327 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#include "asgard/shared_projector_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace asgard {
+
+// The atomics are shared by processes, they must not rely on a lock
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "the shared projector cache needs lock-free atomics");
+
+struct SharedCacheHeader {
+    char magic[8];
+    uint32_t version;
+    std::atomic<uint32_t> state;
+    uint64_t tileset_fingerprint;
+    uint32_t min_outbound_reach;
+    uint32_t min_inbound_reach;
+    uint32_t radius;
+    uint32_t padding;
+    double key_precision;
+    uint64_t nb_slots;
+    uint64_t slot_size;
+};
+
+// The part of a slot written under its sequence, checksummed
+struct SharedCacheContent {
+    uint64_t checksum;
+    double lng;
+    double lat;
+    int32_t origin_lng;
+    int32_t origin_lat;
+    uint16_t names_size;
+    uint8_t mode;
+    uint8_t nb_edges;
+    uint32_t padding;
+    // followed by the edges and their names
+};
+
+struct SharedCacheSlot {
+    // process-shared and robust, held by the writer of the slot
+    pthread_mutex_t lock;
+    // odd while the slot is written, 0 if it has never been
+    std::atomic<uint64_t> sequence;
+    // to choose the slot replaced in a bucket
+    std::atomic<uint64_t> write_time;
+    std::atomic<uint64_t> key_hash;
+    SharedCacheContent content;
+};
+
+namespace {
+
+const char MAGIC[8] = {'A', 'S', 'G', 'S', 'H', 'M', 'C', '\0'};
+const uint32_t VERSION = 5;
+// the slots are after the header, aligned on cache lines
+const size_t HEADER_SIZE = 128;
+const size_t CACHE_LINE_SIZE = 64;
+// number of slots a key can be stored in
+const size_t NB_WAYS = 4;
+
+static_assert(sizeof(SharedCacheHeader) <= HEADER_SIZE, "the shared cache header should fit in HEADER_SIZE");
+
+enum State : uint32_t {
+    UNINITIALIZED = 0,
+    READY
+};
+
+uint64_t now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// FNV-1a, the same in every process
+uint64_t hash_bytes(const void* bytes, size_t size, uint64_t hash = 14695981039346656037ULL) {
+    const auto* b = static_cast<const unsigned char*>(bytes);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ b[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t hash_key(const valhalla::midgard::PointLL& place, ProjectorMode mode) {
+    const double coords[2] = {place.lng(), place.lat()};
+    const auto m = static_cast<uint8_t>(mode);
+    return hash_bytes(&m, sizeof(m), hash_bytes(coords, sizeof(coords)));
+}
+
+// everything after the checksum
+uint64_t checksum(const SharedCacheContent& content, size_t payload_size) {
+    const auto* begin = reinterpret_cast<const char*>(&content) + sizeof(content.checksum);
+    return hash_bytes(begin, sizeof(SharedCacheContent) - sizeof(content.checksum) + payload_size);
+}
+
+size_t round_up(size_t size, size_t multiple) {
+    return (size + multiple - 1) / multiple * multiple;
+}
+
+} // namespace
+
+SharedProjectorCache::SharedProjectorCache(const std::string& path,
+                                           const SnapshotHeader& projection_header,
+                                           double key_precision,
+                                           size_t nb_slots,
+                                           size_t slot_size) : nb_slots(round_up(std::max(nb_slots, NB_WAYS), NB_WAYS)),
+                                                               slot_size(round_up(std::max(slot_size, sizeof(SharedCacheSlot) + sizeof(CompactEdge)), CACHE_LINE_SIZE)) {
+    nb_bytes = HEADER_SIZE + this->nb_slots * this->slot_size;
+
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open shared projector cache " + path + ": " + std::strerror(errno));
+    }
+    // the first process sizes and initializes the file while the others wait,
+    // the kernel releases the lock if it dies meanwhile
+    if (::flock(fd, LOCK_EX) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot lock shared projector cache " + path + ": " + std::strerror(errno));
+    }
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat shared projector cache " + path + ": " + std::strerror(errno));
+    }
+    // the file is zero filled
+    if (file_stat.st_size == 0 && ::ftruncate(fd, static_cast<off_t>(nb_bytes)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot resize shared projector cache " + path + ": " + std::strerror(errno));
+    }
+    if (file_stat.st_size != 0 && static_cast<size_t>(file_stat.st_size) != nb_bytes) {
+        ::close(fd);
+        throw std::runtime_error("Shared projector cache " + path + " has been created with another size");
+    }
+    void* address = ::mmap(nullptr, nb_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+        ::close(fd);
+        throw std::runtime_error("Cannot map shared projector cache " + path + ": " + std::strerror(errno));
+    }
+    data = static_cast<char*>(address);
+    header = reinterpret_cast<SharedCacheHeader*>(data);
+
+    // not READY if the process initializing it died
+    if (header->state.load(std::memory_order_acquire) != READY) {
+        std::memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->version = VERSION;
+        header->tileset_fingerprint = projection_header.tileset_fingerprint;
+        header->min_outbound_reach = projection_header.min_outbound_reach;
+        header->min_inbound_reach = projection_header.min_inbound_reach;
+        header->radius = projection_header.radius;
+        header->key_precision = key_precision;
+        header->nb_slots = this->nb_slots;
+        header->slot_size = this->slot_size;
+        // a writer dying with the lock of its slot does not block the others
+        pthread_mutexattr_t attributes;
+        ::pthread_mutexattr_init(&attributes);
+        ::pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        ::pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        for (size_t i = 0; i < this->nb_slots; ++i) {
+            ::pthread_mutex_init(&get_slot(i / NB_WAYS, i % NB_WAYS)->lock, &attributes);
+        }
+        ::pthread_mutexattr_destroy(&attributes);
+        header->state.store(READY, std::memory_order_release);
+    }
+    ::flock(fd, LOCK_UN);
+    ::close(fd);
+
+    if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION ||
+        header->tileset_fingerprint != projection_header.tileset_fingerprint ||
+        header->min_outbound_reach != projection_header.min_outbound_reach ||
+        header->min_inbound_reach != projection_header.min_inbound_reach ||
+        header->radius != projection_header.radius ||
+        header->key_precision != key_precision ||
+        header->nb_slots != this->nb_slots ||
+        header->slot_size != this->slot_size) {
+        ::munmap(data, nb_bytes);
+        throw std::runtime_error("Shared projector cache " + path + " has been created for another tileset or with other parameters");
+    }
+}
+
+SharedProjectorCache::~SharedProjectorCache() {
+    ::munmap(data, nb_bytes);
+}
+
+SharedCacheSlot* SharedProjectorCache::get_slot(size_t bucket, size_t way) const {
+    return reinterpret_cast<SharedCacheSlot*>(data + HEADER_SIZE + (bucket * NB_WAYS + way) * slot_size);
+}
+
+bool SharedProjectorCache::find(const ProjectorKey& key, CompactProjection& projection) const {
+    const auto mode = parse_projector_mode(key.second);
+    if (!mode) {
+        return false;
+    }
+    const auto hash = hash_key(key.first, *mode);
+    const auto bucket = hash % (nb_slots / NB_WAYS);
+    const auto content_size = slot_size - offsetof(SharedCacheSlot, content);
+    thread_local std::vector<char> buffer;
+    for (size_t way = 0; way < NB_WAYS; ++way) {
+        const auto* slot = get_slot(bucket, way);
+        if (slot->key_hash.load(std::memory_order_relaxed) != hash) {
+            continue;
+        }
+        const auto sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence == 0 || (sequence & 1) != 0) {
+            continue;
+        }
+        const auto* begin = reinterpret_cast<const char*>(&slot->content);
+        buffer.assign(begin, begin + content_size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->sequence.load(std::memory_order_relaxed) != sequence) {
+            continue;
+        }
+
+        SharedCacheContent content;
+        std::memcpy(&content, buffer.data(), sizeof(content));
+        const auto edges_size = content.nb_edges * sizeof(CompactEdge);
+        const auto payload_size = edges_size + content.names_size;
+        if (content.lng != key.first.lng() || content.lat != key.first.lat() ||
+            content.mode != static_cast<uint8_t>(*mode) ||
+            sizeof(SharedCacheContent) + payload_size > content_size ||
+            checksum(*reinterpret_cast<const SharedCacheContent*>(buffer.data()), payload_size) != content.checksum) {
+            continue;
+        }
+        const char* payload = buffer.data() + sizeof(SharedCacheContent);
+        projection.edges.resize(content.nb_edges);
+        std::memcpy(projection.edges.data(), payload, edges_size);
+        projection.names.assign(payload + edges_size, content.names_size);
+        projection.origin_lng = content.origin_lng;
+        projection.origin_lat = content.origin_lat;
+        return true;
+    }
+    return false;
+}
+
+void SharedProjectorCache::insert(const ProjectorKey& key, const CompactProjection& projection) {
+    const auto mode = parse_projector_mode(key.second);
+    if (!mode) {
+        return;
+    }
+    const auto edges_size = projection.edges.size() * sizeof(CompactEdge);
+    const auto payload_size = edges_size + projection.names.size();
+    if (projection.edges.size() > std::numeric_limits<uint8_t>::max() ||
+        projection.names.size() > std::numeric_limits<uint16_t>::max() ||
+        offsetof(SharedCacheSlot, content) + sizeof(SharedCacheContent) + payload_size > slot_size) {
+        return;
+    }
+    const auto hash = hash_key(key.first, *mode);
+    const auto bucket = hash % (nb_slots / NB_WAYS);
+
+    // the slot of the key, else an empty one, else the oldest one
+    SharedCacheSlot* slot = nullptr;
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    for (size_t way = 0; way < NB_WAYS; ++way) {
+        auto* candidate = get_slot(bucket, way);
+        if (candidate->key_hash.load(std::memory_order_relaxed) == hash) {
+            slot = candidate;
+            break;
+        }
+        const auto write_time = candidate->sequence.load(std::memory_order_relaxed) == 0 ? 0 : candidate->write_time.load(std::memory_order_relaxed);
+        if (write_time < oldest) {
+            oldest = write_time;
+            slot = candidate;
+        }
+    }
+
+    const int locked = ::pthread_mutex_trylock(&slot->lock);
+    if (locked == EOWNERDEAD) {
+        // its writer died, the slot is written again
+        ::pthread_mutex_consistent(&slot->lock);
+    } else if (locked != 0) {
+        // written by another thread or process
+        return;
+    }
+    auto sequence = slot->sequence.load(std::memory_order_relaxed);
+    // still odd if the previous writer died
+    if ((sequence & 1) == 0) {
+        ++sequence;
+        slot->sequence.store(sequence, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto& content = slot->content;
+    content.lng = key.first.lng();
+    content.lat = key.first.lat();
+    content.origin_lng = projection.origin_lng;
+    content.origin_lat = projection.origin_lat;
+    content.names_size = static_cast<uint16_t>(projection.names.size());
+    content.mode = static_cast<uint8_t>(*mode);
+    content.nb_edges = static_cast<uint8_t>(projection.edges.size());
+    content.padding = 0;
+    char* payload = reinterpret_cast<char*>(&content) + sizeof(SharedCacheContent);
+    std::memcpy(payload, projection.edges.data(), edges_size);
+    std::memcpy(payload + edges_size, projection.names.data(), projection.names.size());
+    content.checksum = checksum(content, payload_size);
+    slot->key_hash.store(hash, std::memory_order_relaxed);
+    slot->write_time.store(now(), std::memory_order_relaxed);
+
+    slot->sequence.store(sequence + 1, std::memory_order_release);
+    ::pthread_mutex_unlock(&slot->lock);
+}
+
+} // namespace asgard
@@ -0,0 +1,87 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+/**
+ * Projector cache shared by the asgard processes of a host
+ *
+ * The cache lives in a file mapped by every process, typically in /dev/shm.
+ * It is a fixed array of slots of slot_size bytes, grouped in buckets of a
+ * few slots: a key can only be stored in the slots of its bucket, the oldest
+ * one being replaced.
+ *
+ * Nothing in the file is protected by a process-wide mutex, a process dying
+ * while holding one would block the others:
+ *  - the file is initialized under a flock, released by the kernel when its
+ *    holder dies,
+ *  - a writer locks a slot with the slot's robust process-shared mutex, never
+ *    waiting for it. The lock of a writer that died is taken over by the next
+ *    one, whatever the pid namespaces of the processes,
+ *  - the slot's sequence is odd while it is written, a reader checks it before
+ *    and after copying the slot: a slot written meanwhile is a miss,
+ *  - the content of a slot is checksummed, a half written slot is a miss.
+ * The header identifies the tileset and the projection parameters, processes
+ * configured differently cannot map the same cache.
+ */
+
+#pragma once
+
+#include "asgard/compact_projection.h"
+#include "asgard/projector_cache.h"
+#include "asgard/projector_snapshot.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace asgard {
+
+struct SharedCacheHeader;
+struct SharedCacheSlot;
+
+class SharedProjectorCache {
+public:
+    // Map the cache at path, creating it if needed. Throws if it cannot be mapped,
+    // or if it has been created for another tileset, other projection parameters or another size.
+    SharedProjectorCache(const std::string& path,
+                         const SnapshotHeader& projection_header,
+                         double key_precision,
+                         size_t nb_slots,
+                         size_t slot_size = 512);
+    ~SharedProjectorCache();
+
+    SharedProjectorCache(const SharedProjectorCache&) = delete;
+    SharedProjectorCache& operator=(const SharedProjectorCache&) = delete;
+
+    // False if the key is not in the cache or its slot is being written
+    bool find(const ProjectorKey& key, CompactProjection& projection) const;
+    // The projections larger than a slot, or of an unknown mode, are not shared
+    void insert(const ProjectorKey& key, const CompactProjection& projection);
+
+    size_t get_nb_slots() const { return nb_slots; }
+    size_t get_slot_size() const { return slot_size; }
+
+private:
+    SharedCacheSlot* get_slot(size_t bucket, size_t way) const;
+
+    size_t nb_slots;
+    size_t slot_size;
+    size_t nb_bytes = 0;
+    char* data = nullptr;
+    SharedCacheHeader* header = nullptr;
+};
+
+} // namespace asgard
@@ -0,0 +1,104 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#include "asgard/shortest_path_tree.h"
+
+#include <valhalla/baldr/graphconstants.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace asgard {
+
+ShortestPathTree::ShortestPathTree(std::vector<Label> labels) : labels(std::move(labels)) {
+    std::sort(this->labels.begin(), this->labels.end(), [](const Label& a, const Label& b) { return a.edge < b.edge; });
+    this->labels.shrink_to_fit();
+}
+
+boost::optional<valhalla::thor::TimeDistance> ShortestPathTree::find(const valhalla::Location& location) const {
+    if (location.path_edges_size() == 0) {
+        return boost::none;
+    }
+    float best_cost = std::numeric_limits<float>::max();
+    valhalla::thor::TimeDistance best;
+    for (const auto& path_edge : location.path_edges()) {
+        const auto it = std::lower_bound(labels.begin(), labels.end(), path_edge.graph_id(), [](const Label& l, uint64_t edge) { return l.edge < edge; });
+        if (it == labels.end() || it->edge != path_edge.graph_id()) {
+            return boost::none;
+        }
+        // the part of the edge after the location
+        const float remainder = 1.f - path_edge.percent_along();
+        const float cost = it->cost - it->edge_cost * remainder;
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = valhalla::thor::TimeDistance(static_cast<uint32_t>(it->secs - it->edge_secs * remainder),
+                                                static_cast<uint32_t>(it->distance - it->edge_length * remainder));
+        }
+    }
+    return best;
+}
+
+std::shared_ptr<const ShortestPathTree> ReusableTimeDistanceMatrix::get_tree() const {
+    std::vector<ShortestPathTree::Label> labels;
+    labels.reserve(edgelabels_.size());
+    for (const auto& label : edgelabels_) {
+        if (label.predecessor() == valhalla::baldr::kInvalidLabel ||
+            edgestatus_.Get(label.edgeid()).set() != valhalla::thor::EdgeSet::kPermanent) {
+            continue;
+        }
+        const auto& pred = edgelabels_[label.predecessor()];
+        const auto edge_cost = label.cost() - pred.cost() - label.transition_cost();
+        labels.push_back(ShortestPathTree::Label{static_cast<uint64_t>(label.edgeid()),
+                                                 label.cost().cost,
+                                                 edge_cost.cost,
+                                                 label.cost().secs,
+                                                 edge_cost.secs,
+                                                 label.path_distance(),
+                                                 label.path_distance() - pred.path_distance()});
+    }
+    return std::make_shared<const ShortestPathTree>(std::move(labels));
+}
+
+void ReusableTimeDistanceMatrix::get_labels(valhalla::baldr::GraphReader& graph,
+                                            const valhalla::Location& origin,
+                                            bool reverse,
+                                            std::vector<ExpansionLabel>& labels) const {
+    labels.clear();
+    labels.reserve(edgelabels_.size());
+    for (const auto& label : edgelabels_) {
+        // a reverse expansion goes through the opposing edges
+        const auto edge = reverse ? static_cast<uint64_t>(graph.GetOpposingEdgeId(label.edgeid())) : static_cast<uint64_t>(label.edgeid());
+        const bool settled = edgestatus_.Get(label.edgeid()).set() == valhalla::thor::EdgeSet::kPermanent;
+        if (label.predecessor() == valhalla::baldr::kInvalidLabel) {
+            float percent_along = 0.f;
+            for (const auto& path_edge : origin.path_edges()) {
+                if (path_edge.graph_id() == edge) {
+                    percent_along = path_edge.percent_along();
+                }
+            }
+            labels.push_back(ExpansionLabel{edge, label.cost().cost, label.cost().cost, label.cost().secs, label.cost().secs,
+                                            label.path_distance(), label.path_distance(), true, percent_along, settled});
+            continue;
+        }
+        const auto& pred = edgelabels_[label.predecessor()];
+        const auto edge_cost = label.cost() - pred.cost() - label.transition_cost();
+        labels.push_back(ExpansionLabel{edge, label.cost().cost, edge_cost.cost, label.cost().secs, edge_cost.secs,
+                                        label.path_distance(), label.path_distance() - pred.path_distance(), false, 0.f, settled});
+    }
+}
+
+} // namespace asgard
@@ -0,0 +1,117 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <valhalla/proto/tripcommon.pb.h>
+#include <valhalla/thor/timedistancematrix.h>
+
+#include <boost/optional.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace asgard {
+
+/**
+ * The edges settled by a one-to-many expansion of TimeDistanceMatrix.
+ *
+ * Dijkstra settles the edges by increasing cost, so the cost of a settled
+ * edge is final whatever the targets were. For a location whose edges are
+ * all settled, the cost is computed as TimeDistanceMatrix does it: the cost
+ * at the end of the edge minus the part of the edge after the location.
+ */
+class ShortestPathTree {
+public:
+    struct Label {
+        uint64_t edge;
+        // at the end of the edge, and of the edge alone
+        float cost;
+        float edge_cost;
+        float secs;
+        float edge_secs;
+        uint32_t distance;
+        uint32_t edge_length;
+    };
+
+    // labels of distinct edges
+    explicit ShortestPathTree(std::vector<Label> labels);
+
+    // The time and distance to the location, none if one of its edges is not settled
+    boost::optional<valhalla::thor::TimeDistance> find(const valhalla::Location& location) const;
+
+    size_t get_nb_labels() const { return labels.size(); }
+    size_t get_nb_bytes() const { return sizeof(*this) + labels.capacity() * sizeof(Label); }
+
+private:
+    // sorted by edge
+    std::vector<Label> labels;
+};
+
+// A label of an expansion, settled or not
+struct ExpansionLabel {
+    // in the direction of travel, whatever the direction of the expansion
+    uint64_t edge;
+    // from the origin to the end of the edge for a forward expansion, from the start
+    // of the edge to the origin for a reverse one, and of the edge alone
+    float cost;
+    float edge_cost;
+    float secs;
+    float edge_secs;
+    uint32_t distance;
+    uint32_t edge_length;
+    // an edge of the origin location, only traversed from or to the location
+    bool origin;
+    float percent_along;
+    bool settled;
+};
+
+// A TimeDistanceMatrix giving access to the edges it settled during its last expansion
+class ReusableTimeDistanceMatrix : public valhalla::thor::TimeDistanceMatrix {
+public:
+    // SourceToTarget clears the labels after each expansion, this one keeps them until Clear
+    std::vector<valhalla::thor::TimeDistance> one_to_many(const valhalla::Location& origin,
+                                                          const google::protobuf::RepeatedPtrField<valhalla::Location>& targets,
+                                                          valhalla::baldr::GraphReader& graph,
+                                                          const valhalla::sif::mode_costing_t& costing,
+                                                          valhalla::sif::TravelMode mode,
+                                                          float max_distance) {
+        return OneToMany(origin, targets, graph, costing, mode, max_distance);
+    }
+
+    // A single reverse expansion from the destination, the labels are kept until Clear as well
+    std::vector<valhalla::thor::TimeDistance> many_to_one(const valhalla::Location& destination,
+                                                          const google::protobuf::RepeatedPtrField<valhalla::Location>& sources,
+                                                          valhalla::baldr::GraphReader& graph,
+                                                          const valhalla::sif::mode_costing_t& costing,
+                                                          valhalla::sif::TravelMode mode,
+                                                          float max_distance) {
+        return ManyToOne(destination, sources, graph, costing, mode, max_distance);
+    }
+
+    // The edges settled by the last one_to_many, the origin edges, only partially traversed, are left out
+    std::shared_ptr<const ShortestPathTree> get_tree() const;
+
+    // All the labels of the last expansion from origin, many_to_one if reverse
+    void get_labels(valhalla::baldr::GraphReader& graph,
+                    const valhalla::Location& origin,
+                    bool reverse,
+                    std::vector<ExpansionLabel>& labels) const;
+};
+
+} // namespace asgard
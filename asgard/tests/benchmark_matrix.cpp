@@ -0,0 +1,223 @@
+#include "asgard/bucket_matrix.h"
+#include "asgard/context.h"
+#include "asgard/handler.h"
+#include "asgard/matrix_algorithm.h"
+#include "asgard/matrix_pool.h"
+#include "asgard/metrics.h"
+#include "asgard/mode_costing.h"
+#include "asgard/projector.h"
+#include "asgard/request.pb.h"
+#include "asgard/util.h"
+
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/midgard/pointll.h>
+#include <valhalla/thor/costmatrix.h>
+
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <zmq.hpp>
+
+namespace po = boost::program_options;
+using namespace asgard;
+using valhalla::midgard::PointLL;
+
+namespace {
+
+const double METERS_PER_DEGREE = 111195.;
+
+// Random places uniformly spread in a disk around the center
+std::vector<PointLL> make_places(const PointLL& center, double radius, size_t nb_places, unsigned int seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    const double lng_scale = std::cos(center.lat() * M_PI / 180.);
+    std::vector<PointLL> places;
+    places.reserve(nb_places);
+    for (size_t i = 0; i < nb_places; ++i) {
+        const double r = radius * std::sqrt(uniform(gen)) / METERS_PER_DEGREE;
+        const double theta = 2 * M_PI * uniform(gen);
+        places.emplace_back(center.lng() + r * std::cos(theta) / lng_scale, center.lat() + r * std::sin(theta));
+    }
+    return places;
+}
+
+pbnavitia::Request make_request(const std::string& mode, uint32_t max_duration, const std::vector<PointLL>& sources, const std::vector<PointLL>& targets) {
+    pbnavitia::Request request;
+    request.set_requested_api(pbnavitia::street_network_routing_matrix);
+    auto* sn_request = request.mutable_sn_routing_matrix();
+    sn_request->set_mode(mode);
+    sn_request->set_max_duration(max_duration);
+    for (const auto& source : sources) {
+        auto* origin = sn_request->add_origins();
+        origin->set_lon(source.lng());
+        origin->set_lat(source.lat());
+    }
+    for (const auto& target : targets) {
+        auto* destination = sn_request->add_destinations();
+        destination->set_lon(target.lng());
+        destination->set_lat(target.lat());
+    }
+    return request;
+}
+
+template<typename F>
+double time_call(F f) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    return duration.count();
+}
+
+// The N x M matrices with an increasing number of sources, computed on the same projections by
+// TimeDistanceMatrix, the buckets and CostMatrix, next to the algorithm choose_matrix_algorithm picks
+void compare_engines(valhalla::baldr::GraphReader& graph, const Projector& projector, const std::string& mode, uint32_t max_duration,
+                     const std::vector<PointLL>& sources, const std::vector<PointLL>& targets) {
+    const auto template_request = make_request(mode, max_duration, {}, {});
+    const auto max_distance = get_max_distance(mode, template_request.sn_routing_matrix());
+    ModeCosting mode_costing;
+    mode_costing.update_costing(make_modecosting_args(template_request.sn_routing_matrix()));
+    const auto costing = mode_costing.get_costing_for_mode(mode);
+    const auto travel_mode = util::convert_navitia_to_valhalla_mode(mode);
+
+    google::protobuf::RepeatedPtrField<valhalla::Location> all_sources;
+    google::protobuf::RepeatedPtrField<valhalla::Location> valhalla_targets;
+    std::vector<bool> projected;
+    projector.project_to_valhalla_locations(sources.begin(), sources.end(), graph, mode, costing, true, all_sources, projected);
+    projector.project_to_valhalla_locations(targets.begin(), targets.end(), graph, mode, costing, true, valhalla_targets, projected);
+
+    ReusableTimeDistanceMatrix matrix;
+    BucketMatrix bucket_matrix;
+    valhalla::thor::CostMatrix cost_matrix;
+    std::cout << "max_distance = " << max_distance << std::endl;
+    std::cout << "sources\ttargets\ttime_distance (s)\tbucket (s)\tcost_matrix (s)\tchosen with the cost matrix" << std::endl;
+    for (int n = 2; n <= all_sources.size(); n *= 2) {
+        const google::protobuf::RepeatedPtrField<valhalla::Location> valhalla_sources(all_sources.begin(), all_sources.begin() + n);
+        const auto time_distance = time_call([&]() {
+            matrix.SourceToTarget(valhalla_sources, valhalla_targets, graph, mode_costing.get_costing(), travel_mode, max_distance);
+            matrix.Clear();
+        });
+        const auto bucket = time_call([&]() {
+            bucket_matrix.source_to_target(valhalla_sources, valhalla_targets, graph, matrix, mode_costing.get_costing(), travel_mode, max_distance);
+        });
+        const auto cost = time_call([&]() {
+            cost_matrix.SourceToTarget(valhalla_sources, valhalla_targets, graph, mode_costing.get_costing(), travel_mode, max_distance);
+            cost_matrix.Clear();
+        });
+        const auto chosen = choose_matrix_algorithm(mode, n, valhalla_targets.size(), max_distance, MatrixEngine::expansion, true);
+        std::cout << n << "\t" << valhalla_targets.size() << "\t" << time_distance << "\t" << bucket << "\t" << cost << "\t" << to_string(chosen) << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    po::options_description desc("Benchmark of the matrices with many targets");
+    std::string conf_path;
+    std::string mode;
+    double lng = 0;
+    double lat = 0;
+    double radius = 0;
+    size_t nb_sources = 0;
+    size_t nb_targets = 0;
+    size_t nb_requests = 0;
+    uint32_t max_duration = 0;
+    size_t cache_size = 0;
+    size_t nb_matrix_threads = 0;
+    float crow_fly_margin = 0;
+    bool crow_fly_filter = false;
+    bool with_engines = false;
+
+    // clang-format off
+    desc.add_options()
+            ("help", "Show this message")
+            ("conf_path,c", po::value<std::string>(&conf_path)->required(), "valhalla configuration")
+            ("mode", po::value<std::string>(&mode)->default_value("walking"), "mode of the matrices")
+            ("lng", po::value<double>(&lng)->default_value(2.3522), "longitude of the center, the source of the one-to-many matrices")
+            ("lat", po::value<double>(&lat)->default_value(48.8566), "latitude of the center")
+            ("radius", po::value<double>(&radius)->default_value(20000), "in meters, around the center, where the places are drawn")
+            ("sources", po::value<size_t>(&nb_sources)->default_value(1), "number of sources, drawn like the targets when more than one")
+            ("targets,n", po::value<size_t>(&nb_targets)->default_value(50000), "number of targets")
+            ("requests,r", po::value<size_t>(&nb_requests)->default_value(5), "number of requests, the first ones project the targets")
+            ("max_duration", po::value<uint32_t>(&max_duration)->default_value(1800), "max duration of the matrices, in seconds")
+            ("cache_size,s", po::value<size_t>(&cache_size)->default_value(100000), "size of the projector cache of each mode")
+            ("matrix_threads,t", po::value<size_t>(&nb_matrix_threads)->default_value(0), "threads of the matrix pool")
+            ("crow_fly_filter", po::bool_switch(&crow_fly_filter), "skip the targets out of reach as the crow flies")
+            ("crow_fly_margin", po::value<float>(&crow_fly_margin)->default_value(500), "in meters, the margin of the crow fly filter")
+            ("compare_engines", po::bool_switch(&with_engines), "time TimeDistanceMatrix, the buckets and CostMatrix from 2 sources up to the number of sources, not for bss");
+    // clang-format on
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+    po::notify(vm);
+
+    boost::property_tree::ptree conf;
+    boost::property_tree::read_json(conf_path, conf);
+    const auto& graph_conf = conf.get_child("mjolnir");
+
+    valhalla::baldr::GraphReader graph(graph_conf);
+    zmq::context_t zmq_context(1);
+    const Metrics metrics{boost::none};
+    const Projector projector(cache_size, cache_size, cache_size, cache_size);
+    const boost::optional<std::string> valhalla_service_url;
+    std::unique_ptr<const MatrixPool> matrix_pool;
+    if (nb_matrix_threads > 0) {
+        matrix_pool = std::make_unique<const MatrixPool>(graph_conf, nb_matrix_threads, 1);
+    }
+    boost::optional<float> margin;
+    if (crow_fly_filter) {
+        margin = crow_fly_margin;
+    }
+    Handler handler(Context(zmq_context, graph, metrics, projector, valhalla_service_url, nullptr, nullptr, matrix_pool.get(), true, margin));
+
+    const PointLL center{lng, lat};
+    const auto sources = nb_sources > 1 ? make_places(center, radius, nb_sources, 7) : std::vector<PointLL>{center};
+    const auto targets = make_places(center, radius, nb_targets, 42);
+    if (with_engines) {
+        if (mode == "bss") {
+            std::cout << "the engines are not compared for bss" << std::endl;
+            return 1;
+        }
+        compare_engines(graph, projector, mode, max_duration, sources, targets);
+        return 0;
+    }
+    const auto request = make_request(mode, max_duration, sources, targets);
+
+    std::cout << "mode = " << mode << std::endl;
+    std::cout << "nb_sources = " << sources.size() << std::endl;
+    std::cout << "nb_targets = " << nb_targets << std::endl;
+    std::cout << "radius = " << radius << std::endl;
+    std::cout << "crow_fly_filter = " << crow_fly_filter << std::endl;
+    std::cout << "request\tduration (s)\ttargets/s\treached" << std::endl;
+    std::vector<double> durations;
+    for (size_t i = 0; i < nb_requests; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto response = handler.handle(request);
+        const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+        durations.push_back(duration.count());
+
+        if (response.has_error()) {
+            std::cout << "error: " << response.error().message() << std::endl;
+            return 1;
+        }
+        size_t nb_reached = 0;
+        for (const auto& row : response.sn_routing_matrix().rows()) {
+            nb_reached += std::count_if(row.routing_response().begin(), row.routing_response().end(), [](const auto& r) {
+                return r.routing_status() == pbnavitia::RoutingStatus::reached;
+            });
+        }
+        std::cout << i << "\t" << duration.count() << "\t" << nb_targets / duration.count() << "\t" << nb_reached << std::endl;
+    }
+    std::sort(durations.begin(), durations.end());
+    std::cout << "median: " << durations[durations.size() / 2] << "s" << std::endl;
+}
@@ -1,8 +1,6 @@
 #include "asgard/mode_costing.h"
 #include "asgard/projector.h"
 
-#include "utils/timer.h"
-
 #include <valhalla/baldr/graphreader.h>
 #include <valhalla/midgard/pointll.h>
 
@@ -13,8 +11,10 @@
 #include <boost/range/algorithm/transform.hpp>
 
 #include <algorithm>
+#include <chrono>
 #include <random>
 #include <thread>
+#include <tuple>
 
 namespace po = boost::program_options;
 using namespace valhalla::baldr;
@@ -552,45 +552,96 @@ ListOfLocations build_list_of_locations(size_t nb_threads) {
     return list_of_locations;
 }
 
+double run(const Projector& projector, const boost::property_tree::ptree& conf, size_t nb_threads) {
+    auto l = build_list_of_locations(nb_threads);
+    boost::progress_display show_progress(l.size() * nb_threads);
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < nb_threads; ++i) {
+        auto t = std::thread(compute, std::ref(projector), conf, std::ref(show_progress), l);
+        threads.push_back(std::move(t));
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+    size_t nb_projections = 0;
+    for (const auto& locations : l) {
+        nb_projections += locations.size();
+    }
+    return nb_projections * nb_threads / duration.count();
+}
+
 int main(int argc, char** argv) {
     po::options_description desc("Options de l'outil de benchmark");
     size_t cache_size = 0;
     size_t nb_threads = 0;
     std::string conf_path = "";
+    std::string policy = "";
+    bool with_edge_index = false;
+    ProjectorCacheConf cache_conf;
 
     // clang-format off
     desc.add_options()
             ("help", "Show this message")
             ("size,s", po::value<size_t>(&cache_size)->default_value(10), "cache size")
-            ("threads,t", po::value<size_t>(&nb_threads)->default_value(3), "number of threads to run")
+            ("threads,t", po::value<size_t>(&nb_threads)->default_value(3), "maximum number of threads to run")
+            ("shards", po::value<size_t>(&cache_conf.nb_shards)->default_value(cache_conf.nb_shards), "number of shards of the cache")
+            ("policy", po::value<std::string>(&policy)->default_value(to_string(cache_conf.policy)), "eviction policy of the cache: lru, clock or tinylfu")
+            ("edge_index", po::bool_switch(&with_edge_index), "also run with the edge index, to compare it with loki")
             ("conf_path,c", po::value<std::string>(&conf_path)->default_value(""), "conf_path");
     // clang-format on
 
     po::variables_map vm;
     po::store(po::parse_command_line(argc, argv, desc), vm);
     po::notify(vm);
+    cache_conf.policy = parse_cache_policy(policy);
 
-    auto l = build_list_of_locations(nb_threads);
     std::cout << "cache_size = " << cache_size << std::endl;
     std::cout << "nb_threads = " << nb_threads << std::endl;
+    std::cout << "nb_shards = " << cache_conf.nb_shards << std::endl;
+    std::cout << "policy = " << policy << std::endl;
     std::cout << "conf_path = " << conf_path << std::endl;
 
     boost::property_tree::ptree conf;
     boost::property_tree::read_json(conf_path, conf);
-    Projector p(cache_size);
-    boost::progress_display show_progress(l.size() * nb_threads);
-    {
-        Timer t("Projector cache ");
-        std::vector<std::thread> threads;
 
-        for (size_t i = 0; i < nb_threads; ++i) {
-            auto t = std::thread(compute, std::ref(p), conf, std::ref(show_progress), l);
-            threads.push_back(std::move(t));
-        }
-        for (auto& th : threads) {
-            th.join();
+    // The same amount of work is shared by 1, 2, 4... threads, so that we can
+    // see how the projection scales with the number of workers
+    std::vector<size_t> thread_counts;
+    for (size_t n = 1; n < nb_threads; n *= 2) {
+        thread_counts.push_back(n);
+    }
+    thread_counts.push_back(nb_threads);
+
+    // loki alone, then with the edge index
+    std::vector<std::shared_ptr<const EdgeIndex>> edge_indexes = {nullptr};
+    if (with_edge_index) {
+        valhalla::baldr::GraphReader graph(conf.get_child("mjolnir"));
+        const auto start = std::chrono::steady_clock::now();
+        edge_indexes.push_back(std::make_shared<const EdgeIndex>(graph));
+        const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+        std::cout << "edge index built in " << duration.count() << "s" << std::endl;
+    }
+
+    // threads, loki or edge index, projections/s, cache hit ratio, edge index hit ratio
+    std::vector<std::tuple<size_t, std::string, double, double, double>> throughputs;
+    for (const auto n : thread_counts) {
+        for (const auto& index : edge_indexes) {
+            Projector p(cache_size, cache_size, cache_size, cache_size, 0, 0, 0, cache_conf);
+            p.set_edge_index(index);
+            const auto throughput = run(p, conf, n);
+            const auto nb_miss = std::max<size_t>(1, p.get_nb_cache_miss("car"));
+            const auto hit_ratio = 1. - static_cast<double>(p.get_nb_cache_miss("car")) / std::max<size_t>(1, p.get_nb_cache_calls("car"));
+            const auto index_ratio = static_cast<double>(p.get_nb_edge_index_hits("car")) / nb_miss;
+            throughputs.emplace_back(n, index ? "edge index" : "loki", throughput, hit_ratio, index_ratio);
         }
     }
 
-    std::cout << "Number of requests: " << l.size() << std::endl;
+    std::cout << "threads\tsearch\tprojections/s\thit ratio\tedge index hit ratio" << std::endl;
+    for (const auto& t : throughputs) {
+        std::cout << std::get<0>(t) << "\t" << std::get<1>(t) << "\t" << std::get<2>(t) << "\t" << std::get<3>(t) << "\t" << std::get<4>(t) << std::endl;
+    }
 }
@@ -6,10 +6,16 @@
 #include "utils/zmq.h"
 #include "asgard/conf.h"
 #include "asgard/context.h"
+#include "asgard/crow_fly_filter.h"
 #include "asgard/handler.h"
+#include "asgard/fallback_table.h"
+#include "asgard/matrix_algorithm.h"
+#include "asgard/matrix_cache.h"
+#include "asgard/matrix_pool.h"
 #include "asgard/metrics.h"
 #include "asgard/projector.h"
 #include "asgard/request.pb.h"
+#include "asgard/util.h"
 
 #include <valhalla/midgard/pointll.h>
 
@@ -87,6 +93,703 @@ BOOST_AUTO_TEST_CASE(handle_matrix_test) {
     BOOST_CHECK_EQUAL(expected_response.DebugString(), response.DebugString());
 }
 
+BOOST_AUTO_TEST_CASE(handle_matrix_with_cache_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    zmq::context_t context(1);
+    const Metrics metrics{boost::none};
+    const Projector projector{10, 0, 0};
+    const MatrixCache matrix_cache{10};
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+    boost::optional<std::string> valhalla_service_url;
+    Context c{context, graph, metrics, projector, valhalla_service_url, &matrix_cache};
+
+    Handler h{c};
+
+    const auto points = maker.get_all_points();
+    const std::vector<unsigned int> expected_times = {0, 111, 444, 667, 359, 568};
+    auto make_request = [&](const std::vector<size_t>& destinations, float walking_speed) {
+        pbnavitia::Request request;
+        request.set_requested_api(pbnavitia::street_network_routing_matrix);
+        auto* sn_request = request.mutable_sn_routing_matrix();
+        add_origin_or_dest_to_request(sn_request->add_origins(), make_string_from_point(points.front()));
+        for (const auto d : destinations) {
+            add_origin_or_dest_to_request(sn_request->add_destinations(), make_string_from_point(points[d]));
+        }
+        sn_request->set_mode("walking");
+        sn_request->set_max_duration(100000);
+        sn_request->mutable_streetnetwork_params()->set_walking_speed(walking_speed);
+        return request;
+    };
+    auto check_times = [&](const pbnavitia::Response& response, const std::vector<size_t>& destinations) {
+        BOOST_REQUIRE_EQUAL(response.sn_routing_matrix().rows_size(), 1);
+        const auto& row = response.sn_routing_matrix().rows(0);
+        BOOST_REQUIRE_EQUAL(row.routing_response_size(), static_cast<int>(destinations.size()));
+        for (size_t i = 0; i < destinations.size(); ++i) {
+            BOOST_CHECK_EQUAL(row.routing_response(i).duration(), expected_times[destinations[i]]);
+            BOOST_CHECK_EQUAL(row.routing_response(i).routing_status(), pbnavitia::RoutingStatus::reached);
+        }
+    };
+
+    const std::vector<size_t> first = {0, 1, 2};
+    check_times(h.handle(make_request(first, 2)), first);
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_hits("walking"), 0);
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_miss("walking"), 3);
+
+    // only the new destinations are computed
+    const std::vector<size_t> second = {5, 2, 4, 3, 1, 0};
+    check_times(h.handle(make_request(second, 2)), second);
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_hits("walking"), 3);
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_miss("walking"), 6);
+
+    check_times(h.handle(make_request(second, 2)), second);
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_hits("walking"), 9);
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_miss("walking"), 6);
+
+    // other costing parameters, another row
+    h.handle(make_request(first, 1));
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_miss("walking"), 9);
+    BOOST_CHECK_EQUAL(matrix_cache.size(), 2);
+    // the cache keeps no tree, none was built
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_trees(), 0);
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_tree_hits("walking"), 0);
+}
+
+BOOST_AUTO_TEST_CASE(handle_matrix_with_tree_cache_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    zmq::context_t context(1);
+    const Metrics metrics{boost::none};
+    const Projector projector{10, 0, 0};
+    // no room in the rows, the costs can only come from the trees
+    const MatrixCache matrix_cache{10, 0, 10};
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+    boost::optional<std::string> valhalla_service_url;
+    Context c{context, graph, metrics, projector, valhalla_service_url, &matrix_cache};
+    Context c_without_cache{context, graph, metrics, projector, valhalla_service_url};
+
+    Handler h{c};
+    Handler h_without_cache{c_without_cache};
+
+    const auto points = maker.get_all_points();
+    auto make_request = [&](const std::vector<midgard::PointLL>& destinations, float walking_speed) {
+        pbnavitia::Request request;
+        request.set_requested_api(pbnavitia::street_network_routing_matrix);
+        auto* sn_request = request.mutable_sn_routing_matrix();
+        add_origin_or_dest_to_request(sn_request->add_origins(), make_string_from_point(points.front()));
+        for (const auto& d : destinations) {
+            add_origin_or_dest_to_request(sn_request->add_destinations(), make_string_from_point(d));
+        }
+        sn_request->set_mode("walking");
+        sn_request->set_max_duration(100000);
+        sn_request->mutable_streetnetwork_params()->set_walking_speed(walking_speed);
+        return request;
+    };
+    // the same times, up to the rounding of the seconds, whether they are read from the tree or computed
+    auto check_times = [&](const std::vector<midgard::PointLL>& destinations) {
+        const auto response = h.handle(make_request(destinations, 2));
+        const auto expected = h_without_cache.handle(make_request(destinations, 2));
+        BOOST_REQUIRE_EQUAL(response.sn_routing_matrix().rows_size(), 1);
+        const auto& row = response.sn_routing_matrix().rows(0);
+        const auto& expected_row = expected.sn_routing_matrix().rows(0);
+        BOOST_REQUIRE_EQUAL(row.routing_response_size(), static_cast<int>(destinations.size()));
+        for (size_t i = 0; i < destinations.size(); ++i) {
+            BOOST_CHECK_EQUAL(row.routing_response(i).routing_status(), pbnavitia::RoutingStatus::reached);
+            BOOST_CHECK_EQUAL(expected_row.routing_response(i).routing_status(), pbnavitia::RoutingStatus::reached);
+            BOOST_CHECK_LE(std::abs(row.routing_response(i).duration() - expected_row.routing_response(i).duration()), 1);
+        }
+    };
+
+    // the node I, the farthest from A: the expansion to it settles all the edges of B, C and E both ways
+    const std::vector<midgard::PointLL> far = {{.020, .003}};
+    check_times(far);
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_trees(), 1);
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_tree_hits("walking"), 0);
+
+    // the middles of the edges B-C and B-E, both their directions are in the tree
+    const std::vector<midgard::PointLL> near = {{.006, .003}, {.005, .002}};
+    check_times(near);
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_tree_hits("walking"), 2);
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_trees(), 1);
+    // B-C is 333s long at 2 m/s, its middle is 111 + 333 / 2 s from A
+    const auto near_response = h.handle(make_request(near, 2));
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_tree_hits("walking"), 4);
+    BOOST_CHECK_LE(std::abs(near_response.sn_routing_matrix().rows(0).routing_response(0).duration() - 277), 1);
+
+    // other costing parameters, another tree
+    h.handle(make_request(far, 1));
+    BOOST_CHECK_EQUAL(matrix_cache.get_nb_trees(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(handle_matrix_with_fallback_table_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    zmq::context_t context(1);
+    const Metrics metrics{boost::none};
+    const Projector projector{10, 0, 0};
+
+    const auto points = maker.get_all_points();
+    auto make_request = [&](const std::vector<size_t>& origins, const std::vector<size_t>& destinations, float walking_speed) {
+        pbnavitia::Request request;
+        request.set_requested_api(pbnavitia::street_network_routing_matrix);
+        auto* sn_request = request.mutable_sn_routing_matrix();
+        for (const auto o : origins) {
+            add_origin_or_dest_to_request(sn_request->add_origins(), make_string_from_point(points[o]));
+        }
+        for (const auto d : destinations) {
+            add_origin_or_dest_to_request(sn_request->add_destinations(), make_string_from_point(points[d]));
+        }
+        sn_request->set_mode("walking");
+        sn_request->set_max_duration(1000);
+        sn_request->mutable_streetnetwork_params()->set_walking_speed(walking_speed);
+        return request;
+    };
+
+    // the times of the table are not the ones of the graph, to know where they come from
+    const auto table_request = make_request({0}, {0}, 2);
+    FallbackTable::ModeTable walking;
+    walking.mode = "walking";
+    walking.costing_hash = hash_value(make_modecosting_args(table_request.sn_routing_matrix()));
+    walking.max_duration = 1000;
+    walking.max_distance = get_max_distance("walking", table_request.sn_routing_matrix());
+    walking.stops = {points[0], points[1], points[2]};
+    walking.pairs = {{{0, 0}, {1, 10}, {2, 20}}, {{0, 11}, {1, 0}}, {{0, 21}, {2, 0}}};
+    const std::string path = maker.get_tile_dir() + "/fallback_table.bin";
+    FallbackTable::save(path, 0, {walking});
+    const FallbackTable table(path);
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+    boost::optional<std::string> valhalla_service_url;
+    Context c{context, graph, metrics, projector, valhalla_service_url, nullptr, &table};
+
+    Handler h{c};
+
+    auto get_durations = [](const pbnavitia::Response& response) {
+        BOOST_REQUIRE_EQUAL(response.sn_routing_matrix().rows_size(), 1);
+        std::vector<int> durations;
+        for (const auto& r : response.sn_routing_matrix().rows(0).routing_response()) {
+            durations.push_back(r.routing_status() == pbnavitia::RoutingStatus::reached ? r.duration() : -1);
+        }
+        return durations;
+    };
+
+    auto durations = get_durations(h.handle(make_request({0}, {1, 2, 0}, 2)));
+    BOOST_CHECK_EQUAL_COLLECTIONS(durations.begin(), durations.end(), std::vector<int>({10, 20, 0}).begin(), std::vector<int>({10, 20, 0}).end());
+    durations = get_durations(h.handle(make_request({1, 2}, {0}, 2)));
+    BOOST_CHECK_EQUAL_COLLECTIONS(durations.begin(), durations.end(), std::vector<int>({11, 21}).begin(), std::vector<int>({11, 21}).end());
+    // a pair beyond the bound of the table
+    durations = get_durations(h.handle(make_request({1}, {2}, 2)));
+    BOOST_CHECK_EQUAL(durations.at(0), -1);
+    BOOST_CHECK_EQUAL(table.get_nb_hits("walking"), 3);
+
+    // only the bounds of the table are served by it
+    std::vector<valhalla::thor::TimeDistance> costs;
+    BOOST_REQUIRE(table.find("walking", walking.costing_hash, 1000, walking.max_distance, {points[0]}, {points[1], points[2], points[0]}, costs));
+    BOOST_REQUIRE_EQUAL(costs.size(), 3);
+    BOOST_CHECK_EQUAL(costs[0].time, 10);
+    BOOST_CHECK_EQUAL(costs[1].time, 20);
+    BOOST_CHECK_EQUAL(costs[2].time, 0);
+    BOOST_CHECK(!table.find("walking", walking.costing_hash, 15, walking.max_distance / 2, {points[0]}, {points[1]}, costs));
+    BOOST_CHECK(!table.find("walking", walking.costing_hash, 1000, walking.max_distance / 2, {points[0]}, {points[1]}, costs));
+    BOOST_CHECK(!table.find("walking", walking.costing_hash, 1001, walking.max_distance, {points[0]}, {points[1]}, costs));
+    BOOST_CHECK_EQUAL(table.get_nb_hits("walking"), 4);
+    auto smaller = make_request({0}, {1}, 2);
+    smaller.mutable_sn_routing_matrix()->set_max_duration(999);
+    durations = get_durations(h.handle(smaller));
+    BOOST_CHECK_EQUAL(durations.at(0), 111);
+    BOOST_CHECK_EQUAL(table.get_nb_hits("walking"), 4);
+
+    // a place that is not a stop, or another costing, are computed on the graph
+    durations = get_durations(h.handle(make_request({0}, {1, 3}, 2)));
+    BOOST_CHECK_EQUAL(durations.at(0), 111);
+    durations = get_durations(h.handle(make_request({0}, {1}, 1)));
+    BOOST_CHECK_NE(durations.at(0), 10);
+    BOOST_CHECK_EQUAL(table.get_nb_hits("walking"), 4);
+}
+
+BOOST_AUTO_TEST_CASE(handle_many_to_many_matrix_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    zmq::context_t context(1);
+    const Metrics metrics{boost::none};
+    const Projector projector{10, 0, 0};
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+    boost::optional<std::string> valhalla_service_url;
+    Context c{context, graph, metrics, projector, valhalla_service_url};
+
+    Handler h{c};
+
+    pbnavitia::Request request;
+    request.set_requested_api(pbnavitia::street_network_routing_matrix);
+    auto* sn_request = request.mutable_sn_routing_matrix();
+    const auto points = maker.get_all_points();
+    add_origin_or_dest_to_request(sn_request->add_origins(), make_string_from_point(points[0]));
+    add_origin_or_dest_to_request(sn_request->add_origins(), make_string_from_point(points[1]));
+    for (const auto& p : points) {
+        add_origin_or_dest_to_request(sn_request->add_destinations(), make_string_from_point(p));
+    }
+    sn_request->set_mode("walking");
+    sn_request->set_max_duration(100000);
+    sn_request->mutable_streetnetwork_params()->set_walking_speed(2);
+
+    // a row per source, each with all the targets
+    const auto response = h.handle(request);
+    BOOST_REQUIRE_EQUAL(response.sn_routing_matrix().rows_size(), 2);
+    const auto& first_row = response.sn_routing_matrix().rows(0);
+    const auto& second_row = response.sn_routing_matrix().rows(1);
+    BOOST_REQUIRE_EQUAL(first_row.routing_response_size(), static_cast<int>(points.size()));
+    BOOST_REQUIRE_EQUAL(second_row.routing_response_size(), static_cast<int>(points.size()));
+    const std::vector<unsigned int> expected_times = {0, 111, 444, 667, 359, 568};
+    for (size_t j = 0; j < expected_times.size(); ++j) {
+        BOOST_CHECK_EQUAL(first_row.routing_response(j).duration(), expected_times[j]);
+        BOOST_CHECK_EQUAL(second_row.routing_response(j).routing_status(), pbnavitia::RoutingStatus::reached);
+    }
+    BOOST_CHECK_EQUAL(second_row.routing_response(0).duration(), 111);
+    BOOST_CHECK_EQUAL(second_row.routing_response(1).duration(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(handle_many_to_many_matrix_with_pool_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    zmq::context_t context(1);
+    const Metrics metrics{boost::none};
+    const Projector projector{10, 0, 0};
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+    boost::optional<std::string> valhalla_service_url;
+    // every matrix with several sources is split
+    const MatrixPool matrix_pool(conf, 2, 1);
+    Context c{context, graph, metrics, projector, valhalla_service_url};
+    Context c_with_pool{context, graph, metrics, projector, valhalla_service_url, nullptr, nullptr, &matrix_pool};
+
+    Handler h{c};
+    Handler h_with_pool{c_with_pool};
+
+    pbnavitia::Request request;
+    request.set_requested_api(pbnavitia::street_network_routing_matrix);
+    auto* sn_request = request.mutable_sn_routing_matrix();
+    const auto points = maker.get_all_points();
+    for (size_t i = 0; i < 3; ++i) {
+        add_origin_or_dest_to_request(sn_request->add_origins(), make_string_from_point(points[i]));
+    }
+    for (const auto& p : points) {
+        add_origin_or_dest_to_request(sn_request->add_destinations(), make_string_from_point(p));
+    }
+    sn_request->set_mode("walking");
+    sn_request->set_max_duration(100000);
+    sn_request->mutable_streetnetwork_params()->set_walking_speed(2);
+
+    // a row per source, whether the matrix is split or not
+    const auto response = h.handle(request);
+    const auto response_with_pool = h_with_pool.handle(request);
+    BOOST_REQUIRE_EQUAL(response.sn_routing_matrix().rows_size(), 3);
+    BOOST_REQUIRE_EQUAL(response_with_pool.sn_routing_matrix().rows_size(), 3);
+    for (int i = 0; i < 3; ++i) {
+        const auto& row = response.sn_routing_matrix().rows(i);
+        const auto& row_with_pool = response_with_pool.sn_routing_matrix().rows(i);
+        BOOST_REQUIRE_EQUAL(row.routing_response_size(), static_cast<int>(points.size()));
+        BOOST_REQUIRE_EQUAL(row_with_pool.routing_response_size(), static_cast<int>(points.size()));
+        BOOST_CHECK_EQUAL(row.routing_response(i).duration(), 0);
+        for (int j = 0; j < row.routing_response_size(); ++j) {
+            BOOST_CHECK_EQUAL(row.routing_response(j).duration(), row_with_pool.routing_response(j).duration());
+            BOOST_CHECK_EQUAL(row.routing_response(j).routing_status(), row_with_pool.routing_response(j).routing_status());
+        }
+    }
+    // the first source is the one of handle_matrix_test
+    const std::vector<unsigned int> expected_times = {0, 111, 444, 667, 359, 568};
+    for (size_t j = 0; j < expected_times.size(); ++j) {
+        BOOST_CHECK_EQUAL(response_with_pool.sn_routing_matrix().rows(0).routing_response(j).duration(), expected_times[j]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(handle_matrix_expanded_from_targets_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    zmq::context_t context(1);
+    const Metrics metrics{boost::none};
+    const Projector projector{10, 0, 0};
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+    boost::optional<std::string> valhalla_service_url;
+    const MatrixPool matrix_pool(conf, 2, 1);
+    Context c_forward{context, graph, metrics, projector, valhalla_service_url, nullptr, nullptr, nullptr, false};
+    Context c_auto{context, graph, metrics, projector, valhalla_service_url, nullptr, nullptr, nullptr, true};
+    Context c_auto_with_pool{context, graph, metrics, projector, valhalla_service_url, nullptr, nullptr, &matrix_pool, true};
+
+    Handler h_forward{c_forward};
+    Handler h_auto{c_auto};
+    Handler h_auto_with_pool{c_auto_with_pool};
+
+    // more sources than targets, the targets are expanded from
+    BOOST_CHECK(choose_direction(6, 2) == MatrixDirection::reverse);
+    BOOST_CHECK(choose_direction(2, 6) == MatrixDirection::forward);
+
+    pbnavitia::Request request;
+    request.set_requested_api(pbnavitia::street_network_routing_matrix);
+    auto* sn_request = request.mutable_sn_routing_matrix();
+    const auto points = maker.get_all_points();
+    for (const auto& p : points) {
+        add_origin_or_dest_to_request(sn_request->add_origins(), make_string_from_point(p));
+    }
+    for (size_t j = 0; j < 2; ++j) {
+        add_origin_or_dest_to_request(sn_request->add_destinations(), make_string_from_point(points[j]));
+    }
+    sn_request->set_mode("walking");
+    sn_request->set_max_duration(100000);
+    sn_request->mutable_streetnetwork_params()->set_walking_speed(2);
+
+    // the rows are the ones of the sources, whichever side is expanded
+    const auto response = h_forward.handle(request);
+    for (auto* h : {&h_auto, &h_auto_with_pool}) {
+        const auto response_auto = h->handle(request);
+        BOOST_REQUIRE_EQUAL(response.sn_routing_matrix().rows_size(), static_cast<int>(points.size()));
+        BOOST_REQUIRE_EQUAL(response_auto.sn_routing_matrix().rows_size(), static_cast<int>(points.size()));
+        for (int i = 0; i < response.sn_routing_matrix().rows_size(); ++i) {
+            const auto& row = response.sn_routing_matrix().rows(i);
+            const auto& row_auto = response_auto.sn_routing_matrix().rows(i);
+            BOOST_REQUIRE_EQUAL(row.routing_response_size(), 2);
+            BOOST_REQUIRE_EQUAL(row_auto.routing_response_size(), 2);
+            for (int j = 0; j < 2; ++j) {
+                BOOST_CHECK_EQUAL(row.routing_response(j).duration(), row_auto.routing_response(j).duration());
+                BOOST_CHECK_EQUAL(row.routing_response(j).routing_status(), row_auto.routing_response(j).routing_status());
+            }
+        }
+    }
+    // SourceToTarget expands from the 2 targets, the costs still come back by source: the times
+    // to the first point are the ones from it in handle_matrix_test, the paths being symmetric
+    const std::vector<int> expected_times = {0, 111, 444, 667, 359, 568};
+    for (size_t i = 0; i < points.size(); ++i) {
+        BOOST_CHECK_EQUAL(response.sn_routing_matrix().rows(static_cast<int>(i)).routing_response(0).duration(), expected_times[i]);
+    }
+    BOOST_CHECK_EQUAL(response.sn_routing_matrix().rows(0).routing_response(1).duration(), 111);
+    BOOST_CHECK_EQUAL(response.sn_routing_matrix().rows(1).routing_response(1).duration(), 0);
+    BOOST_CHECK_EQUAL(response.sn_routing_matrix().rows(2).routing_response(1).duration(), 333);
+}
+
+BOOST_AUTO_TEST_CASE(handle_matrix_with_crow_fly_filter_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    zmq::context_t context(1);
+    const Metrics metrics{boost::none};
+    const Projector projector{10, 0, 0};
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+    boost::optional<std::string> valhalla_service_url;
+    Context c{context, graph, metrics, projector, valhalla_service_url};
+    Context c_with_filter{context, graph, metrics, projector, valhalla_service_url, nullptr, nullptr, nullptr, true, 0.f};
+
+    Handler h{c};
+    Handler h_with_filter{c_with_filter};
+
+    const auto points = maker.get_all_points();
+    const midgard::PointLL far_away{points.front().lng() + 1, points.front().lat()};
+
+    std::vector<bool> reachable;
+    BOOST_CHECK_EQUAL(mark_reachable_targets({points.front()}, {points[1], far_away}, 2000, reachable), size_t(1));
+    BOOST_CHECK(reachable == std::vector<bool>({true, false}));
+    BOOST_CHECK_EQUAL(mark_reachable_targets({points.front(), far_away}, {points[1], far_away}, 2000, reachable), size_t(2));
+    BOOST_CHECK_EQUAL(mark_reachable_targets({points.front()}, {far_away}, 100000, reachable), size_t(0));
+
+    auto make_request = [&](const std::vector<midgard::PointLL>& targets) {
+        pbnavitia::Request request;
+        request.set_requested_api(pbnavitia::street_network_routing_matrix);
+        auto* sn_request = request.mutable_sn_routing_matrix();
+        add_origin_or_dest_to_request(sn_request->add_origins(), make_string_from_point(points.front()));
+        for (const auto& p : targets) {
+            add_origin_or_dest_to_request(sn_request->add_destinations(), make_string_from_point(p));
+        }
+        sn_request->set_mode("walking");
+        sn_request->set_max_duration(1000);
+        sn_request->mutable_streetnetwork_params()->set_walking_speed(2);
+        return request;
+    };
+
+    // bounded by the max duration at the top speed of the mode, not by the max distance of the search
+    BOOST_CHECK_EQUAL(get_max_crow_fly_distance("walking", make_request({}).sn_routing_matrix()), 4000.f);
+    auto car_request = make_request({});
+    car_request.mutable_sn_routing_matrix()->set_mode("car");
+    BOOST_CHECK_EQUAL(get_max_crow_fly_distance("car", car_request.sn_routing_matrix()), 50000.f);
+
+    // the target out of reach is unreached whether it is filtered or not
+    auto targets = points;
+    targets.push_back(far_away);
+    const auto response = h.handle(make_request(targets));
+    const auto response_with_filter = h_with_filter.handle(make_request(targets));
+    BOOST_CHECK_EQUAL(response.DebugString(), response_with_filter.DebugString());
+    const auto& row = response_with_filter.sn_routing_matrix().rows(0);
+    BOOST_REQUIRE_EQUAL(row.routing_response_size(), static_cast<int>(targets.size()));
+    BOOST_CHECK_EQUAL(row.routing_response(1).duration(), 111);
+    BOOST_CHECK_EQUAL(row.routing_response(points.size()).duration(), -1);
+    BOOST_CHECK_EQUAL(row.routing_response(points.size()).routing_status(), pbnavitia::RoutingStatus::unreached);
+
+    // when no target is in reach, the matrix is not an error
+    const auto response_far_away = h_with_filter.handle(make_request({far_away, far_away}));
+    BOOST_CHECK(!response_far_away.has_error());
+    BOOST_REQUIRE_EQUAL(response_far_away.sn_routing_matrix().rows(0).routing_response_size(), 2);
+    for (const auto& k : response_far_away.sn_routing_matrix().rows(0).routing_response()) {
+        BOOST_CHECK_EQUAL(k.routing_status(), pbnavitia::RoutingStatus::unreached);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(handle_large_matrix_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    zmq::context_t context(1);
+    const Metrics metrics{boost::none};
+    const Projector projector{10, 0, 0};
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+    boost::optional<std::string> valhalla_service_url;
+    Context c{context, graph, metrics, projector, valhalla_service_url};
+
+    Handler h{c};
+
+    // more places than the 10000 of the former fixed size masks
+    const size_t nb_places = 25000;
+    const auto points = maker.get_all_points();
+    const std::vector<int> expected_times = {0, 111, 444, 667, 359, 568};
+
+    for (const bool reverse : {false, true}) {
+        pbnavitia::Request request;
+        request.set_requested_api(pbnavitia::street_network_routing_matrix);
+        auto* sn_request = request.mutable_sn_routing_matrix();
+        auto* single = reverse ? sn_request->add_destinations() : sn_request->add_origins();
+        add_origin_or_dest_to_request(single, make_string_from_point(points.front()));
+        for (size_t i = 0; i < nb_places; ++i) {
+            auto* place = reverse ? sn_request->add_origins() : sn_request->add_destinations();
+            add_origin_or_dest_to_request(place, make_string_from_point(points[i % points.size()]));
+        }
+        sn_request->set_mode("walking");
+        sn_request->set_max_duration(100000);
+        sn_request->mutable_streetnetwork_params()->set_walking_speed(2);
+
+        // twice, with the buffers of the first request reused
+        for (size_t n = 0; n < 2; ++n) {
+            const auto response = h.handle(request);
+            BOOST_REQUIRE(!response.has_error());
+            BOOST_REQUIRE_EQUAL(response.sn_routing_matrix().rows_size(), 1);
+            const auto& row = response.sn_routing_matrix().rows(0);
+            BOOST_REQUIRE_EQUAL(row.routing_response_size(), static_cast<int>(nb_places));
+            if (!reverse) {
+                for (size_t i = 0; i < nb_places; ++i) {
+                    BOOST_REQUIRE_EQUAL(row.routing_response(i).duration(), expected_times[i % points.size()]);
+                    BOOST_REQUIRE_EQUAL(row.routing_response(i).routing_status(), pbnavitia::RoutingStatus::reached);
+                }
+            } else {
+                for (size_t i = 0; i < nb_places; ++i) {
+                    BOOST_REQUIRE_EQUAL(row.routing_response(i).routing_status(), pbnavitia::RoutingStatus::reached);
+                    BOOST_REQUIRE_EQUAL(row.routing_response(i).duration(), row.routing_response(i % points.size()).duration());
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(handle_matrix_with_bucket_engine_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    zmq::context_t context(1);
+    const Metrics metrics{boost::none};
+    const Projector projector{10, 0, 0};
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+    boost::optional<std::string> valhalla_service_url;
+    Context c{context, graph, metrics, projector, valhalla_service_url};
+    Context c_bucket{context, graph, metrics, projector, valhalla_service_url, nullptr, nullptr, nullptr, true, boost::none, MatrixEngine::bucket};
+
+    Handler h{c};
+    Handler h_bucket{c_bucket};
+
+    BOOST_CHECK(parse_matrix_engine("bucket") == MatrixEngine::bucket);
+    BOOST_CHECK_EQUAL(to_string(MatrixEngine::expansion), "expansion");
+    BOOST_CHECK_THROW(parse_matrix_engine("plop"), std::invalid_argument);
+
+    pbnavitia::Request request;
+    request.set_requested_api(pbnavitia::street_network_routing_matrix);
+    auto* sn_request = request.mutable_sn_routing_matrix();
+    const auto points = maker.get_all_points();
+    for (const auto& p : points) {
+        add_origin_or_dest_to_request(sn_request->add_origins(), make_string_from_point(p));
+        add_origin_or_dest_to_request(sn_request->add_destinations(), make_string_from_point(p));
+    }
+    sn_request->set_mode("walking");
+    sn_request->set_max_duration(100000);
+    sn_request->mutable_streetnetwork_params()->set_walking_speed(2);
+
+    // the same shortest paths, up to the rounding of the seconds
+    const auto response = h.handle(request);
+    const auto response_bucket = h_bucket.handle(request);
+    BOOST_REQUIRE_EQUAL(response_bucket.sn_routing_matrix().rows_size(), static_cast<int>(points.size()));
+    for (int i = 0; i < response.sn_routing_matrix().rows_size(); ++i) {
+        const auto& row = response.sn_routing_matrix().rows(i);
+        const auto& row_bucket = response_bucket.sn_routing_matrix().rows(i);
+        BOOST_REQUIRE_EQUAL(row_bucket.routing_response_size(), static_cast<int>(points.size()));
+        BOOST_CHECK_EQUAL(row_bucket.routing_response(i).duration(), 0);
+        for (int j = 0; j < row.routing_response_size(); ++j) {
+            BOOST_CHECK_EQUAL(row.routing_response(j).routing_status(), row_bucket.routing_response(j).routing_status());
+            BOOST_CHECK_LE(std::abs(row.routing_response(j).duration() - row_bucket.routing_response(j).duration()), 1);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bucket_matrix_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+    const Projector projector{10, 0, 0};
+    ModeCosting mode_costing;
+    const auto costing = mode_costing.get_costing_for_mode("walking");
+    const auto travel_mode = util::convert_navitia_to_valhalla_mode("walking");
+
+    // different sources and targets, two of them on the same edge b-c
+    const auto points = maker.get_all_points();
+    const std::vector<midgard::PointLL> source_places = {points[0], points[2], points[4], {.006, .003}};
+    const std::vector<midgard::PointLL> target_places = {points[1], points[3], points[5], {.0075, .003}, {.005, .002}};
+    google::protobuf::RepeatedPtrField<valhalla::Location> sources;
+    google::protobuf::RepeatedPtrField<valhalla::Location> targets;
+    std::vector<bool> projected;
+    projector.project_to_valhalla_locations(begin(source_places), end(source_places), graph, "walking", costing, false, sources, projected);
+    projector.project_to_valhalla_locations(begin(target_places), end(target_places), graph, "walking", costing, false, targets, projected);
+    BOOST_REQUIRE_EQUAL(sources.size(), 4);
+    BOOST_REQUIRE_EQUAL(targets.size(), 5);
+
+    ReusableTimeDistanceMatrix matrix;
+    BucketMatrix bucket_matrix;
+    // the number of pairs reached by SourceToTarget, each with the same cost from the buckets
+    auto compare = [&](float max_distance) {
+        const auto expected = matrix.SourceToTarget(sources, targets, graph, mode_costing.get_costing(), travel_mode, max_distance);
+        matrix.Clear();
+        const auto costs = bucket_matrix.source_to_target(sources, targets, graph, matrix, mode_costing.get_costing(), travel_mode, max_distance);
+        BOOST_REQUIRE_EQUAL(costs.size(), expected.size());
+        size_t nb_reached = 0;
+        for (size_t i = 0; i < costs.size(); ++i) {
+            // the buckets search a bit further, they reach at least the same pairs
+            if (expected[i].time == thor::kMaxCost) {
+                continue;
+            }
+            ++nb_reached;
+            BOOST_CHECK_LE(std::abs(static_cast<int64_t>(costs[i].time) - static_cast<int64_t>(expected[i].time)), 1);
+            BOOST_CHECK_LE(std::abs(static_cast<int64_t>(costs[i].distance) - static_cast<int64_t>(expected[i].distance)), 1);
+        }
+        return nb_reached;
+    };
+    BOOST_CHECK_EQUAL(compare(100000), 20);
+    BOOST_CHECK(compare(600) > 0);
+}
+
+BOOST_AUTO_TEST_CASE(handle_matrix_with_cost_matrix_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    zmq::context_t context(1);
+    const Metrics metrics{boost::none};
+    const Projector projector{10, 0, 0};
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+    boost::optional<std::string> valhalla_service_url;
+    Context c{context, graph, metrics, projector, valhalla_service_url, nullptr, nullptr, nullptr, true, boost::none, MatrixEngine::expansion, false};
+    Context c_cost_matrix{context, graph, metrics, projector, valhalla_service_url, nullptr, nullptr, nullptr, true, boost::none, MatrixEngine::expansion, true};
+
+    Handler h{c};
+    Handler h_cost_matrix{c_cost_matrix};
+
+    // CostMatrix for the car matrices with many sources and targets far away from each other
+    BOOST_CHECK(choose_matrix_algorithm("car", 100, 100, 10000, MatrixEngine::expansion, true) == MatrixAlgorithm::cost_matrix);
+    BOOST_CHECK(choose_matrix_algorithm("car", 100, 100, 10000, MatrixEngine::expansion, false) == MatrixAlgorithm::time_distance);
+    BOOST_CHECK(choose_matrix_algorithm("car", 2, 1000, 10000, MatrixEngine::expansion, true) == MatrixAlgorithm::time_distance);
+    BOOST_CHECK(choose_matrix_algorithm("taxi", 1, 100, 10000, MatrixEngine::expansion, true) == MatrixAlgorithm::time_distance);
+    BOOST_CHECK(choose_matrix_algorithm("walking", 100, 100, 10000, MatrixEngine::expansion, true) == MatrixAlgorithm::time_distance);
+    BOOST_CHECK(choose_matrix_algorithm("walking", 100, 100, 10000, MatrixEngine::bucket, true) == MatrixAlgorithm::bucket);
+    BOOST_CHECK(choose_matrix_algorithm("bss", 100, 100, 10000, MatrixEngine::bucket, true) == MatrixAlgorithm::time_distance);
+    BOOST_CHECK_EQUAL(to_string(MatrixAlgorithm::cost_matrix), "cost_matrix");
+
+    // the crossover of the estimates at 10 km: S x S matrices up to 4000 places, or 2 x T matrices up to 4 targets
+    BOOST_CHECK(choose_matrix_algorithm("car", 3999, 3999, 10000, MatrixEngine::expansion, true) == MatrixAlgorithm::cost_matrix);
+    BOOST_CHECK(choose_matrix_algorithm("car", 4001, 4001, 10000, MatrixEngine::expansion, true) == MatrixAlgorithm::time_distance);
+    BOOST_CHECK(choose_matrix_algorithm("car", 2, 4, 10000, MatrixEngine::expansion, true) == MatrixAlgorithm::cost_matrix);
+    BOOST_CHECK(choose_matrix_algorithm("car", 2, 5, 10000, MatrixEngine::expansion, true) == MatrixAlgorithm::time_distance);
+
+    pbnavitia::Request request;
+    request.set_requested_api(pbnavitia::street_network_routing_matrix);
+    auto* sn_request = request.mutable_sn_routing_matrix();
+    const auto points = maker.get_all_points();
+    for (const auto& p : points) {
+        add_origin_or_dest_to_request(sn_request->add_origins(), make_string_from_point(p));
+        add_origin_or_dest_to_request(sn_request->add_destinations(), make_string_from_point(p));
+    }
+    sn_request->set_mode("car");
+    sn_request->set_max_duration(100000);
+
+    // the same shortest paths, up to the rounding of the seconds
+    const auto response = h.handle(request);
+    const auto response_cost_matrix = h_cost_matrix.handle(request);
+    BOOST_REQUIRE_EQUAL(response_cost_matrix.sn_routing_matrix().rows_size(), static_cast<int>(points.size()));
+    for (int i = 0; i < response.sn_routing_matrix().rows_size(); ++i) {
+        const auto& row = response.sn_routing_matrix().rows(i);
+        const auto& row_cost_matrix = response_cost_matrix.sn_routing_matrix().rows(i);
+        BOOST_REQUIRE_EQUAL(row_cost_matrix.routing_response_size(), static_cast<int>(points.size()));
+        BOOST_CHECK_EQUAL(row_cost_matrix.routing_response(i).duration(), 0);
+        for (int j = 0; j < row.routing_response_size(); ++j) {
+            BOOST_CHECK_EQUAL(row.routing_response(j).routing_status(), row_cost_matrix.routing_response(j).routing_status());
+            BOOST_CHECK_LE(std::abs(row.routing_response(j).duration() - row_cost_matrix.routing_response(j).duration()), 1);
+        }
+    }
+
+    // the places further than the max duration are unreached by both algorithms
+    const auto max_duration = response.sn_routing_matrix().rows(0).routing_response(1).duration();
+    BOOST_REQUIRE_GT(max_duration, 1);
+    sn_request->set_max_duration(max_duration);
+    const auto short_response = h.handle(request);
+    const auto short_response_cost_matrix = h_cost_matrix.handle(request);
+    int nb_unreached = 0;
+    for (int i = 0; i < short_response.sn_routing_matrix().rows_size(); ++i) {
+        const auto& row = short_response.sn_routing_matrix().rows(i);
+        const auto& row_cost_matrix = short_response_cost_matrix.sn_routing_matrix().rows(i);
+        for (int j = 0; j < row.routing_response_size(); ++j) {
+            if (std::abs(row.routing_response(j).duration() - max_duration) > 1) {
+                BOOST_CHECK_EQUAL(row.routing_response(j).routing_status(), row_cost_matrix.routing_response(j).routing_status());
+            }
+            nb_unreached += row_cost_matrix.routing_response(j).routing_status() == pbnavitia::RoutingStatus::unreached;
+        }
+    }
+    BOOST_CHECK_GT(nb_unreached, 0);
+}
+
 void check_journey_trivial_direct_path(const pbnavitia::Response& response,
                                        const std::string& origin_uri,
                                        const std::string& destination_uri,
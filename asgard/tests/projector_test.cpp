@@ -6,12 +6,16 @@
 #include "asgard/mode_costing.h"
 #include "asgard/projector.h"
 #include "asgard/util.h"
+#include "asgard/warmup.h"
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/test/unit_test.hpp>
 
 #include <valhalla/midgard/pointll.h>
 
+#include <cstdio>
+#include <sstream>
+
 using namespace valhalla;
 
 namespace asgard {
@@ -21,11 +25,13 @@ public:
     UnitTestProjector(size_t cache_size_walking = 5,
                       size_t cache_size_bike = 5,
                       size_t cache_size_car = 5,
+                      size_t cache_size_taxi = 5,
                       unsigned int min_outbound_reach = 0,
                       unsigned int min_inbound_reach = 0,
                       unsigned int radius = 0) : p(cache_size_walking,
                                                    cache_size_bike,
                                                    cache_size_car,
+                                                   cache_size_taxi,
                                                    min_outbound_reach, min_inbound_reach, radius) {}
 
     valhalla::baldr::Location build_location(const std::string& place,
@@ -61,7 +67,9 @@ BOOST_AUTO_TEST_CASE(simple_projector_test) {
 
     ModeCosting mode_costing;
     auto costing = mode_costing.get_costing_for_mode("car");
-    Projector p(2, 2, 2);
+    ProjectorCacheConf cache_conf;
+    cache_conf.negative_cache_size = 10;
+    Projector p(2, 2, 2, 1000, 0, 0, 0, cache_conf);
     // cache = {}
     {
         auto locations = make_pointLLs({"coord:2:2"});
@@ -119,6 +127,16 @@ BOOST_AUTO_TEST_CASE(simple_projector_test) {
         BOOST_CHECK_EQUAL(p.get_nb_cache_calls("car"), 7);
     }
     // cache = { coord:.009:.001; coord:.013:.001 }
+    // the failure of coord:2:2 is known, loki is not called again
+    {
+        auto locations = make_pointLLs({"coord:2:2"});
+        auto result = p(begin(locations), end(locations), graph, "car", costing);
+        BOOST_CHECK_EQUAL(result.size(), 0);
+        BOOST_CHECK_EQUAL(p.get_nb_cache_miss("car"), 5);
+        BOOST_CHECK_EQUAL(p.get_nb_cache_calls("car"), 8);
+        BOOST_CHECK_EQUAL(p.get_nb_negative_cache_hits("car"), 1);
+        BOOST_CHECK_EQUAL(p.get_negative_cache_size(), 1);
+    }
 }
 
 BOOST_AUTO_TEST_CASE(multi_cache_test) {
@@ -202,6 +220,616 @@ BOOST_AUTO_TEST_CASE(multi_cache_test) {
     BOOST_CHECK_EQUAL(p.get_nb_cache_calls("none"), 0);
 }
 
+BOOST_AUTO_TEST_CASE(mode_cache_test) {
+    BOOST_CHECK(parse_projector_mode("walking") == ProjectorMode::walking);
+    BOOST_CHECK(parse_projector_mode("bss") == ProjectorMode::walking);
+    BOOST_CHECK(parse_projector_mode("bike") == ProjectorMode::bike);
+    BOOST_CHECK(parse_projector_mode("car") == ProjectorMode::car);
+    BOOST_CHECK(parse_projector_mode("taxi") == ProjectorMode::taxi);
+    BOOST_CHECK(!parse_projector_mode("none"));
+    BOOST_CHECK_EQUAL(to_string(ProjectorMode::taxi), "taxi");
+
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+
+    ModeCosting mode_costing;
+    // every mode is bounded by its own size
+    Projector p(1, 2, 3, 4, 0, 0, 0, ProjectorCacheConf{1});
+    const auto locations = make_pointLLs({"coord:.003:.001", "coord:.009:.001", "coord:.013:.001", "coord:.004:.005"});
+    for (const auto& mode : {"walking", "bike", "car", "taxi"}) {
+        const auto result = p(begin(locations), end(locations), graph, mode, mode_costing.get_costing_for_mode(mode));
+        BOOST_CHECK_EQUAL(result.size(), 4);
+        BOOST_CHECK_EQUAL(p.get_nb_cache_calls(mode), 4);
+    }
+    BOOST_CHECK_EQUAL(p.get_current_cache_size("walking"), 1);
+    BOOST_CHECK_EQUAL(p.get_current_cache_size("bike"), 2);
+    BOOST_CHECK_EQUAL(p.get_current_cache_size("car"), 3);
+    BOOST_CHECK_EQUAL(p.get_current_cache_size("taxi"), 4);
+
+    // taxi has its own cache, the last location of walking is shared with bss
+    const auto taxi_locations = make_pointLLs({"coord:.004:.005"});
+    p(begin(taxi_locations), end(taxi_locations), graph, "taxi", mode_costing.get_costing_for_mode("taxi"));
+    BOOST_CHECK_EQUAL(p.get_nb_cache_miss("taxi"), 4);
+    p(begin(taxi_locations), end(taxi_locations), graph, "bss", mode_costing.get_costing_for_mode("bss"));
+    BOOST_CHECK_EQUAL(p.get_nb_cache_miss("walking"), 4);
+    BOOST_CHECK_EQUAL(p.get_nb_cache_calls("walking"), 5);
+    BOOST_CHECK_EQUAL(p.get_nb_cache_calls("bss"), 5);
+}
+
+BOOST_AUTO_TEST_CASE(quantized_key_test) {
+    BOOST_CHECK(quantize(midgard::PointLL{.0030004, .0009996}, 1e-4) == quantize(midgard::PointLL{.003, .001}, 1e-4));
+    BOOST_CHECK(quantize(midgard::PointLL{.0030004, .0009996}, 0) == (midgard::PointLL{.0030004, .0009996}));
+
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+
+    ModeCosting mode_costing;
+    const auto costing = mode_costing.get_costing_for_mode("walking");
+    // about 2 meters from each other, in the same cell of 1e-4 degree
+    const auto first = make_pointLLs({"coord:.003:.001"});
+    const auto close = make_pointLLs({"coord:.00302:.001"});
+    // in the next cell
+    const auto other = make_pointLLs({"coord:.0032:.001"});
+
+    ProjectorCacheConf cache_conf;
+    cache_conf.key_precision = 1e-4;
+    Projector p(10, 10, 10, 10, 0, 0, 0, cache_conf);
+    p(begin(first), end(first), graph, "walking", costing);
+    const auto result = p(begin(close), end(close), graph, "walking", costing);
+    BOOST_CHECK_EQUAL(p.get_nb_cache_miss("walking"), 1);
+    BOOST_REQUIRE_EQUAL(result.count(close.front()), 1);
+    BOOST_CHECK(result.at(close.front()).latlng_ == close.front());
+    p(begin(other), end(other), graph, "walking", costing);
+    BOOST_CHECK_EQUAL(p.get_nb_cache_miss("walking"), 2);
+
+    // too far from the projected place to reuse its projection
+    cache_conf.key_tolerance = 1;
+    Projector strict(10, 10, 10, 10, 0, 0, 0, cache_conf);
+    strict(begin(first), end(first), graph, "walking", costing);
+    strict(begin(close), end(close), graph, "walking", costing);
+    BOOST_CHECK_EQUAL(strict.get_nb_cache_miss("walking"), 2);
+    strict(begin(first), end(first), graph, "walking", costing);
+    BOOST_CHECK_EQUAL(strict.get_nb_cache_miss("walking"), 2);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+
+    ModeCosting mode_costing;
+    auto costing = mode_costing.get_costing_for_mode("car");
+    const std::string snapshot_path = std::string(TESTS_BUILD_DIR) + "projector_snapshot.bin";
+
+    const auto locations = make_pointLLs({"coord:.003:.001", "coord:.009:.001", "coord:2:2"});
+    Projector p(10, 10, 10);
+    const auto projected = p(begin(locations), end(locations), graph, "car", costing);
+    BOOST_CHECK_EQUAL(projected.size(), 2);
+    BOOST_CHECK_EQUAL(p.save(snapshot_path, graph), 2);
+
+    // the projections are served from the cache right after the load
+    Projector loaded(10, 10, 10);
+    BOOST_CHECK_EQUAL(loaded.load(snapshot_path, graph), 2);
+    BOOST_CHECK_EQUAL(loaded.get_current_cache_size("car"), 2);
+    const auto result = loaded(begin(locations), begin(locations) + 2, graph, "car", costing);
+    BOOST_CHECK_EQUAL(result.size(), 2);
+    BOOST_CHECK_EQUAL(loaded.get_nb_cache_miss("car"), 0);
+    for (const auto& l : result) {
+        const auto& expected = projected.at(l.first);
+        BOOST_REQUIRE_EQUAL(l.second.edges.size(), expected.edges.size());
+        for (size_t i = 0; i < expected.edges.size(); ++i) {
+            BOOST_CHECK_EQUAL(l.second.edges[i].id, expected.edges[i].id);
+            BOOST_CHECK_EQUAL(l.second.edges[i].percent_along, expected.edges[i].percent_along);
+            BOOST_CHECK_CLOSE(l.second.edges[i].distance, expected.edges[i].distance, .0001);
+        }
+    }
+
+    // a snapshot built with other projection parameters is ignored
+    Projector other(10, 10, 10, 10, 30, 30, 20);
+    BOOST_CHECK_EQUAL(other.load(snapshot_path, graph), 0);
+    BOOST_CHECK_EQUAL(other.get_current_cache_size("car"), 0);
+
+    // with quantized keys, the tolerance is still measured from the place projected,
+    // about 2 meters from its key .003:.001
+    ProjectorCacheConf cache_conf;
+    cache_conf.key_precision = 1e-4;
+    cache_conf.key_tolerance = 1;
+    const auto off_grid = make_pointLLs({"coord:.00302:.001"});
+    Projector quantized(10, 10, 10, 10, 0, 0, 0, cache_conf);
+    quantized(begin(off_grid), end(off_grid), graph, "car", costing);
+    BOOST_CHECK_EQUAL(quantized.save(snapshot_path, graph), 1);
+    Projector quantized_loaded(10, 10, 10, 10, 0, 0, 0, cache_conf);
+    BOOST_CHECK_EQUAL(quantized_loaded.load(snapshot_path, graph), 1);
+    BOOST_CHECK_EQUAL(quantized_loaded(begin(off_grid), end(off_grid), graph, "car", costing).size(), 1);
+    BOOST_CHECK_EQUAL(quantized_loaded.get_nb_cache_miss("car"), 0);
+    const auto on_grid = make_pointLLs({"coord:.003:.001"});
+    quantized_loaded(begin(on_grid), end(on_grid), graph, "car", costing);
+    BOOST_CHECK_EQUAL(quantized_loaded.get_nb_cache_miss("car"), 1);
+
+    // the keys of another precision would never be found
+    Projector exact(10, 10, 10);
+    BOOST_CHECK_EQUAL(exact.load(snapshot_path, graph), 0);
+}
+
+BOOST_AUTO_TEST_CASE(shared_cache_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+
+    ModeCosting mode_costing;
+    const auto costing = mode_costing.get_costing_for_mode("car");
+    const auto locations = make_pointLLs({"coord:.003:.001", "coord:.009:.001"});
+
+    // two projectors mapping the same file, as two processes would
+    const std::string cache_path = std::string(TESTS_BUILD_DIR) + "shared_projector_cache.bin";
+    std::remove(cache_path.c_str());
+    Projector first(10, 10, 10, 10);
+    first.set_shared_cache(std::make_shared<SharedProjectorCache>(cache_path, first.make_snapshot_header(graph), 0, 100));
+    Projector second(10, 10, 10, 10);
+    second.set_shared_cache(std::make_shared<SharedProjectorCache>(cache_path, second.make_snapshot_header(graph), 0, 100));
+
+    const auto expected = first(begin(locations), end(locations), graph, "car", costing);
+    BOOST_CHECK_EQUAL(first.get_nb_cache_miss("car"), 2);
+    BOOST_CHECK_EQUAL(first.get_nb_shared_cache_hits("car"), 0);
+
+    const auto result = second(begin(locations), end(locations), graph, "car", costing);
+    BOOST_CHECK_EQUAL(second.get_nb_shared_cache_hits("car"), 2);
+    BOOST_CHECK_EQUAL(second.get_nb_cache_miss("car"), 0);
+    BOOST_CHECK_EQUAL(second.get_current_cache_size("car"), 2);
+    BOOST_REQUIRE_EQUAL(result.size(), expected.size());
+    for (const auto& place : locations) {
+        BOOST_REQUIRE_EQUAL(result.at(place).edges.size(), expected.at(place).edges.size());
+        BOOST_CHECK_EQUAL(result.at(place).edges.front().id, expected.at(place).edges.front().id);
+    }
+    // other modes are not mixed up
+    second(begin(locations), end(locations), graph, "walking", mode_costing.get_costing_for_mode("walking"));
+    BOOST_CHECK_EQUAL(second.get_nb_shared_cache_hits("walking"), 0);
+
+    // a process with other projection parameters cannot use it
+    Projector other(10, 10, 10, 10, 0, 0, 50);
+    BOOST_CHECK_THROW(SharedProjectorCache(cache_path, other.make_snapshot_header(graph), 0, 100), std::runtime_error);
+    BOOST_CHECK_THROW(SharedProjectorCache(cache_path, first.make_snapshot_header(graph), 0, 200), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(valhalla_locations_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+
+    ModeCosting mode_costing;
+    auto costing = mode_costing.get_costing_for_mode("car");
+    // a duplicate and a failure in the middle
+    const auto locations = make_pointLLs({"coord:.003:.001", "coord:2:2", "coord:.009:.001", "coord:.003:.001"});
+    const std::vector<bool> expected_mask = {true, false, true, true};
+
+    // the expected locations, in order
+    ProjectorCacheConf cache_conf;
+    cache_conf.negative_cache_size = 10;
+    Projector p(10, 10, 10, 1000, 0, 0, 0, cache_conf);
+    const auto projected = p(begin(locations), end(locations), graph, "car", costing, false);
+    std::vector<std::string> expected;
+    for (const auto& place : {locations[0], locations[2], locations[3]}) {
+        valhalla::Location location;
+        baldr::PathLocation::toPBF(projected.at(place), &location, graph);
+        expected.push_back(location.SerializeAsString());
+    }
+    // the cached coordinates of the edges are rounded to about 1cm, all the rest is what toPBF builds
+    auto check_edges = [](google::protobuf::RepeatedPtrField<valhalla::Location::PathEdge>& edges,
+                          google::protobuf::RepeatedPtrField<valhalla::Location::PathEdge>& expected_edges) {
+        BOOST_REQUIRE_EQUAL(edges.size(), expected_edges.size());
+        for (int j = 0; j < edges.size(); ++j) {
+            auto* e = edges.Mutable(j);
+            auto* expected_e = expected_edges.Mutable(j);
+            BOOST_CHECK_SMALL(e->ll().lng() - expected_e->ll().lng(), 1e-6);
+            BOOST_CHECK_SMALL(e->ll().lat() - expected_e->ll().lat(), 1e-6);
+            e->clear_ll();
+            expected_e->clear_ll();
+        }
+    };
+    auto check_location = [&](valhalla::Location location, const std::string& serialized) {
+        valhalla::Location expected_location;
+        BOOST_REQUIRE(expected_location.ParseFromString(serialized));
+        check_edges(*location.mutable_path_edges(), *expected_location.mutable_path_edges());
+        check_edges(*location.mutable_filtered_edges(), *expected_location.mutable_filtered_edges());
+        BOOST_CHECK_EQUAL(location.SerializeAsString(), expected_location.SerializeAsString());
+    };
+    auto check = [&](const google::protobuf::RepeatedPtrField<valhalla::Location>& results, const std::vector<bool>& mask) {
+        BOOST_CHECK(mask == expected_mask);
+        BOOST_REQUIRE_EQUAL(results.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            check_location(results.Get(i), expected[i]);
+        }
+    };
+
+    google::protobuf::RepeatedPtrField<valhalla::Location> results;
+    std::vector<bool> mask;
+    p.project_to_valhalla_locations(begin(locations), end(locations), graph, "car", costing, true, results, mask);
+    check(results, mask);
+    BOOST_CHECK_EQUAL(p.get_nb_cache_miss("car"), 4);
+
+    // the second time, the locations come from the cache, edge names included,
+    // in the buffers of the previous call
+    p.project_to_valhalla_locations(begin(locations), end(locations), graph, "car", costing, true, results, mask);
+    check(results, mask);
+    BOOST_CHECK_EQUAL(p.get_nb_cache_miss("car"), 4);
+    BOOST_CHECK_EQUAL(p.get_nb_negative_cache_hits("car"), 1);
+
+    p.project_to_valhalla_locations(begin(locations), end(locations), graph, "car", costing, false, results, mask);
+    check(results, mask);
+    BOOST_CHECK_EQUAL(p.get_nb_cache_calls("car"), 8);
+
+    // a shorter request in the same buffers
+    p.project_to_valhalla_locations(begin(locations) + 1, begin(locations) + 3, graph, "car", costing, true, results, mask);
+    BOOST_CHECK(mask == std::vector<bool>({false, true}));
+    BOOST_REQUIRE_EQUAL(results.size(), 1);
+    check_location(results.Get(0), expected[1]);
+}
+
+BOOST_AUTO_TEST_CASE(edge_index_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+
+    const auto index = std::make_shared<const EdgeIndex>(graph);
+    BOOST_CHECK(index->get_nb_segments() > 0);
+    BOOST_CHECK(index->get_nb_cells() > 0);
+
+    ModeCosting mode_costing;
+    const auto walking = mode_costing.get_costing_for_mode("walking");
+
+    // far from the graph, left to loki
+    BOOST_CHECK(!index->find(baldr::Location(midgard::PointLL{2, 2}), ProjectorMode::walking, graph, walking));
+
+    // the index finds the same edges as loki, or nothing, next to the edges forbidden to the cars too
+    const auto locations = make_pointLLs({"coord:.011:.0032", "coord:.005:.0029", "coord:.003:.001", "coord:.015:.0031",
+                                          "coord:.0145:.0031", "coord:.018:.0031", "coord:.0025:.0031"});
+    size_t nb_found = 0;
+    for (const auto& mode : {"walking", "bike", "car"}) {
+        const auto costing = mode_costing.get_costing_for_mode(mode);
+        for (const auto& place : locations) {
+            const baldr::Location location(place);
+            const auto projection = index->find(location, *parse_projector_mode(mode), graph, costing);
+            if (!projection) {
+                continue;
+            }
+            ++nb_found;
+            const auto expected = loki::Search({location}, graph, costing);
+            BOOST_REQUIRE_EQUAL(expected.count(location), 1);
+            const auto& expected_edges = expected.at(location).edges;
+            BOOST_REQUIRE_EQUAL(projection->edges.size(), expected_edges.size());
+            for (const auto& e : projection->edges) {
+                const auto it = std::find_if(expected_edges.begin(), expected_edges.end(), [&](const auto& x) { return x.id == e.id; });
+                BOOST_REQUIRE(it != expected_edges.end());
+                BOOST_CHECK_CLOSE(e.percent_along, it->percent_along, 1.);
+                BOOST_CHECK_CLOSE(e.distance, it->distance, 1.);
+                BOOST_CHECK_EQUAL(e.sos, it->sos);
+            }
+        }
+    }
+    BOOST_CHECK(nb_found > 0);
+
+    // the reach is left to loki
+    const baldr::Location with_reach(locations.front(), baldr::Location::StopType::BREAK, 2, 2);
+    BOOST_CHECK(!index->find(with_reach, ProjectorMode::walking, graph, walking));
+
+    // the projector only calls loki for what the index cannot answer
+    Projector p(10, 10, 10, 10);
+    p.set_edge_index(index);
+    const auto projected = p(begin(locations), end(locations), graph, "walking", mode_costing.get_costing_for_mode("walking"));
+    BOOST_CHECK_EQUAL(projected.size(), locations.size());
+    BOOST_CHECK(p.get_nb_edge_index_hits("walking") > 0);
+    BOOST_CHECK(p.get_nb_edge_index_hits("walking") <= p.get_nb_cache_miss("walking"));
+    BOOST_CHECK_EQUAL(p.get_nb_edge_index_hits("car"), 0);
+}
+
+BOOST_AUTO_TEST_CASE(projection_pool_test) {
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+    valhalla::baldr::GraphReader graph(conf);
+
+    ModeCosting mode_costing;
+    auto costing = mode_costing.get_costing_for_mode("car");
+    std::vector<baldr::Location> locations;
+    for (const auto& place : make_pointLLs({"coord:.003:.001", "coord:.009:.001", "coord:2:2", "coord:.013:.001", "coord:.004:.001"})) {
+        locations.emplace_back(place);
+    }
+
+    // batches of 1 location, spread on the pool's 2 threads and the calling one
+    const ProjectionPool pool(conf, 2, 1);
+    BOOST_CHECK_EQUAL(pool.get_nb_threads(), 2);
+    const auto expected = loki::Search(locations, graph, costing);
+    const auto results = pool.search(locations, graph, costing);
+    BOOST_REQUIRE_EQUAL(results.size(), expected.size());
+    for (const auto& l : expected) {
+        const auto& edges = results.at(l.first).edges;
+        BOOST_REQUIRE_EQUAL(edges.size(), l.second.edges.size());
+        for (size_t i = 0; i < edges.size(); ++i) {
+            BOOST_CHECK_EQUAL(edges[i].id, l.second.edges[i].id);
+        }
+    }
+
+    // small searches are not split
+    const ProjectionPool big_batches(conf, 2, 1000);
+    BOOST_CHECK_EQUAL(big_batches.search(locations, graph, costing).size(), expected.size());
+
+    Projector p(10, 10, 10);
+    p.set_projection_pool(std::make_shared<ProjectionPool>(conf, 2, 1));
+    const auto places = make_pointLLs({"coord:.003:.001", "coord:.009:.001", "coord:2:2", "coord:.013:.001"});
+    BOOST_CHECK_EQUAL(p(begin(places), end(places), graph, "car", costing).size(), 3);
+    BOOST_CHECK_EQUAL(p.get_current_cache_size("car"), 3);
+    BOOST_CHECK_EQUAL(p(begin(places), end(places), graph, "car", costing, false).size(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(warmup_test) {
+    std::istringstream in("# stop points\n"
+                          "\n"
+                          "coord:.003:.001 car\n"
+                          ".009;.001 car walking\n"
+                          "coord:.013:.001\n"
+                          "coord:.007:.001 plane\n"
+                          "not_a_coord car\n");
+    const auto locations = warmup::read_warmup_locations(in);
+    BOOST_CHECK_EQUAL(locations.at("car").size(), 3);
+    BOOST_CHECK_EQUAL(locations.at("walking").size(), 2);
+    BOOST_CHECK_EQUAL(locations.at("bike").size(), 1);
+    BOOST_CHECK_EQUAL(locations.count("plane"), 0);
+
+    tile_maker::TileMaker maker;
+    maker.make_tile();
+
+    boost::property_tree::ptree conf;
+    conf.put("tile_dir", maker.get_tile_dir());
+
+    Projector p(10, 10, 10);
+    BOOST_CHECK_EQUAL(warmup::warmup_projector(p, locations, conf, 2), 6);
+    BOOST_CHECK_EQUAL(p.get_current_cache_size("car"), 3);
+
+    // the warm coordinates are now cache hits
+    valhalla::baldr::GraphReader graph(conf);
+    ModeCosting mode_costing;
+    const auto& car_locations = locations.at("car");
+    const auto nb_miss = p.get_nb_cache_miss("car");
+    p(begin(car_locations), end(car_locations), graph, "car", mode_costing.get_costing_for_mode("car"));
+    BOOST_CHECK_EQUAL(p.get_nb_cache_miss("car"), nb_miss);
+}
+
+BOOST_AUTO_TEST_CASE(sharded_cache_test) {
+    // small caches are not split, to keep an exact LRU
+    BOOST_CHECK_EQUAL(ProjectorCache(2, 16).get_nb_shards(), 1);
+    BOOST_CHECK_EQUAL(ProjectorCache(0, 16).get_nb_shards(), 1);
+    BOOST_CHECK_EQUAL(ProjectorCache(ProjectorCache::min_shard_size * 4, 16).get_nb_shards(), 4);
+    BOOST_CHECK_EQUAL(ProjectorCache(50000, 16).get_nb_shards(), 16);
+
+    ProjectorCache cache(8000, 8);
+    for (size_t i = 0; i < 1000; ++i) {
+        midgard::PointLL p{i * .001, .001};
+        baldr::PathLocation location{baldr::Location(p)};
+        location.edges.emplace_back(baldr::GraphId(i), 0., p, 0.f);
+        cache.insert(std::make_pair(p, "walking"), CompactProjection(location));
+    }
+    BOOST_CHECK_EQUAL(cache.size(), 1000);
+    for (size_t i = 0; i < 1000; ++i) {
+        midgard::PointLL p{i * .001, .001};
+        auto cached = cache.find(std::make_pair(p, "walking"));
+        BOOST_REQUIRE(cached);
+        BOOST_REQUIRE_EQUAL(cached->get_nb_edges(), 1);
+        BOOST_CHECK_EQUAL(cached->get_edges().front().id, baldr::GraphId(i));
+        BOOST_CHECK(!cache.find(std::make_pair(p, "car")));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(clock_cache_test) {
+    auto key = [](double lon) { return std::make_pair(midgard::PointLL{lon, .001}, std::string("walking")); };
+    auto value = [](double) { return CompactProjection(); };
+
+    ClockCacheShard cache(2);
+    cache.insert(key(1), value(1));
+    cache.insert(key(2), value(2));
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+
+    // 1 is referenced, so it gets a second chance and 2 is evicted
+    BOOST_CHECK(cache.find(key(1)));
+    cache.insert(key(3), value(3));
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+    BOOST_CHECK(cache.find(key(1)));
+    BOOST_CHECK(!cache.find(key(2)));
+    BOOST_CHECK(cache.find(key(3)));
+
+    ClockCacheShard empty_cache(0);
+    empty_cache.insert(key(1), value(1));
+    BOOST_CHECK_EQUAL(empty_cache.size(), 0);
+    BOOST_CHECK(!empty_cache.find(key(1)));
+}
+
+BOOST_AUTO_TEST_CASE(tinylfu_cache_test) {
+    auto key = [](double lon) { return std::make_pair(midgard::PointLL{lon, .001}, std::string("walking")); };
+    auto value = [](double) { return CompactProjection(); };
+
+    TinyLfuCacheShard tinylfu(1000);
+    LruCacheShard lru(1000);
+    for (CacheShard* cache : std::vector<CacheShard*>{&tinylfu, &lru}) {
+        for (int i = 0; i < 1000; ++i) {
+            cache->insert(key(i), value(i));
+        }
+        // 5 is hot
+        for (int i = 0; i < 10; ++i) {
+            BOOST_CHECK(cache->find(key(5)));
+        }
+        // followed by a scan of one-shot coordinates, twice as large as the cache
+        for (int i = 1000; i < 3000; ++i) {
+            if (!cache->find(key(i))) {
+                cache->insert(key(i), value(i));
+            }
+        }
+        BOOST_CHECK_EQUAL(cache->size(), 1000);
+    }
+    // the scan flushed the LRU, but could not evict the hot entry of the TinyLFU
+    BOOST_CHECK(!lru.find(key(5)));
+    BOOST_CHECK(tinylfu.find(key(5)));
+    BOOST_CHECK(tinylfu.get_nb_rejected() > 0);
+    BOOST_CHECK_EQUAL(lru.get_nb_rejected(), 0);
+
+    TinyLfuCacheShard empty_cache(0);
+    empty_cache.insert(key(1), value(1));
+    BOOST_CHECK_EQUAL(empty_cache.size(), 0);
+    BOOST_CHECK(!empty_cache.find(key(1)));
+
+    BOOST_CHECK(parse_cache_policy("tinylfu") == CachePolicy::tinylfu);
+    BOOST_CHECK_EQUAL(to_string(CachePolicy::tinylfu), "tinylfu");
+
+    Projector projector(10, 10, 10, 10, 0, 0, 0, ProjectorCacheConf{1, CachePolicy::tinylfu});
+    BOOST_CHECK(projector.has_admission_policy());
+    BOOST_CHECK(!Projector().has_admission_policy());
+}
+
+BOOST_AUTO_TEST_CASE(compact_projection_test) {
+    const midgard::PointLL place{2.3522219, 48.856614};
+    baldr::PathLocation location{baldr::Location(place)};
+    // a percent_along a float cannot hold
+    location.edges.emplace_back(baldr::GraphId(42), .123456789012345, midgard::PointLL{2.3522, 48.8566}, 12.5f, baldr::PathLocation::LEFT, 10, 70000);
+    location.edges.emplace_back(baldr::GraphId(43), 1., midgard::PointLL{2.3523, 48.8567}, 13.f);
+    location.filtered_edges.emplace_back(baldr::GraphId(44), 0., midgard::PointLL{2.3524, 48.8568}, 50.f, baldr::PathLocation::RIGHT);
+
+    const CompactProjection compact(location);
+    BOOST_CHECK_EQUAL(compact.get_nb_edges(), 3);
+    BOOST_CHECK(compact.get_names().empty());
+
+    // the names of the edges, in the order of toPBF
+    valhalla::Location pbf;
+    pbf.add_path_edges()->add_names("rue de Rivoli");
+    auto* named_edge = pbf.add_path_edges();
+    named_edge->add_names("A1");
+    named_edge->add_names("E15");
+    pbf.add_filtered_edges();
+    BOOST_CHECK_EQUAL(CompactProjection(location, pbf).get_names(), std::string("rue de Rivoli\0A1\0E15\0", 21));
+
+    const auto rebuilt = compact.to_path_location(baldr::Location(place));
+    BOOST_CHECK(rebuilt.latlng_ == place);
+    for (const auto& edges : {std::make_pair(&location.edges, &rebuilt.edges), std::make_pair(&location.filtered_edges, &rebuilt.filtered_edges)}) {
+        BOOST_REQUIRE_EQUAL(edges.first->size(), edges.second->size());
+        for (size_t i = 0; i < edges.first->size(); ++i) {
+            const auto& expected = (*edges.first)[i];
+            const auto& e = (*edges.second)[i];
+            BOOST_CHECK_EQUAL(e.id, expected.id);
+            // not rounded, unlike the coordinates
+            BOOST_CHECK_EQUAL(e.percent_along, expected.percent_along);
+            BOOST_CHECK_CLOSE(e.projected.lng(), expected.projected.lng(), .0001);
+            BOOST_CHECK_CLOSE(e.projected.lat(), expected.projected.lat(), .0001);
+            BOOST_CHECK_EQUAL(e.distance, expected.distance);
+            BOOST_CHECK_EQUAL(e.sos, expected.sos);
+            BOOST_CHECK_EQUAL(e.outbound_reach, expected.outbound_reach);
+        }
+    }
+    // the end of the edge is still recognized
+    BOOST_CHECK(rebuilt.edges[1].end_node());
+    // the reaches are saturated
+    BOOST_CHECK_EQUAL(rebuilt.edges[0].inbound_reach, 65535);
+}
+
+BOOST_AUTO_TEST_CASE(byte_budget_test) {
+    auto key = [](double lon, const std::string& mode) { return std::make_pair(midgard::PointLL{lon, .001}, mode); };
+    // an edge name long enough to live on the heap
+    baldr::PathLocation location(baldr::Location(midgard::PointLL{0, 0}));
+    location.edges.emplace_back(baldr::GraphId(42), .5, midgard::PointLL{0, 0}, 1.f);
+    valhalla::Location pbf;
+    pbf.add_path_edges()->add_names(std::string(200, 'x'));
+    const CompactProjection value(location, pbf);
+    const auto entry_bytes = CacheShard::get_entry_bytes(key(0, "walking"), value);
+    BOOST_CHECK(entry_bytes > 200);
+
+    for (const auto policy : {CachePolicy::lru, CachePolicy::clock, CachePolicy::tinylfu}) {
+        auto budget = std::make_shared<CacheByteBudget>(100 * entry_bytes);
+        ProjectorCache walking(1000, 4, policy, budget);
+        ProjectorCache car(1000, 4, policy, budget);
+
+        // the number of entries is not the limit anymore
+        for (int i = 0; i < 80; ++i) {
+            walking.insert(key(i, "walking"), value);
+        }
+        BOOST_CHECK_EQUAL(walking.size(), 80);
+        BOOST_CHECK_EQUAL(walking.get_nb_bytes(), 80 * entry_bytes);
+
+        // the budget is shared, car entries evict walking ones
+        for (int i = 0; i < 80; ++i) {
+            car.insert(key(i, "car"), value);
+        }
+        BOOST_CHECK(budget->get_nb_bytes() <= budget->get_max_bytes());
+        BOOST_CHECK_EQUAL(walking.get_nb_bytes() + car.get_nb_bytes(), budget->get_nb_bytes());
+        BOOST_CHECK_EQUAL(walking.size() + car.size(), 100);
+        BOOST_CHECK(walking.size() < 80);
+        BOOST_CHECK_EQUAL(walking.get_nb_bytes(), walking.size() * entry_bytes);
+    }
+
+    // evicting everything gives all the memory back
+    LruCacheShard lru(10);
+    ClockCacheShard clock(10);
+    TinyLfuCacheShard tinylfu(10);
+    for (CacheShard* cache : std::vector<CacheShard*>{&lru, &clock, &tinylfu}) {
+        for (int i = 0; i < 20; ++i) {
+            cache->insert(key(i, "walking"), value);
+        }
+        BOOST_CHECK_EQUAL(cache->get_nb_bytes(), cache->size() * entry_bytes);
+        while (cache->evict() > 0) {}
+        BOOST_CHECK_EQUAL(cache->size(), 0);
+        BOOST_CHECK_EQUAL(cache->get_nb_bytes(), 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(negative_cache_test) {
+    auto key = [](double lon, size_t costing_hash = 0) {
+        return std::make_pair(std::make_pair(midgard::PointLL{lon, .001}, std::string("walking")), costing_hash);
+    };
+    const auto now = NegativeCache::clock::now();
+
+    NegativeCache cache(2, std::chrono::seconds(60));
+    cache.insert(key(1), now);
+    BOOST_CHECK(cache.contains(key(1), now + std::chrono::seconds(59)));
+    BOOST_CHECK(!cache.contains(key(2), now));
+    BOOST_CHECK(!cache.contains(std::make_pair(std::make_pair(midgard::PointLL{1, .001}, std::string("car")), size_t(0)), now));
+    // another costing may project the place
+    BOOST_CHECK(!cache.contains(key(1, 42), now));
+
+    // the failures expire
+    BOOST_CHECK(!cache.contains(key(1), now + std::chrono::seconds(60)));
+    BOOST_CHECK_EQUAL(cache.size(), 0);
+
+    // the cache is bounded, the oldest failures go first
+    cache.insert(key(1), now);
+    cache.insert(key(2), now + std::chrono::seconds(1));
+    cache.insert(key(3), now + std::chrono::seconds(2));
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+    BOOST_CHECK(!cache.contains(key(1), now + std::chrono::seconds(2)));
+    BOOST_CHECK(cache.contains(key(2), now + std::chrono::seconds(2)));
+    BOOST_CHECK(cache.contains(key(3), now + std::chrono::seconds(2)));
+
+    NegativeCache disabled(0, std::chrono::seconds(60));
+    disabled.insert(key(1), now);
+    BOOST_CHECK(!disabled.contains(key(1), now));
+}
+
 BOOST_AUTO_TEST_CASE(build_location_test) {
     UnitTestProjector testProjector(3, 3, 3);
     {
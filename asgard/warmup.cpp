@@ -0,0 +1,135 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#include "asgard/warmup.h"
+#include "utils/coord_parser.h"
+#include "asgard/mode_costing.h"
+#include "asgard/projector.h"
+
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/midgard/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace asgard {
+
+namespace warmup {
+
+namespace {
+
+// Number of coordinates given to loki at once
+constexpr size_t BATCH_SIZE = 1000;
+
+const std::vector<std::string> DEFAULT_MODES = {"walking", "bike", "car"};
+const std::vector<std::string> SUPPORTED_MODES = {"walking", "bike", "car", "taxi", "bss"};
+
+struct Batch {
+    std::string mode;
+    std::vector<valhalla::midgard::PointLL>::const_iterator begin;
+    std::vector<valhalla::midgard::PointLL>::const_iterator end;
+};
+
+} // namespace
+
+WarmupLocations read_warmup_locations(std::istream& in) {
+    WarmupLocations locations;
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(in, line)) {
+        ++line_number;
+        std::istringstream line_stream(line);
+        std::string coord;
+        if (!(line_stream >> coord) || coord.front() == '#') {
+            continue;
+        }
+
+        valhalla::midgard::PointLL point;
+        try {
+            const auto c = navitia::parse_coordinate(coord);
+            point = valhalla::midgard::PointLL{c.first, c.second};
+        } catch (const navitia::wrong_coordinate&) {
+            LOG_WARN("Warmup: invalid coordinate " + coord + " at line " + std::to_string(line_number));
+            continue;
+        }
+
+        std::vector<std::string> modes{std::istream_iterator<std::string>(line_stream), std::istream_iterator<std::string>()};
+        if (modes.empty()) {
+            modes = DEFAULT_MODES;
+        }
+        for (const auto& mode : modes) {
+            if (std::find(SUPPORTED_MODES.begin(), SUPPORTED_MODES.end(), mode) == SUPPORTED_MODES.end()) {
+                LOG_WARN("Warmup: unknown mode " + mode + " at line " + std::to_string(line_number));
+                continue;
+            }
+            locations[mode].push_back(point);
+        }
+    }
+    return locations;
+}
+
+WarmupLocations read_warmup_file(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Cannot open warmup file " + path);
+    }
+    return read_warmup_locations(in);
+}
+
+size_t warmup_projector(const Projector& projector,
+                        const WarmupLocations& locations,
+                        const boost::property_tree::ptree& graph_conf,
+                        size_t nb_threads) {
+    std::vector<Batch> batches;
+    size_t nb_locations = 0;
+    for (const auto& l : locations) {
+        nb_locations += l.second.size();
+        for (auto it = l.second.begin(); it != l.second.end();) {
+            const auto batch_end = it + std::min<size_t>(BATCH_SIZE, std::distance(it, l.second.end()));
+            batches.push_back({l.first, it, batch_end});
+            it = batch_end;
+        }
+    }
+
+    std::atomic<size_t> next_batch{0};
+    auto work = [&]() {
+        valhalla::baldr::GraphReader graph(graph_conf);
+        ModeCosting mode_costing;
+        for (size_t i = next_batch++; i < batches.size(); i = next_batch++) {
+            const auto& batch = batches[i];
+            const auto costing = mode_costing.get_costing_for_mode(batch.mode);
+            projector(batch.begin, batch.end, graph, batch.mode, costing);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < std::max<size_t>(1, nb_threads); ++i) {
+        threads.emplace_back(work);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    return nb_locations;
+}
+
+} // namespace warmup
+
+} // namespace asgard
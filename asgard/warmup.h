@@ -0,0 +1,58 @@
+// Copyright 2017-2018, CanalTP and/or its affiliates. All rights reserved.
+//
+// LICENCE: This program is free software; you can redistribute it
+// and/or modify it under the terms of the GNU Affero General Public
+// License as published by the Free Software Foundation, either
+// version 3 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public
+// License along with this program. If not, see
+// <http://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <valhalla/midgard/pointll.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace asgard {
+
+class Projector;
+
+namespace warmup {
+
+// Coordinates to project for each mode
+using WarmupLocations = std::unordered_map<std::string, std::vector<valhalla::midgard::PointLL>>;
+
+/**
+ * Read the coordinates to project at startup
+ *
+ * One coordinate per line, followed by the modes to project it with:
+ *   2.37715;48.846781 walking bike
+ *   coord:2.32811:48.89283
+ * Without any mode the coordinate is projected with walking, bike and car.
+ * Empty lines and lines starting with # are ignored.
+ */
+WarmupLocations read_warmup_locations(std::istream& in);
+WarmupLocations read_warmup_file(const std::string& path);
+
+// Project all the locations in parallel to fill the projector's cache,
+// return the number of projections done
+size_t warmup_projector(const Projector& projector,
+                        const WarmupLocations& locations,
+                        const boost::property_tree::ptree& graph_conf,
+                        size_t nb_threads);
+
+} // namespace warmup
+
+} // namespace asgard